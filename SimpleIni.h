@@ -34,6 +34,9 @@
     - supports both char or wchar_t programming interfaces
     - supports both MBCS (system locale) and UTF-8 file encodings
     - system locale does not need to be UTF-8 on Linux/Unix to load UTF-8 file
+    - invalid UTF-8 files are rejected, see GetErrorOffset()
+    - optional line and column diagnostics for lines that can't be loaded
+    - optional !include and !includedir directives, see SetIncludes()
     - support for non-ASCII characters in section, keys, values and comments
     - support for non-standard character types or file encodings
       via user-written converter classes
@@ -99,6 +102,23 @@
     ofstream) then the flag ios_base::binary has been used when the file was
     opened.
 
+    @section mmap MEMORY MAPPED FILES
+
+    When SI_CHAR is char and the data needs no conversion (the default for
+    CSimpleIniA and CSimpleIniCaseA), LoadFileMapped() can be used instead of
+    LoadFile(). The file is mapped into memory with private copy-on-write
+    pages and parsed in place, so the data is held in memory only once and
+    is never written back to the file. The mapping is held until Reset() or
+    the object is destroyed, and on Windows the file cannot be overwritten
+    while it is mapped. Define SI_NO_MMAP to disable this support.
+
+    @section simd SIMD SCANNING
+
+    When SI_CHAR is char and SSE2 is available, the ends of section names,
+    keys, values and multi-line text are found 16 bytes at a time. The
+    results are identical to the scalar code used for other character types.
+    Define SI_NO_SIMD to disable this.
+
     @section multiline MULTI-LINE VALUES
 
     Values that span multiple lines are created using the following format.
@@ -212,16 +232,91 @@
 #endif
 
 #include <cstring>
+#include <cstddef>
+#include <climits>
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
 #include <algorithm>
+#include <new>
 #include <stdio.h>
 
 #ifdef SI_SUPPORT_IOSTREAMS
 # include <iostream>
 #endif // SI_SUPPORT_IOSTREAMS
 
+#if !defined(SI_NO_MMAP) && !defined(_WIN32_WCE)
+# if defined(_WIN32)
+#  include <windows.h>
+#  define SI_HAS_MMAP
+# elif defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  define SI_HAS_MMAP
+# endif
+#endif // SI_NO_MMAP
+
+// SI_ReplaceFile() flushes the new file to disk before renaming it
+#if defined(_WIN32) && !defined(_WIN32_WCE)
+# include <windows.h>
+# include <io.h>
+#elif defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+# define SI_HAS_FSYNC
+#endif
+
+// Files included by a load (see SetIncludes()) are read on several threads
+// unless SI_NO_THREADS is defined. POSIX builds then need -pthread.
+#if defined(_WIN32) && !defined(_WIN32_WCE)
+# ifndef SI_NO_THREADS
+#  include <process.h>
+#  define SI_HAS_THREADS
+# endif
+#elif defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <dirent.h>
+# include <unistd.h>
+# ifndef SI_NO_THREADS
+#  include <pthread.h>
+#  define SI_HAS_THREADS
+# endif
+#endif
+
+// Maximum nesting of included files, this also stops include loops
+#ifndef SI_MAX_INCLUDE_DEPTH
+# define SI_MAX_INCLUDE_DEPTH   8
+#endif
+
+// SSE2 is used to scan lines in CSimpleIniA data. It is always available
+// on x64. Address sanitizer builds use the scalar code as the aligned loads
+// may read (harmlessly) past the end of the buffer. GCC says it is one with
+// __SANITIZE_ADDRESS__, clang only through __has_feature.
+#if defined(__SANITIZE_ADDRESS__)
+# define SI_ADDRESS_SANITIZER
+#elif defined(__has_feature)
+# if __has_feature(address_sanitizer)
+#  define SI_ADDRESS_SANITIZER
+# endif
+#endif
+
+#if !defined(SI_NO_SIMD) && !defined(SI_ADDRESS_SANITIZER) \
+    && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) \
+        || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+# include <emmintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+# define SI_HAS_SSE2
+#endif // SI_NO_SIMD
+
 #ifdef _DEBUG
 # ifndef assert
 #  include <cassert>
@@ -242,6 +337,40 @@ enum SI_Error {
     SI_FILE     = -3    //!< File error (see errno for detail error)
 };
 
+// Parse diagnostics (see CSimpleIniTempl::SetDiagnostics()) are only
+// recorded when a line is skipped, so valid data is parsed at the same
+// speed. Defining SI_NO_DIAGNOSTICS removes the recording completely.
+
+/** Why a line of the data was skipped, or not loaded as it was probably
+    meant to be.
+ */
+enum SI_DiagReason {
+    SI_DIAG_SECTION,    //!< Section name without the closing ']', skipped
+    SI_DIAG_NO_EQUALS,  //!< Not a section, key or comment, skipped
+    SI_DIAG_EMPTY_KEY,  //!< Value without a key name, skipped
+    SI_DIAG_NO_END_TAG  //!< Multi-line value runs to the end of the data
+};
+
+/** A problem found while parsing */
+struct SI_Diagnostic {
+    size_t          uLine;      //!< Line number, starting at 1
+    size_t          uColumn;    //!< Column in SI_CHAR, starting at 1
+    SI_DiagReason   eReason;    //!< What is wrong with the line
+};
+
+typedef std::vector<SI_Diagnostic> SI_Diagnostics;
+
+/** Description of a diagnostic reason for use in messages */
+inline const char * SI_DiagReasonText(SI_DiagReason a_eReason) {
+    switch (a_eReason) {
+    case SI_DIAG_SECTION:       return "section name is missing ']'";
+    case SI_DIAG_NO_EQUALS:     return "not a section, key or comment";
+    case SI_DIAG_EMPTY_KEY:     return "key name is empty";
+    case SI_DIAG_NO_END_TAG:    return "multi-line value has no end tag";
+    }
+    return "unknown problem";
+}
+
 #define SI_UTF8_SIGNATURE     "\xEF\xBB\xBF"
 
 #ifdef _WIN32
@@ -264,928 +393,3219 @@ enum SI_Error {
 # define SI_WCHAR_T     UChar
 #endif
 
-
+#ifdef SI_HAS_MMAP
 // ---------------------------------------------------------------------------
-//                              MAIN TEMPLATE CLASS
+//                                  FILE MAPPING
 // ---------------------------------------------------------------------------
 
-/** Simple INI file reader.
-
-    This can be instantiated with the choice of unicode or native characterset,
-    and case sensitive or insensitive comparisons of section and key names.
-    The supported combinations are pre-defined with the following typedefs:
-
-    <table>
-        <tr><th>Interface   <th>Case-sensitive  <th>Typedef
-        <tr><td>char        <td>No              <td>CSimpleIniA
-        <tr><td>char        <td>Yes             <td>CSimpleIniCaseA
-        <tr><td>wchar_t     <td>No              <td>CSimpleIniW
-        <tr><td>wchar_t     <td>Yes             <td>CSimpleIniCaseW
-    </table>
-
-    Note that using other types for the SI_CHAR is supported. For instance,
-    unsigned char, unsigned short, etc. Note that where the alternative type
-    is a different size to char/wchar_t you may need to supply new helper
-    classes for SI_STRLESS and SI_CONVERTER.
+/** Private copy-on-write view of an entire file. Changes made to the view
+    (e.g. the NULL characters inserted while parsing) are never written back
+    to the file. The bytes between the end of the file and the end of the
+    last page of the view are always zero, see IsTerminated().
  */
-template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-class CSimpleIniTempl
-{
+class SI_FileMap {
 public:
-    /** key entry */
-    struct Entry {
-        const SI_CHAR * pItem;
-        const SI_CHAR * pComment;
-        int             nOrder;
+    SI_FileMap() : m_pView(NULL), m_uSize(0) { }
+    ~SI_FileMap() { Close(); }
 
-        Entry(const SI_CHAR * a_pszItem = NULL, int a_nOrder = 0)
-            : pItem(a_pszItem)
-            , pComment(NULL)
-            , nOrder(a_nOrder)
-        { }
-        Entry(const Entry & rhs) { operator=(rhs); }
-        Entry & operator=(const Entry & rhs) {
-            pItem    = rhs.pItem;
-            pComment = rhs.pComment;
-            nOrder   = rhs.nOrder;
-            return *this;
+    /** Map the file. An empty file is opened successfully with no view. */
+    bool Open(const char * a_pszFile) {
+        Close();
+#ifdef _WIN32
+        HANDLE hFile = CreateFileA(a_pszFile, GENERIC_READ, FILE_SHARE_READ,
+            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            return false;
         }
-
-#if defined(_MSC_VER) && _MSC_VER <= 1200
-        /** STL of VC6 doesn't allow me to specify my own comparator for list::sort() */
-        bool operator<(const Entry & rhs) const { return LoadOrder()(*this, rhs); }
-        bool operator>(const Entry & rhs) const { return LoadOrder()(rhs, *this); }
-#endif
-
-        /** Strict less ordering by name of key only */
-        struct KeyOrder : std::binary_function<Entry, Entry, bool> {
-            bool operator()(const Entry & lhs, const Entry & rhs) const {
-                const static SI_STRLESS isLess = SI_STRLESS();
-                return isLess(lhs.pItem, rhs.pItem);
+        DWORD dwSizeHigh = 0;
+        DWORD dwSize = GetFileSize(hFile, &dwSizeHigh);
+        if ((dwSize == INVALID_FILE_SIZE && GetLastError() != NO_ERROR)
+            || dwSizeHigh != 0)
+        {
+            CloseHandle(hFile);
+            return false;
+        }
+        if (dwSize > 0) {
+            HANDLE hMap = CreateFileMappingA(hFile, NULL, PAGE_WRITECOPY,
+                0, 0, NULL);
+            if (hMap) {
+                m_pView = (char *) MapViewOfFile(hMap, FILE_MAP_COPY, 0, 0, 0);
+                CloseHandle(hMap);
             }
-        };
-
-        /** Strict less ordering by order, and then name of key */
-        struct LoadOrder : std::binary_function<Entry, Entry, bool> {
-            bool operator()(const Entry & lhs, const Entry & rhs) const {
-                if (lhs.nOrder != rhs.nOrder) {
-                    return lhs.nOrder < rhs.nOrder;
-                }
-                return KeyOrder()(lhs.pItem, rhs.pItem);
+            if (!m_pView) {
+                CloseHandle(hFile);
+                return false;
             }
-        };
-    };
-
-    /** map keys to values */
-    typedef std::multimap<Entry,const SI_CHAR *,typename Entry::KeyOrder> TKeyVal;
-
-    /** map sections to key/value map */
-    typedef std::map<Entry,TKeyVal,typename Entry::KeyOrder> TSection;
-
-    /** set of dependent string pointers. Note that these pointers are
-        dependent on memory owned by CSimpleIni.
-    */
-    typedef std::list<Entry> TNamesDepend;
-
-    /** interface definition for the OutputWriter object to pass to Save()
-        in order to output the INI file data.
-    */
-    class OutputWriter {
-    public:
-        OutputWriter() { }
-        virtual ~OutputWriter() { }
-        virtual void Write(const char * a_pBuf) = 0;
-    private:
-        OutputWriter(const OutputWriter &);             // disable
-        OutputWriter & operator=(const OutputWriter &); // disable
-    };
-
-    /** OutputWriter class to write the INI data to a file */
-    class FileWriter : public OutputWriter {
-        FILE * m_file;
-    public:
-        FileWriter(FILE * a_file) : m_file(a_file) { }
-        void Write(const char * a_pBuf) {
-            fputs(a_pBuf, m_file);
-        }
-    private:
-        FileWriter(const FileWriter &);             // disable
-        FileWriter & operator=(const FileWriter &); // disable
-    };
-
-    /** OutputWriter class to write the INI data to a string */
-    class StringWriter : public OutputWriter {
-        std::string & m_string;
-    public:
-        StringWriter(std::string & a_string) : m_string(a_string) { }
-        void Write(const char * a_pBuf) {
-            m_string.append(a_pBuf);
-        }
-    private:
-        StringWriter(const StringWriter &);             // disable
-        StringWriter & operator=(const StringWriter &); // disable
-    };
-
-#ifdef SI_SUPPORT_IOSTREAMS
-    /** OutputWriter class to write the INI data to an ostream */
-    class StreamWriter : public OutputWriter {
-        std::ostream & m_ostream;
-    public:
-        StreamWriter(std::ostream & a_ostream) : m_ostream(a_ostream) { }
-        void Write(const char * a_pBuf) {
-            m_ostream << a_pBuf;
         }
-    private:
-        StreamWriter(const StreamWriter &);             // disable
-        StreamWriter & operator=(const StreamWriter &); // disable
-    };
-#endif // SI_SUPPORT_IOSTREAMS
-
-    /** Characterset conversion utility class to convert strings to the
-        same format as is used for the storage.
-    */
-    class Converter : private SI_CONVERTER {
-    public:
-        Converter(bool a_bStoreIsUtf8) : SI_CONVERTER(a_bStoreIsUtf8) {
-            m_scratch.resize(1024);
+        CloseHandle(hFile);
+        m_uSize = (size_t) dwSize;
+#else // !_WIN32
+        int fd = open(a_pszFile, O_RDONLY);
+        if (fd < 0) {
+            return false;
         }
-        Converter(const Converter & rhs) { operator=(rhs); }
-        Converter & operator=(const Converter & rhs) {
-            m_scratch = rhs.m_scratch;
-            return *this;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+            || (unsigned long long) st.st_size > (size_t)(-1) / 2)
+        {
+            close(fd);
+            return false;
         }
-        bool ConvertToStore(const SI_CHAR * a_pszString) {
-            size_t uLen = SizeToStore(a_pszString);
-            if (uLen == (size_t)(-1)) {
+        if (st.st_size > 0) {
+            void * pView = mmap(NULL, (size_t) st.st_size,
+                PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (pView == MAP_FAILED) {
+                close(fd);
                 return false;
             }
-            while (uLen > m_scratch.size()) {
-                m_scratch.resize(m_scratch.size() * 2);
-            }
-            return SI_CONVERTER::ConvertToStore(
-                a_pszString,
-                const_cast<char*>(m_scratch.data()),
-                m_scratch.size());
+            m_pView = (char *) pView;
         }
-        const char * Data() { return m_scratch.data(); }
-    private:
-        std::string m_scratch;
-    };
+        close(fd);
+        m_uSize = (size_t) st.st_size;
+#endif // _WIN32
+        return true;
+    }
 
-public:
-    /*-----------------------------------------------------------------------*/
+    /** Unmap the file. All pointers into the view become invalid. */
+    void Close() {
+        if (m_pView) {
+#ifdef _WIN32
+            UnmapViewOfFile(m_pView);
+#else
+            munmap(m_pView, m_uSize);
+#endif
+        }
+        m_pView = NULL;
+        m_uSize = 0;
+    }
 
-    /** Default constructor.
+    bool IsOpen() const { return m_pView != NULL; }
+    char * Data() const { return m_pView; }
+    size_t Size() const { return m_uSize; }
 
-        @param a_bIsUtf8     See the method SetUnicode() for details.
-        @param a_bMultiKey   See the method SetMultiKey() for details.
-        @param a_bMultiLine  See the method SetMultiLine() for details.
+    /** Is the view followed by at least one zero byte? This is only false
+        when the file size is an exact multiple of the page size.
      */
-    CSimpleIniTempl(
-        bool a_bIsUtf8 = false,
-        bool a_bMultiKey = false,
-        bool a_bMultiLine = false
-        );
+    bool IsTerminated() const {
+        return m_pView && (m_uSize % PageSize()) != 0;
+    }
 
-    /** Destructor */
-    ~CSimpleIniTempl();
+private:
+    static size_t PageSize() {
+#ifdef _WIN32
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        return (size_t) si.dwPageSize;
+#else
+        long nSize = sysconf(_SC_PAGESIZE);
+        return nSize > 0 ? (size_t) nSize : 4096;
+#endif
+    }
 
-    /** Deallocate all memory stored by this object */
-    void Reset();
+    SI_FileMap(const SI_FileMap &);             // disable
+    SI_FileMap & operator=(const SI_FileMap &); // disable
 
-    /*-----------------------------------------------------------------------*/
-    /** @{ @name Settings */
+    char *  m_pView;
+    size_t  m_uSize;
+};
+#endif // SI_HAS_MMAP
 
-    /** Set the storage format of the INI data. This affects both the loading
-        and saving of the INI data using all of the Load/Save API functions.
-        This value cannot be changed after any INI data has been loaded.
+// ---------------------------------------------------------------------------
+//                              ATOMIC FILE REPLACEMENT
+// ---------------------------------------------------------------------------
 
-        If the file is not set to Unicode (UTF-8), then the data encoding is
-        assumed to be the OS native encoding. This encoding is the system
-        locale on Linux/Unix and the legacy MBCS encoding on Windows NT/2K/XP.
-        If the storage format is set to Unicode then the file will be loaded
-        as UTF-8 encoded data regardless of the native file encoding. If
-        SI_CHAR == char then all of the char* parameters take and return UTF-8
-        encoded data regardless of the system locale.
+/** Replace the contents of a file so that after a crash it holds either
+    the old or the new data, never a partial write. The data is written to
+    a new, uniquely named temporary file in the same directory (so that
+    concurrent writers never share one), flushed to disk and then renamed
+    over the file. The file keeps its permissions (POSIX) or attributes
+    (Windows). Nothing is written if the file already holds the data.
 
-        \param a_bIsUtf8     Assume UTF-8 encoding for the source?
-     */
-    void SetUnicode(bool a_bIsUtf8 = true) {
-        if (!m_pData) m_bStoreIsUtf8 = a_bIsUtf8;
-    }
+    @param a_pszFile    Path of the file to replace.
+    @param a_pData      New contents of the file.
+    @param a_uDataLen   Length of a_pData in bytes.
 
-    /** Get the storage format of the INI data. */
-    bool IsUnicode() const { return m_bStoreIsUtf8; }
+    @return SI_OK       The file holds the data
+    @return SI_FILE     The file could not be replaced (see errno), it is
+                        left as it was.
+ */
+inline SI_Error
+SI_ReplaceFile(
+    const char *    a_pszFile,
+    const char *    a_pData,
+    size_t          a_uDataLen
+    )
+{
+    FILE * fp = NULL;
 
-    /** Should multiple identical keys be permitted in the file. If set to false
-        then the last value encountered will be used as the value of the key.
-        If set to true, then all values will be available to be queried. For
-        example, with the following input:
+    // skip the write (and the flush) when nothing has changed
+#if __STDC_WANT_SECURE_LIB__ && !_WIN32_WCE
+    fopen_s(&fp, a_pszFile, "rb");
+#else // !__STDC_WANT_SECURE_LIB__
+    fp = fopen(a_pszFile, "rb");
+#endif // __STDC_WANT_SECURE_LIB__
+    if (fp) {
+        char szBlock[16 * 1024];
+        size_t uPos = 0, uRead;
+        bool bSame = true;
+        while (bSame && (uRead = fread(szBlock, 1, sizeof(szBlock), fp)) > 0) {
+            bSame = uRead <= a_uDataLen - uPos
+                && memcmp(szBlock, a_pData + uPos, uRead) == 0;
+            uPos += uRead;
+        }
+        bSame = bSame && !ferror(fp) && uPos == a_uDataLen;
+        fclose(fp);
+        if (bSame) {
+            return SI_OK;
+        }
+    }
 
-        <pre>
-        [section]
-        test=value1
-        test=value2
-        </pre>
+    std::string strTemp(a_pszFile);
+#if defined(_WIN32) && !defined(_WIN32_WCE)
+    // GetTempFileName() creates an empty file with a name of its own
+    std::string strDir(a_pszFile);
+    size_t uSlash = strDir.find_last_of("\\/");
+    strDir = (uSlash == std::string::npos) ? "." : strDir.substr(0, uSlash + 1);
+    char szTemp[MAX_PATH];
+    if (!GetTempFileNameA(strDir.c_str(), "si", 0, szTemp)) {
+        return SI_FILE;
+    }
+    strTemp = szTemp;
+    DWORD dwAttributes = GetFileAttributesA(a_pszFile);
+    if (dwAttributes != INVALID_FILE_ATTRIBUTES) {
+        SetFileAttributesA(szTemp, dwAttributes & (FILE_ATTRIBUTE_HIDDEN
+            | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE
+            | FILE_ATTRIBUTE_NOT_CONTENT_INDEXED));
+    }
+# if __STDC_WANT_SECURE_LIB__
+    fopen_s(&fp, szTemp, "wb");
+# else
+    fp = fopen(szTemp, "wb");
+# endif
+#elif defined(SI_HAS_FSYNC)
+    // mkstemp() creates the file (mode 0600) with a name of its own
+    strTemp += ".XXXXXX";
+    int fdTemp = mkstemp(&strTemp[0]);
+    if (fdTemp < 0) {
+        return SI_FILE;
+    }
+    struct stat st;
+    mode_t uMode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH; // a new file
+    if (stat(a_pszFile, &st) == 0) {
+        uMode = st.st_mode & 07777;
+    }
+    fp = (fchmod(fdTemp, uMode) == 0) ? fdopen(fdTemp, "wb") : NULL;
+    if (!fp) {
+        close(fdTemp);
+    }
+#else
+    strTemp += ".tmp";
+    fp = fopen(strTemp.c_str(), "wb");
+#endif
+    if (!fp) {
+        remove(strTemp.c_str());
+        return SI_FILE;
+    }
+    bool bOk = fwrite(a_pData, 1, a_uDataLen, fp) == a_uDataLen;
+    bOk = bOk && fflush(fp) == 0;
+#if defined(_WIN32) && !defined(_WIN32_WCE)
+    bOk = bOk && FlushFileBuffers((HANDLE) _get_osfhandle(_fileno(fp)));
+#elif defined(SI_HAS_FSYNC)
+    bOk = bOk && fsync(fileno(fp)) == 0;
+#endif
+    bOk = (fclose(fp) == 0) && bOk;
 
-        Then with SetMultiKey(true), both of the values "value1" and "value2"
-        will be returned for the key test. If SetMultiKey(false) is used, then
-        the value for "test" will only be "value2". This value may be changed
-        at any time.
+#if defined(_WIN32) && !defined(_WIN32_WCE)
+    bOk = bOk && MoveFileExA(strTemp.c_str(), a_pszFile,
+        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    bOk = bOk && rename(strTemp.c_str(), a_pszFile) == 0;
+#endif
+    if (!bOk) {
+        remove(strTemp.c_str());
+        return SI_FILE;
+    }
 
-        \param a_bAllowMultiKey  Allow multi-keys in the source?
-     */
-    void SetMultiKey(bool a_bAllowMultiKey = true) {
-        m_bAllowMultiKey = a_bAllowMultiKey;
+#ifdef SI_HAS_FSYNC
+    // the rename is only durable once the directory has been flushed
+    std::string strDir(a_pszFile);
+    size_t uSlash = strDir.rfind('/');
+    strDir = (uSlash == std::string::npos) ? "." : strDir.substr(0, uSlash + 1);
+    int fd = open(strDir.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
     }
+#endif // SI_HAS_FSYNC
 
-    /** Get the storage format of the INI data. */
-    bool IsMultiKey() const { return m_bAllowMultiKey; }
+    return SI_OK;
+}
 
-    /** Should data values be permitted to span multiple lines in the file. If
-        set to false then the multi-line construct <<<TAG as a value will be
-        returned as is instead of loading the data. This value may be changed
-        at any time.
+// ---------------------------------------------------------------------------
+//                              ARENA ALLOCATOR
+// ---------------------------------------------------------------------------
 
-        \param a_bAllowMultiLine     Allow multi-line values in the source?
-     */
-    void SetMultiLine(bool a_bAllowMultiLine = true) {
-        m_bAllowMultiLine = a_bAllowMultiLine;
+/** Memory arena owned by each CSimpleIniTempl object. Copied strings and
+    the nodes of the section and key maps are carved out of large blocks.
+    Small allocations that are freed are recycled through free lists
+    bucketed by size, larger ones are allocated individually. Everything
+    is returned to the system in one pass by Release().
+ */
+class SI_Arena
+{
+public:
+    SI_Arena() : m_pBlocks(NULL), m_pNext(NULL), m_pEnd(NULL), m_pLarge(NULL) {
+        memset(m_pFree, 0, sizeof(m_pFree));
     }
+    ~SI_Arena() { Release(); }
+
+    /** Allocate memory from the arena. Returns NULL if out of memory. */
+    void * Allocate(size_t a_uSize) {
+        if (a_uSize > MAX_SMALL) {
+            Large * pLarge = (Large *)
+                ::operator new(sizeof(Large) + a_uSize, std::nothrow);
+            if (!pLarge) return NULL;
+            pLarge->pPrev = NULL;
+            pLarge->pNext = m_pLarge;
+            if (m_pLarge) m_pLarge->pPrev = pLarge;
+            m_pLarge = pLarge;
+            m_regions[(const char *) (pLarge + 1)] = (const char *) (pLarge + 1) + a_uSize;
+            return pLarge + 1;
+        }
 
-    /** Query the status of multi-line data */
-    bool IsMultiLine() const { return m_bAllowMultiLine; }
-
-    /*-----------------------------------------------------------------------*/
-    /** @}
-        @{ @name Loading INI Data */
-
-    /** Load an INI file from disk into memory
+        size_t uBucket = Bucket(a_uSize);
+        if (m_pFree[uBucket]) {
+            FreeNode * pNode = m_pFree[uBucket];
+            m_pFree[uBucket] = pNode->pNext;
+            return pNode;
+        }
 
-        @param a_pszFile    Path of the file to be loaded. This will be passed
-                            to fopen() and so must be a valid path for the
-                            current platform.
+        size_t uSize = (uBucket + 1) * ALIGN;
+        if ((size_t) (m_pEnd - m_pNext) < uSize) {
+            Block * pBlock = (Block *) ::operator new(BLOCK_SIZE, std::nothrow);
+            if (!pBlock) return NULL;
+            pBlock->pNext = m_pBlocks;
+            m_pBlocks = pBlock;
+            m_pNext = (char *) (pBlock + 1);
+            m_pEnd = (char *) pBlock + BLOCK_SIZE;
+            m_regions[m_pNext] = m_pEnd;
+        }
+        void * p = m_pNext;
+        m_pNext += uSize;
+        return p;
+    }
 
-        @return SI_Error    See error definitions
+    /** Return memory to the arena. The size must be the same as was
+        requested when it was allocated.
      */
-    SI_Error LoadFile(
-        const char * a_pszFile
-        );
-
-#ifdef SI_HAS_WIDE_FILE
-    /** Load an INI file from disk into memory
-
-        @param a_pwszFile   Path of the file to be loaded in UTF-16.
+    void Deallocate(void * a_p, size_t a_uSize) {
+        if (!a_p) return;
+        if (a_uSize > MAX_SMALL) {
+            Large * pLarge = (Large *) a_p - 1;
+            if (pLarge->pPrev) pLarge->pPrev->pNext = pLarge->pNext;
+            else m_pLarge = pLarge->pNext;
+            if (pLarge->pNext) pLarge->pNext->pPrev = pLarge->pPrev;
+            m_regions.erase((const char *) a_p);
+            ::operator delete(pLarge);
+            return;
+        }
+        size_t uBucket = Bucket(a_uSize);
+        FreeNode * pNode = (FreeNode *) a_p;
+        pNode->pNext = m_pFree[uBucket];
+        m_pFree[uBucket] = pNode;
+    }
 
-        @return SI_Error    See error definitions
+    /** Whether a_p was allocated from the arena with a_uSize, so that it
+        may be given to Deallocate(). Strings the arena didn't allocate
+        (static, in the loaded data or owned by the caller) are not.
      */
-    SI_Error LoadFile(
-        const SI_WCHAR_T * a_pwszFile
-        );
-#endif // SI_HAS_WIDE_FILE
-
-    /** Load the file from a file pointer.
-
-        @param a_fpFile     Valid file pointer to read the file data from. The
-                            file will be read until end of file.
-
-        @return SI_Error    See error definitions
-    */
-    SI_Error LoadFile(
-        FILE * a_fpFile
-        );
-
-#ifdef SI_SUPPORT_IOSTREAMS
-    /** Load INI file data from an istream.
+    bool Owns(const void * a_p, size_t a_uSize) const {
+        const char * p = (const char *) a_p;
+        TRegions::const_iterator i = m_regions.upper_bound(p);
+        if (i == m_regions.begin()) return false;
+        --i;
+        if (p >= i->second) return false;
+        size_t uRegion = (size_t) (i->second - i->first);
+        if (a_uSize > MAX_SMALL) {
+            return p == i->first && uRegion == a_uSize;
+        }
+        return uRegion == BLOCK_SIZE - sizeof(Block);
+    }
 
-        @param a_istream    Stream to read from
+    /** Free all memory allocated from the arena */
+    void Release() {
+        while (m_pBlocks) {
+            Block * pBlock = m_pBlocks;
+            m_pBlocks = pBlock->pNext;
+            ::operator delete(pBlock);
+        }
+        while (m_pLarge) {
+            Large * pLarge = m_pLarge;
+            m_pLarge = pLarge->pNext;
+            ::operator delete(pLarge);
+        }
+        m_pNext = m_pEnd = NULL;
+        memset(m_pFree, 0, sizeof(m_pFree));
+        m_regions.clear();
+    }
 
-        @return SI_Error    See error definitions
+private:
+    /** Headers are ALIGN bytes so that the memory following them is as
+        aligned as that returned by operator new for the map nodes.
      */
-    SI_Error Load(
-        std::istream & a_istream
-        );
-#endif // SI_SUPPORT_IOSTREAMS
-
-    /** Load INI file data direct from a std::string
-
-        @param a_strData    Data to be loaded
+    struct Block { Block * pNext; void * pUnused; };
+    struct Large { Large * pPrev; Large * pNext; };
+    struct FreeNode { FreeNode * pNext; };
+
+    enum {
+        ALIGN       = sizeof(Block),
+        MAX_SMALL   = 256,
+        BUCKETS     = (MAX_SMALL + ALIGN - 1) / ALIGN,
+        BLOCK_SIZE  = 64 * 1024
+    };
 
-        @return SI_Error    See error definitions
-     */
-    SI_Error Load(const std::string & a_strData) {
-        return Load(a_strData.c_str(), a_strData.size());
+    static size_t Bucket(size_t a_uSize) {
+        return a_uSize ? (a_uSize - 1) / ALIGN : 0;
     }
 
-    /** Load INI file data direct from memory
+    SI_Arena(const SI_Arena &);             // disable
+    SI_Arena & operator=(const SI_Arena &); // disable
 
-        @param a_pData      Data to be loaded
-        @param a_uDataLen   Length of the data in bytes
+    Block *     m_pBlocks;
+    char *      m_pNext;
+    char *      m_pEnd;
+    Large *     m_pLarge;
+    FreeNode *  m_pFree[BUCKETS];
 
-        @return SI_Error    See error definitions
+    /** The memory handed out, start -> end, for Owns(). Ordered so that
+        finding the region holding a pointer is O(log regions).
      */
-    SI_Error Load(
-        const char *    a_pData,
-        size_t          a_uDataLen
-        );
+    typedef std::map<const char *, const char *> TRegions;
+    TRegions    m_regions;
+};
 
-    /*-----------------------------------------------------------------------*/
-    /** @}
-        @{ @name Saving INI Data */
+/** Standard allocator that allocates from an SI_Arena. An allocator without
+    an arena uses the global operator new. Allocators are equal if they use
+    the same arena.
+ */
+template<class T>
+class SI_ArenaAllocator
+{
+public:
+    typedef T               value_type;
+    typedef T *             pointer;
+    typedef const T *       const_pointer;
+    typedef T &             reference;
+    typedef const T &       const_reference;
+    typedef size_t          size_type;
+    typedef ptrdiff_t       difference_type;
+
+    template<class U> struct rebind { typedef SI_ArenaAllocator<U> other; };
+
+    SI_ArenaAllocator(SI_Arena * a_pArena = NULL) throw()
+        : m_pArena(a_pArena) { }
+    template<class U> SI_ArenaAllocator(const SI_ArenaAllocator<U> & a_rhs) throw()
+        : m_pArena(a_rhs.Arena()) { }
+
+    pointer address(reference a_val) const { return &a_val; }
+    const_pointer address(const_reference a_val) const { return &a_val; }
+
+    pointer allocate(size_type a_uCount, const void * = 0) {
+        if (!m_pArena) {
+            return (pointer) ::operator new(a_uCount * sizeof(T));
+        }
+        void * p = m_pArena->Allocate(a_uCount * sizeof(T));
+        if (!p) throw std::bad_alloc();
+        return (pointer) p;
+    }
+    void deallocate(pointer a_p, size_type a_uCount) {
+        if (!m_pArena) ::operator delete(a_p);
+        else m_pArena->Deallocate(a_p, a_uCount * sizeof(T));
+    }
 
-    /** Save an INI file from memory to disk
+    size_type max_size() const throw() { return size_type(-1) / sizeof(T); }
+    void construct(pointer a_p, const T & a_val) { new((void *) a_p) T(a_val); }
+    void destroy(pointer a_p) { a_p->~T(); }
 
-        @param a_pszFile    Path of the file to be saved. This will be passed
-                            to fopen() and so must be a valid path for the
-                            current platform.
+    SI_Arena * Arena() const { return m_pArena; }
 
-        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is
-                            in UTF-8 format. If it is not UTF-8 then
-                            this parameter is ignored.
+private:
+    SI_Arena * m_pArena;
+};
 
-        @return SI_Error    See error definitions
-     */
-    SI_Error SaveFile(
-        const char *    a_pszFile,
-        bool            a_bAddSignature = true
-        ) const;
+template<class T, class U>
+inline bool operator==(const SI_ArenaAllocator<T> & a_lhs, const SI_ArenaAllocator<U> & a_rhs) {
+    return a_lhs.Arena() == a_rhs.Arena();
+}
+template<class T, class U>
+inline bool operator!=(const SI_ArenaAllocator<T> & a_lhs, const SI_ArenaAllocator<U> & a_rhs) {
+    return a_lhs.Arena() != a_rhs.Arena();
+}
 
-#ifdef SI_HAS_WIDE_FILE
-    /** Save an INI file from memory to disk
 
-        @param a_pwszFile   Path of the file to be saved in UTF-16.
+// ---------------------------------------------------------------------------
+//                              LINE SCANNING
+// ---------------------------------------------------------------------------
 
-        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is
-                            in UTF-8 format. If it is not UTF-8 then
-                            this parameter is ignored.
+/** Find the first newline, NULL or a_cStop character in a line. Passing
+    NULL as a_cStop finds the end of the line.
+ */
+template<class SI_CHAR>
+inline SI_CHAR * SI_ScanLine(SI_CHAR * a_pData, SI_CHAR a_cStop) {
+    while (*a_pData && *a_pData != a_cStop
+        && *a_pData != '\n' && *a_pData != '\r')
+    {
+        ++a_pData;
+    }
+    return a_pData;
+}
 
-        @return SI_Error    See error definitions
-     */
-    SI_Error SaveFile(
-        const SI_WCHAR_T *  a_pwszFile,
-        bool                a_bAddSignature = true
-        ) const;
-#endif // _WIN32
+#ifdef SI_HAS_SSE2
+/** Return a bit mask of the bytes in a_v which end the scan */
+inline unsigned int SI_ScanMask(
+    __m128i a_v,
+    __m128i a_vStop
+    )
+{
+    __m128i vEnd = _mm_or_si128(
+        _mm_or_si128(
+            _mm_cmpeq_epi8(a_v, _mm_set1_epi8('\n')),
+            _mm_cmpeq_epi8(a_v, _mm_set1_epi8('\r'))),
+        _mm_or_si128(
+            _mm_cmpeq_epi8(a_v, _mm_setzero_si128()),
+            _mm_cmpeq_epi8(a_v, a_vStop)));
+    return (unsigned int) _mm_movemask_epi8(vEnd);
+}
 
-    /** Save the INI data to a file. See Save() for details.
+/** Index of the lowest set bit, a_uMask must not be 0 */
+inline unsigned int SI_LowestBit(unsigned int a_uMask) {
+#ifdef _MSC_VER
+    unsigned long uIndex;
+    _BitScanForward(&uIndex, a_uMask);
+    return (unsigned int) uIndex;
+#else
+    return (unsigned int) __builtin_ctz(a_uMask);
+#endif
+}
 
-        @param a_pFile      Handle to a file. File should be opened for
-                            binary output.
+/** SSE2 version of SI_ScanLine for char data. Only aligned 16 byte blocks
+    are read, and as these never cross a page boundary it is safe to read
+    past the terminating NULL.
+ */
+inline char * SI_ScanLine(char * a_pData, char a_cStop) {
+    __m128i vStop = _mm_set1_epi8(a_cStop);
+    size_t uOffset = (size_t) a_pData & 15;
+    const char * pBlock = a_pData - uOffset;
+
+    // the first block is masked to ignore the bytes before a_pData
+    unsigned int uMask = SI_ScanMask(
+        _mm_load_si128((const __m128i *) pBlock), vStop) >> uOffset;
+    if (uMask) {
+        return a_pData + SI_LowestBit(uMask);
+    }
+    for (;;) {
+        pBlock += 16;
+        uMask = SI_ScanMask(_mm_load_si128((const __m128i *) pBlock), vStop);
+        if (uMask) {
+            return const_cast<char *>(pBlock) + SI_LowestBit(uMask);
+        }
+    }
+}
+#endif // SI_HAS_SSE2
 
-        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is in
-                            UTF-8 format. If it is not UTF-8 then this value is
-                            ignored. Do not set this to true if anything has
-                            already been written to the file.
+// ---------------------------------------------------------------------------
+//                              UTF-8 VALIDATION AND CONVERSION
+// ---------------------------------------------------------------------------
 
-        @return SI_Error    See error definitions
-     */
-    SI_Error SaveFile(
-        FILE *  a_pFile,
-        bool    a_bAddSignature = false
-        ) const;
+/** Decode the UTF-8 sequence at a_pData. Only the shortest form of each
+    code point is accepted, and surrogates and values above U+10FFFF are
+    rejected, as required by RFC 3629.
 
-    /** Save the INI data. The data will be written to the output device
-        in a format appropriate to the current data, selected by:
+    @param a_pData      Start of the sequence.
+    @param a_uDataLen   Number of bytes available at a_pData, must be > 0.
+    @param a_uChar      Receives the code point.
 
-        <table>
-            <tr><th>SI_CHAR     <th>FORMAT
-            <tr><td>char        <td>same format as when loaded (MBCS or UTF-8)
-            <tr><td>wchar_t     <td>UTF-8
-            <tr><td>other       <td>UTF-8
-        </table>
+    @return             Length of the sequence in bytes, or 0 if the
+                        sequence is invalid or truncated.
+ */
+inline size_t SI_Utf8Decode(
+    const unsigned char *   a_pData,
+    size_t                  a_uDataLen,
+    unsigned long &         a_uChar
+    )
+{
+    unsigned char c = a_pData[0];
+    unsigned char cMin = 0x80, cMax = 0xBF; // range of the second byte
+    size_t uLen;
+    if (c < 0x80) {
+        a_uChar = c;
+        return 1;
+    }
+    if (c < 0xC2) {
+        return 0; // continuation byte or overlong 2 byte form
+    }
+    if (c < 0xE0) {
+        uLen = 2;
+        a_uChar = c & 0x1F;
+    }
+    else if (c < 0xF0) {
+        uLen = 3;
+        a_uChar = c & 0x0F;
+        if (c == 0xE0) cMin = 0xA0;         // overlong
+        else if (c == 0xED) cMax = 0x9F;    // surrogates
+    }
+    else if (c < 0xF5) {
+        uLen = 4;
+        a_uChar = c & 0x07;
+        if (c == 0xF0) cMin = 0x90;         // overlong
+        else if (c == 0xF4) cMax = 0x8F;    // above U+10FFFF
+    }
+    else {
+        return 0;
+    }
+    if (a_uDataLen < uLen || a_pData[1] < cMin || a_pData[1] > cMax) {
+        return 0;
+    }
+    a_uChar = (a_uChar << 6) | (a_pData[1] & 0x3F);
+    for (size_t n = 2; n < uLen; ++n) {
+        if ((a_pData[n] & 0xC0) != 0x80) {
+            return 0;
+        }
+        a_uChar = (a_uChar << 6) | (a_pData[n] & 0x3F);
+    }
+    return uLen;
+}
 
-        Note that comments from the original data is preserved as per the
-        documentation on comments. The order of the sections and values
-        from the original file will be preserved.
+#ifdef SI_HAS_SSE2
+/** Number of ASCII bytes at the start of a_pData, scanning 16 bytes at a
+    time. Only whole blocks inside the data are read.
+ */
+inline size_t SI_Utf8AsciiRun(
+    const unsigned char *   a_pData,
+    size_t                  a_uDataLen
+    )
+{
+    size_t uPos = 0;
+    for (; a_uDataLen - uPos >= 16; uPos += 16) {
+        unsigned int uMask = (unsigned int) _mm_movemask_epi8(
+            _mm_loadu_si128((const __m128i *) (a_pData + uPos)));
+        if (uMask) {
+            return uPos + SI_LowestBit(uMask);
+        }
+    }
+    while (uPos < a_uDataLen && a_pData[uPos] < 0x80) {
+        ++uPos;
+    }
+    return uPos;
+}
+#else // !SI_HAS_SSE2
+inline size_t SI_Utf8AsciiRun(
+    const unsigned char *   a_pData,
+    size_t                  a_uDataLen
+    )
+{
+    size_t uPos = 0;
+    while (uPos < a_uDataLen && a_pData[uPos] < 0x80) {
+        ++uPos;
+    }
+    return uPos;
+}
+#endif // SI_HAS_SSE2
 
-        Any data prepended or appended to the output device must use the the
-        same format (MBCS or UTF-8). You may use the GetConverter() method to
-        convert text to the correct format regardless of the output format
-        being used by SimpleIni.
+/** Check that data is valid UTF-8 (see SI_Utf8Decode()). Runs of ASCII,
+    which is most of a typical INI file, are skipped a block at a time.
 
-        To add a BOM to UTF-8 data, write it out manually at the very beginning
-        like is done in SaveFile when a_bUseBOM is true.
+    @param a_pData      Data to check.
+    @param a_uDataLen   Length of the data in bytes.
 
-        @param a_oOutput    Output writer to write the data to.
+    @return             a_uDataLen if the data is valid, otherwise the offset
+                        of the first byte of the first invalid sequence.
+ */
+inline size_t SI_Utf8Validate(
+    const char *    a_pData,
+    size_t          a_uDataLen
+    )
+{
+    const unsigned char * pData = (const unsigned char *) a_pData;
+    unsigned long uChar;
+    size_t uPos = 0;
+    while (uPos < a_uDataLen) {
+        if (pData[uPos] < 0x80) {
+            uPos += SI_Utf8AsciiRun(pData + uPos, a_uDataLen - uPos);
+            continue;
+        }
+        size_t uLen = SI_Utf8Decode(pData + uPos, a_uDataLen - uPos, uChar);
+        if (!uLen) {
+            return uPos;
+        }
+        uPos += uLen;
+    }
+    return a_uDataLen;
+}
 
-        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is in
-                            UTF-8 format. If it is not UTF-8 then this value is
-                            ignored. Do not set this to true if anything has
-                            already been written to the OutputWriter.
+/** Convert UTF-8 to UTF-16 or UTF-32, depending on the size of SI_WCHAR.
+    Invalid data is rejected rather than replaced (see SI_Utf8Decode()).
+    Runs of ASCII are widened 16 bytes at a time when SSE2 is available.
 
-        @return SI_Error    See error definitions
-     */
-    SI_Error Save(
-        OutputWriter &  a_oOutput,
-        bool            a_bAddSignature = false
-        ) const;
-
-#ifdef SI_SUPPORT_IOSTREAMS
-    /** Save the INI data to an ostream. See Save() for details.
+    @param a_pData          UTF-8 data to convert. A NULL byte is converted
+                            like any other character.
+    @param a_uDataLen       Length of the data in bytes.
+    @param a_pOutputData    Buffer to receive the converted data. It is not
+                            NULL terminated unless the input is.
+    @param a_uOutputDataSize Size of the output buffer in SI_WCHAR. The
+                            input length is always enough.
 
-        @param a_ostream    String to have the INI data appended to.
+    @return                 Number of SI_WCHAR written, or -1 cast to size_t
+                            if the data is invalid or the buffer too small.
+ */
+template<class SI_WCHAR>
+inline size_t SI_Utf8ToWide(
+    const char *    a_pData,
+    size_t          a_uDataLen,
+    SI_WCHAR *      a_pOutputData,
+    size_t          a_uOutputDataSize
+    )
+{
+    const unsigned char * pData = (const unsigned char *) a_pData;
+    size_t uPos = 0, uOut = 0;
+    unsigned long uChar;
+    while (uPos < a_uDataLen) {
+#ifdef SI_HAS_SSE2
+        if ((sizeof(SI_WCHAR) == 2 || sizeof(SI_WCHAR) == 4)
+            && pData[uPos] < 0x80)
+        {
+            const __m128i vZero = _mm_setzero_si128();
+            while (a_uDataLen - uPos >= 16 && a_uOutputDataSize - uOut >= 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *) (pData + uPos));
+                if (_mm_movemask_epi8(v)) {
+                    break;
+                }
+                __m128i vLo = _mm_unpacklo_epi8(v, vZero);
+                __m128i vHi = _mm_unpackhi_epi8(v, vZero);
+                __m128i * pOut = (__m128i *) (a_pOutputData + uOut);
+                if (sizeof(SI_WCHAR) == 2) {
+                    _mm_storeu_si128(pOut,     vLo);
+                    _mm_storeu_si128(pOut + 1, vHi);
+                }
+                else {
+                    _mm_storeu_si128(pOut,     _mm_unpacklo_epi16(vLo, vZero));
+                    _mm_storeu_si128(pOut + 1, _mm_unpackhi_epi16(vLo, vZero));
+                    _mm_storeu_si128(pOut + 2, _mm_unpacklo_epi16(vHi, vZero));
+                    _mm_storeu_si128(pOut + 3, _mm_unpackhi_epi16(vHi, vZero));
+                }
+                uPos += 16;
+                uOut += 16;
+            }
+            if (uPos >= a_uDataLen) {
+                break;
+            }
+        }
+#endif // SI_HAS_SSE2
+        if (pData[uPos] < 0x80) {
+            uChar = pData[uPos++];
+        }
+        else {
+            size_t uLen = SI_Utf8Decode(pData + uPos, a_uDataLen - uPos, uChar);
+            if (!uLen) {
+                return (size_t) -1;
+            }
+            uPos += uLen;
+        }
+        if (uChar > 0xFFFF && sizeof(SI_WCHAR) == 2) {
+            if (a_uOutputDataSize - uOut < 2) {
+                return (size_t) -1;
+            }
+            uChar -= 0x10000;
+            a_pOutputData[uOut++] = (SI_WCHAR) (0xD800 + (uChar >> 10));
+            a_pOutputData[uOut++] = (SI_WCHAR) (0xDC00 + (uChar & 0x3FF));
+        }
+        else {
+            if (uOut >= a_uOutputDataSize) {
+                return (size_t) -1;
+            }
+            a_pOutputData[uOut++] = (SI_WCHAR) uChar;
+        }
+    }
+    return uOut;
+}
 
-        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is in
-                            UTF-8 format. If it is not UTF-8 then this value is
-                            ignored. Do not set this to true if anything has
-                            already been written to the stream.
+// ---------------------------------------------------------------------------
+//                              INCLUDED FILES
+// ---------------------------------------------------------------------------
 
-        @return SI_Error    See error definitions
-     */
-    SI_Error Save(
-        std::ostream &  a_ostream,
-        bool            a_bAddSignature = false
-        ) const
-    {
-        StreamWriter writer(a_ostream);
-        return Save(writer, a_bAddSignature);
-    }
-#endif // SI_SUPPORT_IOSTREAMS
+/** Number of processors available for loading included files */
+inline size_t SI_ProcessorCount() {
+#if defined(_WIN32) && !defined(_WIN32_WCE)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (size_t) info.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long nCount = sysconf(_SC_NPROCESSORS_ONLN);
+    return nCount > 0 ? (size_t) nCount : 1;
+#else
+    return 1;
+#endif
+}
 
-    /** Append the INI data to a string. See Save() for details.
+/** Arguments of a thread started by SI_RunParallel() */
+struct SI_ThreadArgs {
+    void (*pfnWork)(void *, size_t);
+    void *  pArg;
+    size_t  uThread;
+};
 
-        @param a_sBuffer    String to have the INI data appended to.
+#ifdef SI_HAS_THREADS
+# ifdef _WIN32
+inline unsigned __stdcall SI_ThreadMain(void * a_pArgs) {
+    SI_ThreadArgs * pArgs = (SI_ThreadArgs *) a_pArgs;
+    pArgs->pfnWork(pArgs->pArg, pArgs->uThread);
+    return 0;
+}
+# else // !_WIN32
+inline void * SI_ThreadMain(void * a_pArgs) {
+    SI_ThreadArgs * pArgs = (SI_ThreadArgs *) a_pArgs;
+    pArgs->pfnWork(pArgs->pArg, pArgs->uThread);
+    return NULL;
+}
+# endif // _WIN32
+#endif // SI_HAS_THREADS
 
-        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is in
-                            UTF-8 format. If it is not UTF-8 then this value is
-                            ignored. Do not set this to true if anything has
-                            already been written to the string.
+/** Call a_pfnWork(a_pArg, n) for n from 0 to a_uThreads - 1, each on its
+    own thread, and wait for them all to return. The calling thread does
+    n = 0. If threads are not available or can't be started the calls are
+    made on the calling thread instead.
+ */
+inline void SI_RunParallel(
+    size_t  a_uThreads,
+    void    (*a_pfnWork)(void *, size_t),
+    void *  a_pArg
+    )
+{
+#ifdef SI_HAS_THREADS
+    std::vector<SI_ThreadArgs> args(a_uThreads);
+# ifdef _WIN32
+    std::vector<HANDLE> threads(a_uThreads, (HANDLE) NULL);
+# else
+    std::vector<pthread_t> threads(a_uThreads);
+    std::vector<char> started(a_uThreads, 0);
+# endif
+    for (size_t n = 1; n < a_uThreads; ++n) {
+        args[n].pfnWork = a_pfnWork;
+        args[n].pArg = a_pArg;
+        args[n].uThread = n;
+# ifdef _WIN32
+        threads[n] = (HANDLE) _beginthreadex(NULL, 0, SI_ThreadMain, &args[n], 0, NULL);
+        if (!threads[n]) {
+            a_pfnWork(a_pArg, n);
+        }
+# else
+        started[n] = pthread_create(&threads[n], NULL, SI_ThreadMain, &args[n]) == 0;
+        if (!started[n]) {
+            a_pfnWork(a_pArg, n);
+        }
+# endif
+    }
+    a_pfnWork(a_pArg, 0);
+    for (size_t n = 1; n < a_uThreads; ++n) {
+# ifdef _WIN32
+        if (threads[n]) {
+            WaitForSingleObject(threads[n], INFINITE);
+            CloseHandle(threads[n]);
+        }
+# else
+        if (started[n]) {
+            pthread_join(threads[n], NULL);
+        }
+# endif
+    }
+#else // !SI_HAS_THREADS
+    for (size_t n = 0; n < a_uThreads; ++n) {
+        a_pfnWork(a_pArg, n);
+    }
+#endif // SI_HAS_THREADS
+}
 
-        @return SI_Error    See error definitions
-     */
-    SI_Error Save(
-        std::string &   a_sBuffer,
-        bool            a_bAddSignature = false
-        ) const
-    {
-        StringWriter writer(a_sBuffer);
-        return Save(writer, a_bAddSignature);
+/** Does the file name end in ".ini" or ".cfg" (in any case) */
+inline bool SI_IsIncludeName(const char * a_pszName) {
+    size_t uLen = strlen(a_pszName);
+    if (uLen < 5 || a_pszName[uLen - 4] != '.') {
+        return false;
     }
+    char szExt[4];
+    for (size_t n = 0; n < 3; ++n) {
+        char c = a_pszName[uLen - 3 + n];
+        szExt[n] = (c >= 'A' && c <= 'Z') ? (char) (c - 'A' + 'a') : c;
+    }
+    szExt[3] = 0;
+    return strcmp(szExt, "ini") == 0 || strcmp(szExt, "cfg") == 0;
+}
 
-    /*-----------------------------------------------------------------------*/
-    /** @}
-        @{ @name Accessing INI Data */
+/** List the *.ini and *.cfg files in a directory for "!includedir". The
+    paths are added to a_files in order of their names, so that the files
+    are always loaded in the same order.
 
-    /** Retrieve all section names. The list is returned as an STL vector of
-        names and can be iterated or searched as necessary. Note that the
-        collation order of the returned strings is NOT DEFINED.
+    @return             false if the directory can't be read
+ */
+inline bool SI_ListIncludeDir(
+    const std::string &         a_strDir,
+    std::vector<std::string> &  a_files
+    )
+{
+    std::vector<std::string> names;
+#ifdef _WIN32
+    const char cSep = '\\';
+#else
+    const char cSep = '/';
+#endif
+#if defined(_WIN32) && !defined(_WIN32_WCE)
+    WIN32_FIND_DATAA data;
+    HANDLE hFind = FindFirstFileA((a_strDir + "\\*").c_str(), &data);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        return GetLastError() == ERROR_FILE_NOT_FOUND;
+    }
+    do {
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            && SI_IsIncludeName(data.cFileName))
+        {
+            names.push_back(data.cFileName);
+        }
+    } while (FindNextFileA(hFind, &data));
+    FindClose(hFind);
+#elif defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+    DIR * pDir = opendir(a_strDir.c_str());
+    if (!pDir) {
+        return false;
+    }
+    struct dirent * pEntry;
+    struct stat st;
+    while ((pEntry = readdir(pDir)) != NULL) {
+        if (SI_IsIncludeName(pEntry->d_name)
+            && stat((a_strDir + '/' + pEntry->d_name).c_str(), &st) == 0
+            && S_ISREG(st.st_mode))
+        {
+            names.push_back(pEntry->d_name);
+        }
+    }
+    closedir(pDir);
+#else
+    return false;
+#endif
+    std::sort(names.begin(), names.end());
+    for (size_t n = 0; n < names.size(); ++n) {
+        a_files.push_back(a_strDir + cSep + names[n]);
+    }
+    return true;
+}
 
-        NOTE! This structure contains only pointers to strings. The actual
-        string data is stored in memory owned by CSimpleIni. Ensure that the
-        CSimpleIni object is not destroyed or Reset() while these pointers
-        are in use!
 
-        @param a_names          Vector that will receive all of the section
-                                names. See note above!
-     */
-    void GetAllSections(
-        TNamesDepend & a_names
-        ) const;
+// ---------------------------------------------------------------------------
+//                              MAIN TEMPLATE CLASS
+// ---------------------------------------------------------------------------
 
-    /** Retrieve all unique key names in a section. The collation order of the
-        returned strings is NOT DEFINED. Only unique key names are returned.
+/** Simple INI file reader.
 
-        NOTE! This structure contains only pointers to strings. The actual
-        string data is stored in memory owned by CSimpleIni. Ensure that the
-        CSimpleIni object is not destroyed or Reset() while these strings
-        are in use!
+    This can be instantiated with the choice of unicode or native characterset,
+    and case sensitive or insensitive comparisons of section and key names.
+    The supported combinations are pre-defined with the following typedefs:
 
-        @param a_pSection       Section to request data for
-        @param a_names          List that will receive all of the key
-                                names. See note above!
+    <table>
+        <tr><th>Interface   <th>Case-sensitive  <th>Typedef
+        <tr><td>char        <td>No              <td>CSimpleIniA
+        <tr><td>char        <td>Yes             <td>CSimpleIniCaseA
+        <tr><td>wchar_t     <td>No              <td>CSimpleIniW
+        <tr><td>wchar_t     <td>Yes             <td>CSimpleIniCaseW
+    </table>
 
-        @return true            Section was found.
-        @return false           Matching section was not found.
-     */
-    bool GetAllKeys(
-        const SI_CHAR * a_pSection,
-        TNamesDepend &  a_names
-        ) const;
+    Note that using other types for the SI_CHAR is supported. For instance,
+    unsigned char, unsigned short, etc. Note that where the alternative type
+    is a different size to char/wchar_t you may need to supply new helper
+    classes for SI_STRLESS and SI_CONVERTER.
+ */
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+class CSimpleIniTempl
+{
+public:
+    /** key entry */
+    struct Entry {
+        const SI_CHAR * pItem;
+        const SI_CHAR * pComment;
+        int             nOrder;
 
-    /** Retrieve all values for a specific key. This method can be used when
-        multiple keys are both enabled and disabled.
+        Entry(const SI_CHAR * a_pszItem = NULL, int a_nOrder = 0)
+            : pItem(a_pszItem)
+            , pComment(NULL)
+            , nOrder(a_nOrder)
+        { }
+        Entry(const Entry & rhs) { operator=(rhs); }
+        Entry & operator=(const Entry & rhs) {
+            pItem    = rhs.pItem;
+            pComment = rhs.pComment;
+            nOrder   = rhs.nOrder;
+            return *this;
+        }
 
-        NOTE! The returned values are pointers to string data stored in memory
-        owned by CSimpleIni. Ensure that the CSimpleIni object is not destroyed
-        or Reset while you are using this pointer!
+#if defined(_MSC_VER) && _MSC_VER <= 1200
+        /** STL of VC6 doesn't allow me to specify my own comparator for list::sort() */
+        bool operator<(const Entry & rhs) const { return LoadOrder()(*this, rhs); }
+        bool operator>(const Entry & rhs) const { return LoadOrder()(rhs, *this); }
+#endif
 
-        @param a_pSection       Section to search
-        @param a_pKey           Key to search for
-        @param a_values         List to return if the key is not found
+        /** Strict less ordering by name of key only */
+        struct KeyOrder : std::binary_function<Entry, Entry, bool> {
+            bool operator()(const Entry & lhs, const Entry & rhs) const {
+                const static SI_STRLESS isLess = SI_STRLESS();
+                return isLess(lhs.pItem, rhs.pItem);
+            }
+        };
 
-        @return true            Key was found.
-        @return false           Matching section/key was not found.
+        /** Strict less ordering by order, and then name of key */
+        struct LoadOrder : std::binary_function<Entry, Entry, bool> {
+            bool operator()(const Entry & lhs, const Entry & rhs) const {
+                if (lhs.nOrder != rhs.nOrder) {
+                    return lhs.nOrder < rhs.nOrder;
+                }
+                return KeyOrder()(lhs.pItem, rhs.pItem);
+            }
+        };
+    };
+
+    /** map keys to values. Nodes are allocated from the arena of the
+        CSimpleIniTempl object, so copies of a TKeyVal must not outlive it.
      */
-    bool GetAllValues(
-        const SI_CHAR * a_pSection,
-        const SI_CHAR * a_pKey,
-        TNamesDepend &  a_values
-        ) const;
+    typedef std::multimap<Entry,const SI_CHAR *,typename Entry::KeyOrder,
+        SI_ArenaAllocator<std::pair<const Entry,const SI_CHAR *> > > TKeyVal;
 
-    /** Query the number of keys in a specific section. Note that if multiple
-        keys are enabled, then this value may be different to the number of
-        keys returned by GetAllKeys.
+    /** map sections to key/value map */
+    typedef std::map<Entry,TKeyVal,typename Entry::KeyOrder,
+        SI_ArenaAllocator<std::pair<const Entry,TKeyVal> > > TSection;
 
-        @param a_pSection       Section to request data for
+    /** set of dependent string pointers. Note that these pointers are
+        dependent on memory owned by CSimpleIni.
+    */
+    typedef std::list<Entry> TNamesDepend;
 
-        @return -1              Section does not exist in the file
-        @return >=0             Number of keys in the section
-     */
-    int GetSectionSize(
-        const SI_CHAR * a_pSection
-        ) const;
+    /** reference to a string with a known length, which is not necessarily
+        NULL terminated. Strings returned from the INI data are always NULL
+        terminated at pData[uLen].
+    */
+    struct StringRef {
+        const SI_CHAR * pData;
+        size_t          uLen;
+
+        StringRef() : pData(NULL), uLen(0) { }
+        StringRef(const SI_CHAR * a_pData)
+            : pData(a_pData), uLen(a_pData ? StringLength(a_pData) : 0) { }
+        StringRef(const SI_CHAR * a_pData, size_t a_uLen)
+            : pData(a_pData), uLen(a_uLen) { }
+        StringRef(const std::basic_string<SI_CHAR> & a_str)
+            : pData(a_str.data()), uLen(a_str.length()) { }
+
+        /** Is this a reference to no string (as opposed to an empty one) */
+        bool IsNull() const { return pData == NULL; }
+    };
 
-    /** Retrieve all key and value pairs for a section. The data is returned
-        as a pointer to an STL map and can be iterated or searched as
-        desired. Note that multiple entries for the same key may exist when
-        multiple keys have been enabled.
+    /** interface definition for the OutputWriter object to pass to Save()
+        in order to output the INI file data. Save() collects its output in
+        large blocks and passes them to WriteBlock().
+    */
+    class OutputWriter {
+    public:
+        OutputWriter() { }
+        virtual ~OutputWriter() { }
+        virtual void Write(const char * a_pBuf) = 0;
 
-        NOTE! This structure contains only pointers to strings. The actual
-        string data is stored in memory owned by CSimpleIni. Ensure that the
-        CSimpleIni object is not destroyed or Reset() while these strings
-        are in use!
-
-        @param a_pSection       Name of the section to return
-        @return boolean         Was a section matching the supplied
-                                name found.
-     */
-    const TKeyVal * GetSection(
-        const SI_CHAR * a_pSection
-        ) const;
+        /** Write a_uLen chars of a_pBuf, which is not NULL terminated. The
+            default implementation passes a terminated copy to Write().
+         */
+        virtual void WriteBlock(const char * a_pBuf, size_t a_uLen) {
+            std::string block(a_pBuf, a_uLen);
+            Write(block.c_str());
+        }
+    private:
+        OutputWriter(const OutputWriter &);             // disable
+        OutputWriter & operator=(const OutputWriter &); // disable
+    };
 
-    /** Retrieve the value for a specific key. If multiple keys are enabled
-        (see SetMultiKey) then only the first value associated with that key
-        will be returned, see GetAllValues for getting all values with multikey.
+    /** OutputWriter class to write the INI data to a file */
+    class FileWriter : public OutputWriter {
+        FILE * m_file;
+    public:
+        FileWriter(FILE * a_file) : m_file(a_file) { }
+        void Write(const char * a_pBuf) {
+            fputs(a_pBuf, m_file);
+        }
+        void WriteBlock(const char * a_pBuf, size_t a_uLen) {
+            fwrite(a_pBuf, sizeof(char), a_uLen, m_file);
+        }
+    private:
+        FileWriter(const FileWriter &);             // disable
+        FileWriter & operator=(const FileWriter &); // disable
+    };
 
-        NOTE! The returned value is a pointer to string data stored in memory
-        owned by CSimpleIni. Ensure that the CSimpleIni object is not destroyed
-        or Reset while you are using this pointer!
+    /** OutputWriter class to write the INI data to a string */
+    class StringWriter : public OutputWriter {
+        std::string & m_string;
+    public:
+        StringWriter(std::string & a_string) : m_string(a_string) { }
+        void Write(const char * a_pBuf) {
+            m_string.append(a_pBuf);
+        }
+        void WriteBlock(const char * a_pBuf, size_t a_uLen) {
+            m_string.append(a_pBuf, a_uLen);
+        }
+    private:
+        StringWriter(const StringWriter &);             // disable
+        StringWriter & operator=(const StringWriter &); // disable
+    };
 
-        @param a_pSection       Section to search
-        @param a_pKey           Key to search for
-        @param a_pDefault       Value to return if the key is not found
-        @param a_pHasMultiple   Optionally receive notification of if there are
-                                multiple entries for this key.
+#ifdef SI_SUPPORT_IOSTREAMS
+    /** OutputWriter class to write the INI data to an ostream */
+    class StreamWriter : public OutputWriter {
+        std::ostream & m_ostream;
+    public:
+        StreamWriter(std::ostream & a_ostream) : m_ostream(a_ostream) { }
+        void Write(const char * a_pBuf) {
+            m_ostream << a_pBuf;
+        }
+        void WriteBlock(const char * a_pBuf, size_t a_uLen) {
+            m_ostream.write(a_pBuf, (std::streamsize) a_uLen);
+        }
+    private:
+        StreamWriter(const StreamWriter &);             // disable
+        StreamWriter & operator=(const StreamWriter &); // disable
+    };
+#endif // SI_SUPPORT_IOSTREAMS
 
-        @return a_pDefault      Key was not found in the section
-        @return other           Value of the key
-     */
-    const SI_CHAR * GetValue(
-        const SI_CHAR * a_pSection,
-        const SI_CHAR * a_pKey,
-        const SI_CHAR * a_pDefault     = NULL,
-        bool *          a_pHasMultiple = NULL
-        ) const;
+    /** Characterset conversion utility class to convert strings to the
+        same format as is used for the storage.
+    */
+    class Converter : private SI_CONVERTER {
+    public:
+        Converter(bool a_bStoreIsUtf8) : SI_CONVERTER(a_bStoreIsUtf8), m_uLen(0) {
+            m_scratch.resize(1024);
+        }
+        Converter(const Converter & rhs) { operator=(rhs); }
+        Converter & operator=(const Converter & rhs) {
+            m_scratch = rhs.m_scratch;
+            m_uLen = rhs.m_uLen;
+            return *this;
+        }
+        bool ConvertToStore(const SI_CHAR * a_pszString) {
+            size_t uLen = SizeToStore(a_pszString);
+            if (uLen == (size_t)(-1)) {
+                return false;
+            }
+            while (uLen > m_scratch.size()) {
+                m_scratch.resize(m_scratch.size() * 2);
+            }
 
-    /** Retrieve a numeric value for a specific key. If multiple keys are enabled
-        (see SetMultiKey) then only the first value associated with that key
-        will be returned, see GetAllValues for getting all values with multikey.
+            // char data is stored as is (SI_ConvertA), so SizeToStore() is
+            // the exact length and the copy needs no second scan. Wide char
+            // sizes may only be an upper bound, so those are measured.
+            if (sizeof(SI_CHAR) == sizeof(char)) {
+                memcpy(const_cast<char*>(m_scratch.data()), a_pszString, uLen);
+                m_uLen = uLen - 1;
+                return true;
+            }
+            if (!SI_CONVERTER::ConvertToStore(
+                a_pszString,
+                const_cast<char*>(m_scratch.data()),
+                m_scratch.size()))
+            {
+                return false;
+            }
+            m_uLen = strlen(m_scratch.data());
+            return true;
+        }
+        const char * Data() { return m_scratch.data(); }
+        /** Length of the converted string in Data() */
+        size_t Length() const { return m_uLen; }
+    private:
+        std::string m_scratch;
+        size_t      m_uLen;
+    };
 
-        @param a_pSection       Section to search
-        @param a_pKey           Key to search for
-        @param a_nDefault       Value to return if the key is not found
-        @param a_pHasMultiple   Optionally receive notification of if there are
-                                multiple entries for this key.
+    /** interface definition for the EntryHandler object to pass to Parse()
+        and ParseFile() in order to receive the INI data as it is parsed
+        instead of loading it. All strings passed to the handler are only
+        valid for the duration of the call.
+    */
+    class EntryHandler {
+    public:
+        EntryHandler() { }
+        virtual ~EntryHandler() { }
+
+        /** Called with the file comment if one exists. This is always
+            before any entries. Return false to stop parsing.
+         */
+        virtual bool OnFileComment(const SI_CHAR * a_pComment) {
+            (void) a_pComment;
+            return true;
+        }
 
-        @return a_nDefault      Key was not found in the section
-        @return other           Value of the key
-     */
-    long GetLongValue(
-        const SI_CHAR * a_pSection,
-        const SI_CHAR * a_pKey,
-        long            a_nDefault     = 0,
-        bool *          a_pHasMultiple = NULL
-        ) const;
+        /** Called for every section and key in the order that they are in
+            the data. For sections a_pKey and a_pValue are NULL. Comments
+            are in full comment form. Return false to stop parsing.
+         */
+        virtual bool OnEntry(
+            const SI_CHAR * a_pSection,
+            const SI_CHAR * a_pKey,
+            const SI_CHAR * a_pValue,
+            const SI_CHAR * a_pComment
+            ) = 0;
+    private:
+        EntryHandler(const EntryHandler &);             // disable
+        EntryHandler & operator=(const EntryHandler &); // disable
+    };
 
-    /** Retrieve a boolean value for a specific key. If multiple keys are enabled
-        (see SetMultiKey) then only the first value associated with that key
-        will be returned, see GetAllValues for getting all values with multikey.
+    /** Incremental parser for INI data that arrives in pieces, e.g. from a
+        pipe or a socket. The data is passed to Feed() in chunks of any size
+        and every entry is passed to the handler as soon as it is complete,
+        so only the incomplete entry at the end of the data received so far
+        is buffered. Finish() must be called at the end of the data. The
+        entries passed to the handler are the same as those from Parse() for
+        all of the data.
+    */
+    class StreamParser {
+    public:
+        /** @param a_ini            The settings for Unicode and multi-line
+                                    values are taken from this object.
+            @param a_handler        Handler for the entries
+            @param a_bFileComment   Look for a file comment at the start of
+                                    the data.
+         */
+        StreamParser(
+            const CSimpleIniTempl & a_ini,
+            EntryHandler &          a_handler,
+            bool                    a_bFileComment = true
+            );
+
+        /** Parse the next chunk of data.
+
+            @return SI_Error    See error definitions. Once the handler has
+                                stopped the parse any data is ignored.
+         */
+        SI_Error Feed(
+            const char *    a_pData,
+            size_t          a_uDataLen
+            );
+
+        /** Parse whatever data remains at the end of the stream.
+
+            @return SI_Error    See error definitions
+         */
+        SI_Error Finish();
+
+        /** The handler has stopped the parse */
+        bool IsStopped() const { return m_bStopped; }
 
-        Strings starting with "t", "y", "on" or "1" are returned as logically true.
-        Strings starting with "f", "n", "of" or "0" are returned as logically false.
-        For all other values the default is returned. Character comparisons are 
-        case-insensitive.
+    private:
+        SI_Error Convert(bool a_bFinal);
+        void ParsePending(bool a_bFinal);
 
-        @param a_pSection       Section to search
-        @param a_pKey           Key to search for
-        @param a_bDefault       Value to return if the key is not found
-        @param a_pHasMultiple   Optionally receive notification of if there are
-                                multiple entries for this key.
+        StreamParser(const StreamParser &);             // disable
+        StreamParser & operator=(const StreamParser &); // disable
 
-        @return a_nDefault      Key was not found in the section
-        @return other           Value of the key
-     */
-    bool GetBoolValue(
-        const SI_CHAR * a_pSection,
-        const SI_CHAR * a_pKey,
-        bool            a_bDefault     = false,
-        bool *          a_pHasMultiple = NULL
-        ) const;
+    private:
+        const CSimpleIniTempl & m_ini;
+        EntryHandler &          m_handler;
+        std::string             m_store;    // data not yet converted
+        std::vector<SI_CHAR>    m_pending;  // data not yet parsed
+        std::vector<SI_CHAR>    m_work;     // copy of m_pending being parsed
+        std::vector<SI_CHAR>    m_section;  // section of the last entry
+        size_t                  m_uConverted; // bytes converted so far
+#ifndef SI_NO_DIAGNOSTICS
+        size_t                  m_uLine;    // line number of m_pending[0]
+#endif
+        bool                    m_bCheckBom;
+        bool                    m_bFileComment;
+        bool                    m_bStopped;
+        bool                    m_bEnded;   // NULL character found
+    };
 
-    /** Add or update a section or value. This will always insert
-        when multiple keys are enabled.
+public:
+    /*-----------------------------------------------------------------------*/
 
-        @param a_pSection   Section to add or update
-        @param a_pKey       Key to add or update. Set to NULL to
-                            create an empty section.
-        @param a_pValue     Value to set. Set to NULL to create an
-                            empty section.
-        @param a_pComment   Comment to be associated with the section or the
-                            key. If a_pKey is NULL then it will be associated
-                            with the section, otherwise the key. Note that a
-                            comment may be set ONLY when the section or key is
-                            first created (i.e. when this function returns the
-                            value SI_INSERTED). If you wish to create a section
-                            with a comment then you need to create the section
-                            separately to the key. The comment string must be
-                            in full comment form already (have a comment
-                            character starting every line).
+    /** Default constructor.
 
-        @return SI_Error    See error definitions
-        @return SI_UPDATED  Value was updated
-        @return SI_INSERTED Value was inserted
+        @param a_bIsUtf8     See the method SetUnicode() for details.
+        @param a_bMultiKey   See the method SetMultiKey() for details.
+        @param a_bMultiLine  See the method SetMultiLine() for details.
      */
-    SI_Error SetValue(
-        const SI_CHAR * a_pSection,
-        const SI_CHAR * a_pKey,
-        const SI_CHAR * a_pValue,
-        const SI_CHAR * a_pComment = NULL
-        )
-    {
-        return AddEntry(a_pSection, a_pKey, a_pValue, a_pComment, true);
-    }
+    CSimpleIniTempl(
+        bool a_bIsUtf8 = false,
+        bool a_bMultiKey = false,
+        bool a_bMultiLine = false
+        );
 
-    /** Add or update a numeric value. This will always insert
-        when multiple keys are enabled.
+    /** Destructor */
+    ~CSimpleIniTempl();
 
-        @param a_pSection   Section to add or update
-        @param a_pKey       Key to add or update. 
-        @param a_nValue     Value to set. 
-        @param a_pComment   Comment to be associated with the key. See the 
-                            notes on SetValue() for comments.
-        @param a_bUseHex    By default the value will be written to the file 
-                            in decimal format. Set this to true to write it 
-                            as hexadecimal.
+    /** Deallocate all memory stored by this object */
+    void Reset();
 
-        @return SI_Error    See error definitions
-        @return SI_UPDATED  Value was updated
-        @return SI_INSERTED Value was inserted
-     */
-    SI_Error SetLongValue(
-        const SI_CHAR * a_pSection,
-        const SI_CHAR * a_pKey,
-        long            a_nValue,
-        const SI_CHAR * a_pComment = NULL,
-        bool            a_bUseHex = false
-        );
+    /*-----------------------------------------------------------------------*/
+    /** @{ @name Settings */
 
-    /** Add or update a boolean value. This will always insert
-        when multiple keys are enabled.
+    /** Set the storage format of the INI data. This affects both the loading
+        and saving of the INI data using all of the Load/Save API functions.
+        This value cannot be changed after any INI data has been loaded.
 
-        @param a_pSection   Section to add or update
-        @param a_pKey       Key to add or update. 
-        @param a_bValue     Value to set. 
-        @param a_pComment   Comment to be associated with the key. See the 
-                            notes on SetValue() for comments.
+        If the file is not set to Unicode (UTF-8), then the data encoding is
+        assumed to be the OS native encoding. This encoding is the system
+        locale on Linux/Unix and the legacy MBCS encoding on Windows NT/2K/XP.
+        If the storage format is set to Unicode then the file will be loaded
+        as UTF-8 encoded data regardless of the native file encoding. If
+        SI_CHAR == char then all of the char* parameters take and return UTF-8
+        encoded data regardless of the system locale.
 
-        @return SI_Error    See error definitions
-        @return SI_UPDATED  Value was updated
-        @return SI_INSERTED Value was inserted
+        \param a_bIsUtf8     Assume UTF-8 encoding for the source?
      */
-    SI_Error SetBoolValue(
-        const SI_CHAR * a_pSection,
-        const SI_CHAR * a_pKey,
-        bool            a_nValue,
-        const SI_CHAR * a_pComment = NULL
-        );
+    void SetUnicode(bool a_bIsUtf8 = true) {
+        if (!m_pData) m_bStoreIsUtf8 = a_bIsUtf8;
+    }
 
-    /** Delete an entire section, or a key from a section. Note that the
-        data returned by GetSection is invalid and must not be used after
-        anything has been deleted from that section using this method.
-        Note when multiple keys is enabled, this will delete all keys with
-        that name; there is no way to selectively delete individual key/values
-        in this situation.
+    /** Get the storage format of the INI data. */
+    bool IsUnicode() const { return m_bStoreIsUtf8; }
 
-        @param a_pSection       Section to delete key from, or if
-                                a_pKey is NULL, the section to remove.
-        @param a_pKey           Key to remove from the section. Set to
-                                NULL to remove the entire section.
-        @param a_bRemoveEmpty   If the section is empty after this key has
-                                been deleted, should the empty section be
-                                removed?
+    /** Should multiple identical keys be permitted in the file. If set to false
+        then the last value encountered will be used as the value of the key.
+        If set to true, then all values will be available to be queried. For
+        example, with the following input:
 
-        @return true            Key or section was deleted.
-        @return false           Key or section was not found.
+        <pre>
+        [section]
+        test=value1
+        test=value2
+        </pre>
+
+        Then with SetMultiKey(true), both of the values "value1" and "value2"
+        will be returned for the key test. If SetMultiKey(false) is used, then
+        the value for "test" will only be "value2". This value may be changed
+        at any time.
+
+        \param a_bAllowMultiKey  Allow multi-keys in the source?
      */
-    bool Delete(
-        const SI_CHAR * a_pSection,
-        const SI_CHAR * a_pKey,
-        bool            a_bRemoveEmpty = false
-        );
+    void SetMultiKey(bool a_bAllowMultiKey = true) {
+        m_bAllowMultiKey = a_bAllowMultiKey;
+    }
 
-    /*-----------------------------------------------------------------------*/
-    /** @}
-        @{ @name Converter */
+    /** Get the storage format of the INI data. */
+    bool IsMultiKey() const { return m_bAllowMultiKey; }
 
-    /** Return a conversion object to convert text to the same encoding
-        as is used by the Save(), SaveFile() and SaveString() functions.
-        Use this to prepare the strings that you wish to append or prepend
-        to the output INI data.
+    /** Should data values be permitted to span multiple lines in the file. If
+        set to false then the multi-line construct <<<TAG as a value will be
+        returned as is instead of loading the data. This value may be changed
+        at any time.
+
+        \param a_bAllowMultiLine     Allow multi-line values in the source?
      */
-    Converter GetConverter() const {
-        return Converter(m_bStoreIsUtf8);
+    void SetMultiLine(bool a_bAllowMultiLine = true) {
+        m_bAllowMultiLine = a_bAllowMultiLine;
+    }
+
+    /** Query the status of multi-line data */
+    bool IsMultiLine() const { return m_bAllowMultiLine; }
+
+    /** Should section and key lookups use a hash index. When enabled an
+        open addressing hash table over the section names and the names of
+        the keys in each section is maintained in addition to the sorted
+        maps, making GetValue() and friends O(1) instead of O(log n) string
+        comparisons. The sorted maps are still used for iteration, so the
+        load order used by Save() is unaffected. This costs some extra memory
+        per section and key and so is off by default. This value may be
+        changed at any time.
+
+        \param a_bUseHashIndex      Maintain a hash index for lookups?
+     */
+    void SetHashIndex(bool a_bUseHashIndex = true);
+
+    /** Query the status of the hash index */
+    bool IsHashIndex() const { return m_bUseHashIndex; }
+
+    /** Collect diagnostics while loading or parsing. Each line that is
+        skipped because it isn't valid (e.g. a key without '='), and each
+        multi-line value without an end tag, adds the line and column where
+        it starts to a_pDiagnostics. Entries are appended, the vector is not
+        cleared. Only data which is actually parsed is checked, so for
+        LoadFileSection() this ends with the section. Nothing is collected
+        if SI_NO_DIAGNOSTICS is defined. This value may be changed at any
+        time.
+
+        \param a_pDiagnostics   Vector for the diagnostics, or NULL to stop
+                                collecting them. It must remain valid while
+                                it is set.
+     */
+    void SetDiagnostics(SI_Diagnostics * a_pDiagnostics) {
+        m_pDiagnostics = a_pDiagnostics;
+    }
+
+    /** Get the vector that diagnostics are collected in, or NULL */
+    SI_Diagnostics * GetDiagnostics() const { return m_pDiagnostics; }
+
+    /** Should include directives be processed when loading. When enabled,
+        lines of the form
+
+        <pre>
+        !include common.ini
+        !includedir conf.d
+        </pre>
+
+        load the named file, or every *.ini and *.cfg file in the directory
+        in order of name, as if the contents were at that point. Relative
+        paths are from the directory of the file with the directive if it
+        was loaded with LoadFile(const char *) or LoadFileMapped(), and from
+        the current directory otherwise. An included file starts outside of
+        any section and doesn't change the section of the file including
+        it. Includes may be nested up to SI_MAX_INCLUDE_DEPTH deep.
+
+        The files included by one load are read and parsed at the same time
+        into separate objects, on up to one thread per processor (unless
+        SI_NO_THREADS is defined). They are then added in order, so the
+        result, including the load order used by Save(), is the same as if
+        the files had been loaded one after the other. The load fails
+        without adding anything if an included file can't be loaded.
+
+        Directives are only recognised by the Load() and LoadFile()
+        functions, Parse(), ParseFile(), LoadFileSection() and loading from
+        a stream skip them as invalid lines. This value may be changed at
+        any time.
+
+        \param a_bAllowIncludes     Process include directives?
+     */
+    void SetIncludes(bool a_bAllowIncludes = true) {
+        m_bAllowIncludes = a_bAllowIncludes;
     }
 
+    /** Query the status of include directives */
+    bool IsIncludes() const { return m_bAllowIncludes; }
+
     /*-----------------------------------------------------------------------*/
-    /** @} */
+    /** @}
+        @{ @name Loading INI Data */
 
-private:
-    // copying is not permitted
-    CSimpleIniTempl(const CSimpleIniTempl &); // disabled
-    CSimpleIniTempl & operator=(const CSimpleIniTempl &); // disabled
+    /** Load an INI file from disk into memory
 
-    /** Parse the data looking for a file comment and store it if found.
+        @param a_pszFile    Path of the file to be loaded. This will be passed
+                            to fopen() and so must be a valid path for the
+                            current platform.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error LoadFile(
+        const char * a_pszFile
+        );
+
+    /** Load an INI file by mapping it into memory and parsing it in place.
+        See the section on memory mapped files for details. If the data
+        cannot be parsed in place (e.g. SI_CHAR is not char, data has
+        already been loaded or memory mapping is not supported), then this
+        is the same as LoadFile().
+
+        @param a_pszFile    Path of the file to be loaded.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error LoadFileMapped(
+        const char * a_pszFile
+        );
+
+#ifdef SI_HAS_WIDE_FILE
+    /** Load an INI file from disk into memory
+
+        @param a_pwszFile   Path of the file to be loaded in UTF-16.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error LoadFile(
+        const SI_WCHAR_T * a_pwszFile
+        );
+#endif // SI_HAS_WIDE_FILE
+
+    /** Load the file from a file pointer.
+
+        @param a_fpFile     Valid file pointer to read the file data from. The
+                            file will be read until end of file.
+
+        @return SI_Error    See error definitions
     */
-    SI_Error FindFileComment(
-        SI_CHAR *&      a_pData,
-        bool            a_bCopyStrings
+    SI_Error LoadFile(
+        FILE * a_fpFile
+        );
+
+#ifdef SI_SUPPORT_IOSTREAMS
+    /** Load INI file data from an istream. The data is parsed as it is
+        read (see StreamParser) and the strings are copied as if added by
+        SetValue().
+
+        @param a_istream    Stream to read from
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error Load(
+        std::istream & a_istream
+        );
+#endif // SI_SUPPORT_IOSTREAMS
+
+    /** Load INI file data direct from a std::string
+
+        @param a_strData    Data to be loaded
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error Load(const std::string & a_strData) {
+        return Load(a_strData.c_str(), a_strData.size());
+    }
+
+    /** Load INI file data direct from memory
+
+        @param a_pData      Data to be loaded
+        @param a_uDataLen   Length of the data in bytes
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error Load(
+        const char *    a_pData,
+        size_t          a_uDataLen
+        );
+
+    /** Load a single section of an INI file. Parsing stops at the end of
+        the first occurrence of the section, so for large files only the
+        data up to the end of that section is read (see ParseFile()). The
+        section and its keys are copied as if added by SetValue(), and are
+        merged with any data already loaded.
+
+        @param a_pszFile    Path of the file to be loaded.
+        @param a_pSection   Name of the section to load.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error LoadFileSection(
+        const char *    a_pszFile,
+        const SI_CHAR * a_pSection
         );
 
-    /** Parse the data looking for the next valid entry. The memory pointed to
-        by a_pData is modified by inserting NULL characters. The pointer is
-        updated to the current location in the block of text.
-    */
-    bool FindEntry(
-        SI_CHAR *&  a_pData,
-        const SI_CHAR *&  a_pSection,
-        const SI_CHAR *&  a_pKey,
-        const SI_CHAR *&  a_pVal,
-        const SI_CHAR *&  a_pComment
-        ) const;
+    /** Byte offset of the invalid UTF-8 sequence that caused the last load
+        or parse to fail with SI_FAIL. The offset is from the start of the
+        file or data, including any BOM. Only set when the storage format
+        is UTF-8 (see SetUnicode()).
+
+        @return             Offset in bytes, or -1 cast to size_t if no
+                            invalid data has been found.
+     */
+    size_t GetErrorOffset() const { return m_uErrorOffset; }
+
+    /*-----------------------------------------------------------------------*/
+    /** @}
+        @{ @name Parsing INI Data */
+
+    /** Parse INI data from memory passing every entry to a handler instead
+        of loading it. No data is stored in this object, but the settings
+        for Unicode and multi-line values are used as for Load().
+
+        @param a_pData      Data to be parsed
+        @param a_uDataLen   Length of the data in bytes
+        @param a_handler    Handler for the entries
+
+        @return SI_Error    See error definitions. SI_OK is also returned
+                            when the handler stops the parse.
+     */
+    SI_Error Parse(
+        const char *    a_pData,
+        size_t          a_uDataLen,
+        EntryHandler &  a_handler
+        ) const;
+
+    /** Parse an INI file passing every entry to a handler instead of
+        loading it. When no conversion of the data is required the file is
+        mapped into memory and parsed in place, so if the handler stops the
+        parse early the rest of the file is never read.
+
+        @param a_pszFile    Path of the file to be parsed.
+        @param a_handler    Handler for the entries
+
+        @return SI_Error    See error definitions. SI_OK is also returned
+                            when the handler stops the parse.
+     */
+    SI_Error ParseFile(
+        const char *    a_pszFile,
+        EntryHandler &  a_handler
+        ) const;
+
+    /*-----------------------------------------------------------------------*/
+    /** @}
+        @{ @name Saving INI Data */
+
+    /** Save an INI file from memory to disk
+
+        @param a_pszFile    Path of the file to be saved. This will be passed
+                            to fopen() and so must be a valid path for the
+                            current platform.
+
+        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is
+                            in UTF-8 format. If it is not UTF-8 then
+                            this parameter is ignored.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error SaveFile(
+        const char *    a_pszFile,
+        bool            a_bAddSignature = true
+        ) const;
+
+    /** Save an INI file from memory to disk so that a crash during the save
+        can't leave a truncated file. See SI_ReplaceFile() for details. The
+        file is not rewritten if its contents would not change.
+
+        @param a_pszFile    Path of the file to be saved. The temporary file
+                            is created next to it.
+
+        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is
+                            in UTF-8 format. If it is not UTF-8 then
+                            this parameter is ignored.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error SaveFileAtomic(
+        const char *    a_pszFile,
+        bool            a_bAddSignature = true
+        ) const;
+
+#ifdef SI_HAS_WIDE_FILE
+    /** Save an INI file from memory to disk
+
+        @param a_pwszFile   Path of the file to be saved in UTF-16.
+
+        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is
+                            in UTF-8 format. If it is not UTF-8 then
+                            this parameter is ignored.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error SaveFile(
+        const SI_WCHAR_T *  a_pwszFile,
+        bool                a_bAddSignature = true
+        ) const;
+#endif // _WIN32
+
+    /** Save the INI data to a file. See Save() for details.
+
+        @param a_pFile      Handle to a file. File should be opened for
+                            binary output.
+
+        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is in
+                            UTF-8 format. If it is not UTF-8 then this value is
+                            ignored. Do not set this to true if anything has
+                            already been written to the file.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error SaveFile(
+        FILE *  a_pFile,
+        bool    a_bAddSignature = false
+        ) const;
+
+    /** Save the INI data. The data will be written to the output device
+        in a format appropriate to the current data, selected by:
+
+        <table>
+            <tr><th>SI_CHAR     <th>FORMAT
+            <tr><td>char        <td>same format as when loaded (MBCS or UTF-8)
+            <tr><td>wchar_t     <td>UTF-8
+            <tr><td>other       <td>UTF-8
+        </table>
+
+        Note that comments from the original data is preserved as per the
+        documentation on comments. The order of the sections and values
+        from the original file will be preserved.
+
+        Any data prepended or appended to the output device must use the the
+        same format (MBCS or UTF-8). You may use the GetConverter() method to
+        convert text to the correct format regardless of the output format
+        being used by SimpleIni.
+
+        To add a BOM to UTF-8 data, write it out manually at the very beginning
+        like is done in SaveFile when a_bUseBOM is true.
+
+        @param a_oOutput    Output writer to write the data to.
+
+        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is in
+                            UTF-8 format. If it is not UTF-8 then this value is
+                            ignored. Do not set this to true if anything has
+                            already been written to the OutputWriter.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error Save(
+        OutputWriter &  a_oOutput,
+        bool            a_bAddSignature = false
+        ) const;
+
+#ifdef SI_SUPPORT_IOSTREAMS
+    /** Save the INI data to an ostream. See Save() for details.
+
+        @param a_ostream    String to have the INI data appended to.
+
+        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is in
+                            UTF-8 format. If it is not UTF-8 then this value is
+                            ignored. Do not set this to true if anything has
+                            already been written to the stream.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error Save(
+        std::ostream &  a_ostream,
+        bool            a_bAddSignature = false
+        ) const
+    {
+        StreamWriter writer(a_ostream);
+        return Save(writer, a_bAddSignature);
+    }
+#endif // SI_SUPPORT_IOSTREAMS
+
+    /** Append the INI data to a string. See Save() for details.
+
+        @param a_sBuffer    String to have the INI data appended to.
+
+        @param a_bAddSignature  Prepend the UTF-8 BOM if the output data is in
+                            UTF-8 format. If it is not UTF-8 then this value is
+                            ignored. Do not set this to true if anything has
+                            already been written to the string.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error Save(
+        std::string &   a_sBuffer,
+        bool            a_bAddSignature = false
+        ) const
+    {
+        StringWriter writer(a_sBuffer);
+        return Save(writer, a_bAddSignature);
+    }
+
+    /*-----------------------------------------------------------------------*/
+    /** @}
+        @{ @name Accessing INI Data */
+
+    /** Retrieve all section names. The list is returned as an STL vector of
+        names and can be iterated or searched as necessary. Note that the
+        collation order of the returned strings is NOT DEFINED.
+
+        NOTE! This structure contains only pointers to strings. The actual
+        string data is stored in memory owned by CSimpleIni. Ensure that the
+        CSimpleIni object is not destroyed or Reset() while these pointers
+        are in use!
+
+        @param a_names          Vector that will receive all of the section
+                                names. See note above!
+     */
+    void GetAllSections(
+        TNamesDepend & a_names
+        ) const;
+
+    /** Retrieve all unique key names in a section. The collation order of the
+        returned strings is NOT DEFINED. Only unique key names are returned.
+
+        NOTE! This structure contains only pointers to strings. The actual
+        string data is stored in memory owned by CSimpleIni. Ensure that the
+        CSimpleIni object is not destroyed or Reset() while these strings
+        are in use!
+
+        @param a_pSection       Section to request data for
+        @param a_names          List that will receive all of the key
+                                names. See note above!
+
+        @return true            Section was found.
+        @return false           Matching section was not found.
+     */
+    bool GetAllKeys(
+        const SI_CHAR * a_pSection,
+        TNamesDepend &  a_names
+        ) const;
+
+    /** Retrieve all values for a specific key. This method can be used when
+        multiple keys are both enabled and disabled.
+
+        NOTE! The returned values are pointers to string data stored in memory
+        owned by CSimpleIni. Ensure that the CSimpleIni object is not destroyed
+        or Reset while you are using this pointer!
+
+        @param a_pSection       Section to search
+        @param a_pKey           Key to search for
+        @param a_values         List to return if the key is not found
+
+        @return true            Key was found.
+        @return false           Matching section/key was not found.
+     */
+    bool GetAllValues(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        TNamesDepend &  a_values
+        ) const;
+
+    /** Query the number of keys in a specific section. Note that if multiple
+        keys are enabled, then this value may be different to the number of
+        keys returned by GetAllKeys.
+
+        @param a_pSection       Section to request data for
+
+        @return -1              Section does not exist in the file
+        @return >=0             Number of keys in the section
+     */
+    int GetSectionSize(
+        const SI_CHAR * a_pSection
+        ) const;
+
+    /** Retrieve all key and value pairs for a section. The data is returned
+        as a pointer to an STL map and can be iterated or searched as
+        desired. Note that multiple entries for the same key may exist when
+        multiple keys have been enabled.
+
+        NOTE! This structure contains only pointers to strings. The actual
+        string data is stored in memory owned by CSimpleIni. Ensure that the
+        CSimpleIni object is not destroyed or Reset() while these strings
+        are in use!
+
+        @param a_pSection       Name of the section to return
+        @return boolean         Was a section matching the supplied
+                                name found.
+     */
+    const TKeyVal * GetSection(
+        const SI_CHAR * a_pSection
+        ) const;
+
+    /** Retrieve the value for a specific key. If multiple keys are enabled
+        (see SetMultiKey) then only the first value associated with that key
+        will be returned, see GetAllValues for getting all values with multikey.
+
+        NOTE! The returned value is a pointer to string data stored in memory
+        owned by CSimpleIni. Ensure that the CSimpleIni object is not destroyed
+        or Reset while you are using this pointer!
+
+        @param a_pSection       Section to search
+        @param a_pKey           Key to search for
+        @param a_pDefault       Value to return if the key is not found
+        @param a_pHasMultiple   Optionally receive notification of if there are
+                                multiple entries for this key.
+
+        @return a_pDefault      Key was not found in the section
+        @return other           Value of the key
+     */
+    const SI_CHAR * GetValue(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        const SI_CHAR * a_pDefault     = NULL,
+        bool *          a_pHasMultiple = NULL
+        ) const;
+
+    /** Retrieve the value for a specific key as a string reference. This is
+        the same as GetValue() except that the section and key do not need to
+        be NULL terminated and the length of the value is returned with it.
+        No memory is allocated unless the section or key name is longer than
+        255 characters.
+
+        NOTE! The returned value refers to string data stored in memory owned
+        by CSimpleIni. Ensure that the CSimpleIni object is not destroyed or
+        Reset while you are using it!
+
+        @param a_section        Section to search
+        @param a_key            Key to search for
+        @param a_default        Value to return if the key is not found
+        @param a_pHasMultiple   Optionally receive notification of if there are
+                                multiple entries for this key.
+
+        @return a_default       Key was not found in the section
+        @return other           Value of the key
+     */
+    StringRef GetValueRef(
+        StringRef       a_section,
+        StringRef       a_key,
+        StringRef       a_default      = StringRef(),
+        bool *          a_pHasMultiple = NULL
+        ) const;
+
+    /** Retrieve a numeric value for a specific key. If multiple keys are enabled
+        (see SetMultiKey) then only the first value associated with that key
+        will be returned, see GetAllValues for getting all values with multikey.
+
+        @param a_pSection       Section to search
+        @param a_pKey           Key to search for
+        @param a_nDefault       Value to return if the key is not found
+        @param a_pHasMultiple   Optionally receive notification of if there are
+                                multiple entries for this key.
+
+        @return a_nDefault      Key was not found in the section
+        @return other           Value of the key
+     */
+    long GetLongValue(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        long            a_nDefault     = 0,
+        bool *          a_pHasMultiple = NULL
+        ) const;
+
+    /** Retrieve a boolean value for a specific key. If multiple keys are enabled
+        (see SetMultiKey) then only the first value associated with that key
+        will be returned, see GetAllValues for getting all values with multikey.
+
+        Strings starting with "t", "y", "on" or "1" are returned as logically true.
+        Strings starting with "f", "n", "of" or "0" are returned as logically false.
+        For all other values the default is returned. Character comparisons are 
+        case-insensitive.
+
+        @param a_pSection       Section to search
+        @param a_pKey           Key to search for
+        @param a_bDefault       Value to return if the key is not found
+        @param a_pHasMultiple   Optionally receive notification of if there are
+                                multiple entries for this key.
+
+        @return a_nDefault      Key was not found in the section
+        @return other           Value of the key
+     */
+    bool GetBoolValue(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        bool            a_bDefault     = false,
+        bool *          a_pHasMultiple = NULL
+        ) const;
+
+    /** Retrieve a time duration for a specific key in milliseconds. The
+        value is a whole number optionally followed by one of the units
+        "ms", "s", "m" or "h" (case-insensitive), e.g. "30s". A number with
+        no units is in milliseconds. Values that can't be parsed or don't
+        fit in a long return the default.
+
+        @param a_pSection       Section to search
+        @param a_pKey           Key to search for
+        @param a_nDefault       Value to return if the key is not found
+        @param a_pHasMultiple   Optionally receive notification of if there are
+                                multiple entries for this key.
+
+        @return a_nDefault      Key was not found in the section
+        @return other           Value of the key in milliseconds
+     */
+    long GetDurationValue(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        long            a_nDefault     = 0,
+        bool *          a_pHasMultiple = NULL
+        ) const;
+
+    /** Retrieve a size in bytes for a specific key. The value is a whole
+        number optionally followed by one of the units "B", "K", "M" or "G"
+        (case-insensitive, and "KB", "MB" and "GB" are also accepted), which
+        are powers of 1024, e.g. "64K". Values that can't be parsed or don't
+        fit in a long return the default.
+
+        @param a_pSection       Section to search
+        @param a_pKey           Key to search for
+        @param a_nDefault       Value to return if the key is not found
+        @param a_pHasMultiple   Optionally receive notification of if there are
+                                multiple entries for this key.
+
+        @return a_nDefault      Key was not found in the section
+        @return other           Value of the key in bytes
+     */
+    long GetByteSizeValue(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        long            a_nDefault     = 0,
+        bool *          a_pHasMultiple = NULL
+        ) const;
+
+    /** Add or update a section or value. This will always insert
+        when multiple keys are enabled.
+
+        @param a_pSection   Section to add or update
+        @param a_pKey       Key to add or update. Set to NULL to
+                            create an empty section.
+        @param a_pValue     Value to set. Set to NULL to create an
+                            empty section.
+        @param a_pComment   Comment to be associated with the section or the
+                            key. If a_pKey is NULL then it will be associated
+                            with the section, otherwise the key. Note that a
+                            comment may be set ONLY when the section or key is
+                            first created (i.e. when this function returns the
+                            value SI_INSERTED). If you wish to create a section
+                            with a comment then you need to create the section
+                            separately to the key. The comment string must be
+                            in full comment form already (have a comment
+                            character starting every line).
+
+        @return SI_Error    See error definitions
+        @return SI_UPDATED  Value was updated
+        @return SI_INSERTED Value was inserted
+     */
+    SI_Error SetValue(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        const SI_CHAR * a_pValue,
+        const SI_CHAR * a_pComment = NULL
+        )
+    {
+        return AddEntry(a_pSection, a_pKey, a_pValue, a_pComment, true);
+    }
+
+    /** Add or update a numeric value. This will always insert
+        when multiple keys are enabled.
+
+        @param a_pSection   Section to add or update
+        @param a_pKey       Key to add or update. 
+        @param a_nValue     Value to set. 
+        @param a_pComment   Comment to be associated with the key. See the 
+                            notes on SetValue() for comments.
+        @param a_bUseHex    By default the value will be written to the file 
+                            in decimal format. Set this to true to write it 
+                            as hexadecimal.
+
+        @return SI_Error    See error definitions
+        @return SI_UPDATED  Value was updated
+        @return SI_INSERTED Value was inserted
+     */
+    SI_Error SetLongValue(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        long            a_nValue,
+        const SI_CHAR * a_pComment = NULL,
+        bool            a_bUseHex = false
+        );
+
+    /** Add or update a boolean value. This will always insert
+        when multiple keys are enabled.
+
+        @param a_pSection   Section to add or update
+        @param a_pKey       Key to add or update. 
+        @param a_bValue     Value to set. 
+        @param a_pComment   Comment to be associated with the key. See the 
+                            notes on SetValue() for comments.
+
+        @return SI_Error    See error definitions
+        @return SI_UPDATED  Value was updated
+        @return SI_INSERTED Value was inserted
+     */
+    SI_Error SetBoolValue(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        bool            a_nValue,
+        const SI_CHAR * a_pComment = NULL
+        );
+
+    /** Delete an entire section, or a key from a section. Note that the
+        data returned by GetSection is invalid and must not be used after
+        anything has been deleted from that section using this method.
+        Note when multiple keys is enabled, this will delete all keys with
+        that name; there is no way to selectively delete individual key/values
+        in this situation.
+
+        @param a_pSection       Section to delete key from, or if
+                                a_pKey is NULL, the section to remove.
+        @param a_pKey           Key to remove from the section. Set to
+                                NULL to remove the entire section.
+        @param a_bRemoveEmpty   If the section is empty after this key has
+                                been deleted, should the empty section be
+                                removed?
+
+        @return true            Key or section was deleted.
+        @return false           Key or section was not found.
+     */
+    bool Delete(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        bool            a_bRemoveEmpty = false
+        );
+
+    /*-----------------------------------------------------------------------*/
+    /** @}
+        @{ @name Converter */
+
+    /** Return a conversion object to convert text to the same encoding
+        as is used by the Save(), SaveFile() and SaveString() functions.
+        Use this to prepare the strings that you wish to append or prepend
+        to the output INI data.
+     */
+    Converter GetConverter() const {
+        return Converter(m_bStoreIsUtf8);
+    }
+
+    /*-----------------------------------------------------------------------*/
+    /** @} */
+
+private:
+    // copying is not permitted
+    CSimpleIniTempl(const CSimpleIniTempl &); // disabled
+    CSimpleIniTempl & operator=(const CSimpleIniTempl &); // disabled
+
+    /** Parse the converted data and add all entries found to our data. The
+        memory pointed to by a_pData is modified as for FindEntry.
+    */
+    SI_Error LoadEntries(
+        SI_CHAR *       a_pData,
+        bool            a_bCopyStrings
+        );
+
+    /** Convert data in the storage format to SI_CHAR, removing the UTF-8
+        BOM if it exists. The returned data is NULL terminated and must be
+        freed with delete[].
+    */
+    SI_Error ConvertData(
+        const char *    a_pData,
+        size_t          a_uDataLen,
+        SI_CHAR *&      a_pConverted,
+        size_t &        a_uConvertedLen
+        ) const;
+
+    /** Record the offset of the first invalid UTF-8 in data which failed
+        to convert. a_uStart is the offset of a_pData in the source.
+    */
+    void SetErrorOffset(
+        const char *    a_pData,
+        size_t          a_uDataLen,
+        size_t          a_uStart
+        ) const;
+
+#ifdef SI_NO_DIAGNOSTICS
+    void BeginDiagnostics(const SI_CHAR *, size_t) const { }
+    void Diagnose(const SI_CHAR *, SI_DiagReason) const { }
+#else // !SI_NO_DIAGNOSTICS
+    /** Index the lines of the data about to be parsed so that diagnostics
+        can be given a position. This must be done before the data is
+        modified. a_uFirstLine is the line number of a_pData. Does nothing
+        unless diagnostics are being collected.
+    */
+    void BeginDiagnostics(
+        const SI_CHAR * a_pData,
+        size_t          a_uFirstLine
+        ) const;
+
+    /** Line and column of a position in the data being parsed */
+    void DiagnosticPosition(
+        const SI_CHAR * a_pPos,
+        SI_Diagnostic & a_diagnostic
+        ) const;
+
+    /** Add a diagnostic for the position a_pPos in the data being parsed */
+    void Diagnose(
+        const SI_CHAR * a_pPos,
+        SI_DiagReason   a_eReason
+        ) const;
+#endif // SI_NO_DIAGNOSTICS
+
+    /** LoadEntries() when include directives are enabled */
+    SI_Error LoadEntriesWithIncludes(
+        SI_CHAR *       a_pData,
+        bool            a_bCopyStrings
+        );
+
+    /** An entry, or the included files for a directive, found by
+        LoadEntriesWithIncludes() and not yet added.
+    */
+    struct PendingEntry {
+        const SI_CHAR * pSection;
+        const SI_CHAR * pKey;
+        const SI_CHAR * pVal;
+        const SI_CHAR * pComment;
+        bool            bInclude;
+        size_t          uFilesEnd;  // end of the files of a directive
+    };
+
+    /** A file included by a directive, loaded into its own object */
+    struct IncludedFile {
+        std::string         strPath;
+        CSimpleIniTempl *   pIni;
+        SI_Error            rc;
+    };
+
+    /** A section or key of an included file, see MergeIncluded() */
+    struct IncludedEntry {
+        int             nOrder;
+        const Entry *   pSection;
+        const Entry *   pKey;       // NULL for the section itself
+        const SI_CHAR * pValue;
+
+        bool operator<(const IncludedEntry & rhs) const {
+            return nOrder < rhs.nOrder;
+        }
+    };
+
+    /** The files of one load, owns the objects they are loaded into */
+    struct IncludedFiles {
+        IncludedFiles() : uThreads(1) { }
+        ~IncludedFiles() {
+            for (size_t n = 0; n < files.size(); ++n) {
+                delete files[n].pIni;
+            }
+        }
+        std::vector<IncludedFile> files;
+        size_t uThreads;
+    private:
+        IncludedFiles(const IncludedFiles &);             // disable
+        IncludedFiles & operator=(const IncludedFiles &); // disable
+    };
+
+    /** Thread function for SI_RunParallel(), loads every uThreads'th file
+        starting with a_uThread.
+    */
+    static void LoadIncludedFiles(void * a_pFiles, size_t a_uThread);
+
+    /** Add the files for an include directive to a_files. a_pDirective is
+        "!include" or "!includedir" and a_pPath is the path it was given.
+    */
+    SI_Error FindIncludedFiles(
+        const SI_CHAR *             a_pDirective,
+        const SI_CHAR *             a_pPath,
+        std::vector<IncludedFile> & a_files
+        );
+
+    /** Add all entries of an included file in the order they were loaded */
+    SI_Error MergeIncluded(
+        const CSimpleIniTempl & a_ini
+        );
+
+    /** Length of the directive name at a_pData if the line is an include
+        directive ("!include" or "!includedir" followed by whitespace),
+        otherwise 0.
+    */
+    size_t IncludeDirective(const SI_CHAR * a_pData) const {
+        static const char szInclude[] = "!include";
+        size_t uLen = 0;
+        for (; szInclude[uLen]; ++uLen) {
+            if (a_pData[uLen] != (SI_CHAR) szInclude[uLen]) {
+                return 0;
+            }
+        }
+        if (a_pData[uLen] == 'd' && a_pData[uLen+1] == 'i' && a_pData[uLen+2] == 'r') {
+            uLen += 3;
+        }
+        return (a_pData[uLen] == ' ' || a_pData[uLen] == '\t') ? uLen : 0;
+    }
+
+    /** Remember the directory of the file being loaded, relative include
+        paths are from there. NULL for the current directory.
+    */
+    void SetIncludeBase(const char * a_pszFile);
+
+    /** Parse the data in place passing every entry to a handler. Returns
+        false if the handler stopped the parse.
+    */
+    bool ParseEntries(
+        SI_CHAR *       a_pData,
+        EntryHandler &  a_handler
+        ) const;
+
+    /** EntryHandler used by Load(std::istream) and LoadFileSection(). It
+        adds every entry and the file comment, or if a section is given only
+        the entries of the first occurrence of that section and then stops
+        the parse.
+    */
+    class EntryLoader : public EntryHandler {
+    public:
+        EntryLoader(CSimpleIniTempl & a_ini, const SI_CHAR * a_pSection)
+            : m_ini(a_ini), m_pSection(a_pSection), m_bFound(false), m_rc(SI_OK) { }
+        bool OnFileComment(const SI_CHAR * a_pComment) {
+            if (m_pSection || m_ini.m_pFileComment) {
+                return true;
+            }
+            m_rc = m_ini.CopyString(a_pComment);
+            if (m_rc < 0) return false;
+            m_ini.m_pFileComment = a_pComment;
+            return true;
+        }
+        bool OnEntry(
+            const SI_CHAR * a_pSection,
+            const SI_CHAR * a_pKey,
+            const SI_CHAR * a_pValue,
+            const SI_CHAR * a_pComment
+            )
+        {
+            if (m_pSection && (m_ini.IsLess(a_pSection, m_pSection)
+                || m_ini.IsLess(m_pSection, a_pSection)))
+            {
+                return !m_bFound;
+            }
+            m_bFound = true;
+            m_rc = m_ini.AddEntry(a_pSection, a_pKey, a_pValue, a_pComment, true);
+            return m_rc >= 0;
+        }
+        SI_Error Result() const { return m_rc < 0 ? m_rc : SI_OK; }
+    private:
+        CSimpleIniTempl &   m_ini;
+        const SI_CHAR *     m_pSection;
+        bool                m_bFound;
+        SI_Error            m_rc;
+    };
+
+    /** Parse the data looking for a file comment and store it if found.
+    */
+    SI_Error FindFileComment(
+        SI_CHAR *&      a_pData,
+        bool            a_bCopyStrings
+        );
+
+    /** Parse the data looking for the next valid entry. The memory pointed to
+        by a_pData is modified by inserting NULL characters. The pointer is
+        updated to the current location in the block of text. If a_pbInclude
+        is given then include directives are returned too, with the name of
+        the directive as the key and the path as the value, and
+        *a_pbInclude is set to show if the entry is a directive.
+    */
+    bool FindEntry(
+        SI_CHAR *&  a_pData,
+        const SI_CHAR *&  a_pSection,
+        const SI_CHAR *&  a_pKey,
+        const SI_CHAR *&  a_pVal,
+        const SI_CHAR *&  a_pComment,
+        bool *      a_pbInclude = NULL
+        ) const;
+
+    /** Add the section/key/value to our data.
+
+        @param a_pSection   Section name. Sections will be created if they
+                            don't already exist.
+        @param a_pKey       Key name. May be NULL to create an empty section.
+                            Existing entries will be updated. New entries will
+                            be created.
+        @param a_pValue     Value for the key.
+        @param a_pComment   Comment to be associated with the section or the
+                            key. If a_pKey is NULL then it will be associated
+                            with the section, otherwise the key. This must be
+                            a string in full comment form already (have a
+                            comment character starting every line).
+        @param a_bCopyStrings   Should copies of the strings be made or not.
+                            If false then the pointers will be used as is.
+    */
+    SI_Error AddEntry(
+        const SI_CHAR * a_pSection,
+        const SI_CHAR * a_pKey,
+        const SI_CHAR * a_pValue,
+        const SI_CHAR * a_pComment,
+        bool            a_bCopyStrings
+        );
+
+    /** Is the supplied character a whitespace character? */
+    inline bool IsSpace(SI_CHAR ch) const {
+        return (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n');
+    }
+
+    /** Does the supplied character start a comment line? */
+    inline bool IsComment(SI_CHAR ch) const {
+        return (ch == ';' || ch == '#');
+    }
+
+
+    /** Skip over a newline character (or characters) for either DOS or UNIX */
+    inline void SkipNewLine(SI_CHAR *& a_pData) const {
+        a_pData += (*a_pData == '\r' && *(a_pData+1) == '\n') ? 2 : 1;
+    }
+
+    /** Make a copy of the supplied string, replacing the original pointer */
+    SI_Error CopyString(const SI_CHAR *& a_pString);
+
+    /** Delete a string from the copied strings buffer if necessary */
+    void DeleteString(const SI_CHAR * a_pString);
+
+    /** Parse a whole number followed by an optional unit. The unit must be
+        one of those in the NULL separated list a_pszUnits (terminated by an
+        empty string) and the matching entry of a_uScales is applied. A
+        number without a unit is not scaled.
+    */
+    bool ParseScaledValue(
+        const SI_CHAR *         a_pszValue,
+        const char *            a_pszUnits,
+        const unsigned long *   a_uScales,
+        long &                  a_nValue
+        ) const;
+
+    /** Length of a string in characters, not including the NULL */
+    static size_t StringLength(const SI_CHAR * a_pString) {
+        size_t uLen = 0;
+        if (sizeof(SI_CHAR) == sizeof(char)) {
+            uLen = strlen((const char *)a_pString);
+        }
+        else if (sizeof(SI_CHAR) == sizeof(wchar_t)) {
+            uLen = wcslen((const wchar_t *)a_pString);
+        }
+        else {
+            for ( ; a_pString[uLen]; ++uLen) /*loop*/ ;
+        }
+        return uLen;
+    }
+
+    /** Internal use of our string comparison function */
+    bool IsLess(const SI_CHAR * a_pLeft, const SI_CHAR * a_pRight) const {
+        const static SI_STRLESS isLess = SI_STRLESS();
+        return isLess(a_pLeft, a_pRight);
+    }
+
+    /** Find a section using the hash index if enabled, the map if not */
+    typename TSection::iterator FindSection(const SI_CHAR * a_pSection);
+    typename TSection::const_iterator FindSection(
+        const SI_CHAR * a_pSection
+        ) const;
+
+    /** Find the first entry of a key in a section, using the hash index if
+        enabled, the map if not.
+     */
+    typename TKeyVal::iterator FindKey(
+        typename TSection::iterator a_iSection,
+        const SI_CHAR *             a_pKey
+        );
+    typename TKeyVal::const_iterator FindKey(
+        typename TSection::const_iterator a_iSection,
+        const SI_CHAR *                   a_pKey
+        ) const;
+
+    /** Slot in the hash index. Section slots only use iSection. Key slots
+        refer to both the section and the first entry for the key in it.
+     */
+    struct IndexSlot {
+        enum { EMPTY, USED, DELETED };
+        size_t                      uHash;
+        int                         nState;
+        typename TSection::iterator iSection;
+        typename TKeyVal::iterator  iKey;
+        IndexSlot() : uHash(0), nState(EMPTY) { }
+    };
+    typedef std::vector<IndexSlot> TIndex;
+
+    /** Hash a section or key name. ASCII letters are folded to lower case
+        and other non-ASCII characters are skipped, so that names which are
+        equal under any of the supported comparisons have the same hash.
+     */
+    static size_t HashName(const SI_CHAR * a_pName) {
+        size_t uHash = (size_t) 2166136261UL;
+        for (; *a_pName; ++a_pName) {
+            unsigned long ch = (unsigned long) *a_pName;
+            if (ch > 0x7F) continue;
+            if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+            uHash = (uHash ^ (size_t) ch) * (size_t) 16777619UL;
+        }
+        return uHash;
+    }
+
+    /** Hash a key name within a section. Map nodes never move so the
+        address of the section is used to distinguish between sections.
+     */
+    static size_t HashKey(
+        typename TSection::const_iterator a_iSection,
+        const SI_CHAR *                   a_pKey
+        ) {
+        size_t uSection = (size_t) &a_iSection->second;
+        return HashName(a_pKey) ^ ((uSection >> 4) * (size_t) 2654435761UL);
+    }
+
+    size_t FindSectionSlot(const SI_CHAR * a_pSection) const;
+    size_t FindKeySlot(
+        typename TSection::const_iterator a_iSection,
+        const SI_CHAR *                   a_pKey
+        ) const;
+    void IndexSection(typename TSection::iterator a_iSection);
+    void IndexKey(
+        typename TSection::iterator a_iSection,
+        typename TKeyVal::iterator  a_iKey
+        );
+    void IndexInsert(TIndex & a_index, size_t & a_uUsed, const IndexSlot & a_slot);
+    void IndexRehash(TIndex & a_index, size_t & a_uUsed, size_t a_uCount);
+    void RebuildIndex();
+
+    bool IsMultiLineTag(const SI_CHAR * a_pData) const;
+    bool IsMultiLineData(const SI_CHAR * a_pData) const;
+    bool LoadMultiLineText(
+        SI_CHAR *&          a_pData,
+        const SI_CHAR *&    a_pVal,
+        const SI_CHAR *     a_pTagName,
+        bool                a_bAllowBlankLinesInComment = false
+        ) const;
+    bool IsNewLineChar(SI_CHAR a_c) const;
+
+    /** Collects the output of Save() and passes it to the OutputWriter in
+        large blocks. Anything still buffered is written on destruction.
+    */
+    class OutputBuffer {
+    public:
+        OutputBuffer(OutputWriter & a_oOutput)
+            : m_oOutput(a_oOutput), m_uUsed(0) { m_buffer.resize(64 * 1024); }
+        ~OutputBuffer() { Flush(); }
+        void Write(const char * a_pBuf, size_t a_uLen) {
+            if (a_uLen > m_buffer.size() - m_uUsed) {
+                Flush();
+                if (a_uLen >= m_buffer.size()) {
+                    m_oOutput.WriteBlock(a_pBuf, a_uLen);
+                    return;
+                }
+            }
+            memcpy(&m_buffer[m_uUsed], a_pBuf, a_uLen);
+            m_uUsed += a_uLen;
+        }
+        void Write(const char * a_pszText) {
+            Write(a_pszText, strlen(a_pszText));
+        }
+        void Flush() {
+            if (m_uUsed > 0) {
+                m_oOutput.WriteBlock(&m_buffer[0], m_uUsed);
+                m_uUsed = 0;
+            }
+        }
+    private:
+        OutputBuffer(const OutputBuffer &);             // disable
+        OutputBuffer & operator=(const OutputBuffer &); // disable
+
+        OutputWriter &      m_oOutput;
+        std::vector<char>   m_buffer;
+        size_t              m_uUsed;
+    };
+
+    /** Iterator to a section or key which sorts in load order, as Save()
+        writes them. The order is copied so that sorting doesn't need to
+        visit the map nodes unless two entries have the same order.
+    */
+    template<class ITER>
+    struct OrderedEntry {
+        int     nOrder;
+        ITER    iEntry;
+
+        OrderedEntry(ITER a_iEntry)
+            : nOrder(a_iEntry->first.nOrder), iEntry(a_iEntry) { }
+        bool operator<(const OrderedEntry & rhs) const {
+            if (nOrder != rhs.nOrder) {
+                return nOrder < rhs.nOrder;
+            }
+            return typename Entry::LoadOrder()(iEntry->first, rhs.iEntry->first);
+        }
+    };
+    typedef std::vector<OrderedEntry<typename TSection::const_iterator> > TSectionOrder;
+    typedef std::vector<OrderedEntry<typename TKeyVal::const_iterator> > TKeyOrder;
+
+    /** Get the first entry of every key of the sections in a_sections.
+        The keys of a_sections[n] are returned in load order in a_keys from
+        a_start[n] up to a_start[n + 1].
+    */
+    void GetKeysInLoadOrder(
+        const TSectionOrder &   a_sections,
+        TKeyOrder &             a_keys,
+        std::vector<size_t> &   a_start
+        ) const;
+
+    bool OutputMultiLineText(
+        OutputBuffer &  a_oOutput,
+        Converter &     a_oConverter,
+        const SI_CHAR * a_pText
+        ) const;
+
+private:
+    /** Copy of the INI file data in our character format. This will be
+        modified when parsed to have NULL characters added after all
+        interesting string entries. All of the string pointers to sections,
+        keys and values point into this block of memory.
+     */
+    SI_CHAR * m_pData;
+
+    /** Length of the data that we have stored. Used when deleting strings
+        to determine if the string is stored here or in the allocated string
+        buffer.
+     */
+    size_t m_uDataLen;
+
+#ifdef SI_HAS_MMAP
+    /** Mapped file view that m_pData points into when the data was loaded
+        with LoadFileMapped().
+     */
+    SI_FileMap m_oMap;
+#endif
+
+    /** File comment for this data, if one exists. */
+    const SI_CHAR * m_pFileComment;
+
+    /** Memory for copies of strings that have been supplied after the file
+        load and for the nodes of m_data. This must be declared before
+        m_data as it is used by it.
+     */
+    SI_Arena m_arena;
+
+    /** Parsed INI data. Section -> (Key -> Value). */
+    TSection m_data;
+
+    /** Is the format of our datafile UTF-8 or MBCS? */
+    bool m_bStoreIsUtf8;
+
+    /** Are multiple values permitted for the same key? */
+    bool m_bAllowMultiKey;
+
+    /** Are data values permitted to span multiple lines? */
+    bool m_bAllowMultiLine;
+
+    /** Next order value, used to ensure sections and keys are output in the
+        same order that they are loaded/added.
+     */
+    int m_nOrder;
+
+    /** Are lookups done through the hash index? */
+    bool m_bUseHashIndex;
+
+    /** Hash index of the sections and the keys in all sections. The number
+        of used slots includes deleted slots as these still take part in
+        probing until the index is rehashed.
+     */
+    TIndex m_sectionIndex;
+    size_t m_uSectionIndexUsed;
+    TIndex m_keyIndex;
+    size_t m_uKeyIndexUsed;
+
+    /** See GetErrorOffset(). Set by the const Parse() functions as well. */
+    mutable size_t m_uErrorOffset;
+
+    /** See SetDiagnostics() */
+    SI_Diagnostics * m_pDiagnostics;
+
+    /** Are include directives processed? */
+    bool m_bAllowIncludes;
+
+    /** Number of files including this one, see SetIncludes() */
+    int m_nIncludeDepth;
+
+    /** Directory of the file being loaded, see SetIncludeBase() */
+    std::string m_strIncludeBase;
+
+#ifndef SI_NO_DIAGNOSTICS
+    /** Data being parsed while diagnostics are collected, the line number
+        of its first line and the offsets of the start of each line. Only
+        valid during a parse.
+     */
+    mutable const SI_CHAR * m_pDiagData;
+    mutable size_t m_uDiagLine;
+    mutable std::vector<size_t> m_diagLines;
+#endif // SI_NO_DIAGNOSTICS
+};
+
+// ---------------------------------------------------------------------------
+//                                  IMPLEMENTATION
+// ---------------------------------------------------------------------------
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::CSimpleIniTempl(
+    bool a_bIsUtf8,
+    bool a_bAllowMultiKey,
+    bool a_bAllowMultiLine
+    )
+  : m_pData(0)
+  , m_uDataLen(0)
+  , m_pFileComment(NULL)
+  , m_data(typename Entry::KeyOrder(), typename TSection::allocator_type(&m_arena))
+  , m_bStoreIsUtf8(a_bIsUtf8)
+  , m_bAllowMultiKey(a_bAllowMultiKey)
+  , m_bAllowMultiLine(a_bAllowMultiLine)
+  , m_nOrder(0)
+  , m_bUseHashIndex(false)
+  , m_uSectionIndexUsed(0)
+  , m_uKeyIndexUsed(0)
+  , m_uErrorOffset((size_t) -1)
+  , m_pDiagnostics(NULL)
+  , m_bAllowIncludes(false)
+  , m_nIncludeDepth(0)
+#ifndef SI_NO_DIAGNOSTICS
+  , m_pDiagData(NULL)
+  , m_uDiagLine(1)
+#endif
+{ }
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::~CSimpleIniTempl()
+{
+    Reset();
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Reset()
+{
+    // remove all data
+#ifdef SI_HAS_MMAP
+    if (m_oMap.IsOpen()) {
+        m_oMap.Close();
+    }
+    else
+#endif
+    delete[] m_pData;
+    m_pData = NULL;
+    m_uDataLen = 0;
+    m_pFileComment = NULL;
+    if (!m_data.empty()) {
+        m_data.erase(m_data.begin(), m_data.end());
+    }
+    TIndex().swap(m_sectionIndex);
+    TIndex().swap(m_keyIndex);
+    m_uSectionIndexUsed = 0;
+    m_uKeyIndexUsed = 0;
+    m_uErrorOffset = (size_t) -1;
+
+    // remove all strings and map nodes
+    m_arena.Release();
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
+    const char * a_pszFile
+    )
+{
+    FILE * fp = NULL;
+#if __STDC_WANT_SECURE_LIB__ && !_WIN32_WCE
+    fopen_s(&fp, a_pszFile, "rb");
+#else // !__STDC_WANT_SECURE_LIB__
+    fp = fopen(a_pszFile, "rb");
+#endif // __STDC_WANT_SECURE_LIB__
+    if (!fp) {
+        return SI_FILE;
+    }
+    SetIncludeBase(a_pszFile);
+    SI_Error rc = LoadFile(fp);
+    SetIncludeBase(NULL);
+    fclose(fp);
+    return rc;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFileMapped(
+    const char * a_pszFile
+    )
+{
+#ifdef SI_HAS_MMAP
+    // we can only parse in place if there is no conversion to be done and
+    // the strings don't need to be copied into data that is already loaded
+    if (sizeof(SI_CHAR) != sizeof(char) || m_pData) {
+        return LoadFile(a_pszFile);
+    }
+    if (!m_oMap.Open(a_pszFile)) {
+        return SI_FILE;
+    }
+    if (m_oMap.Size() == 0) {
+        return SI_OK;
+    }
+
+    // the parser requires a NULL terminator after the data, which the
+    // mapping only provides if the file doesn't end on a page boundary
+    char * pData = m_oMap.Data();
+    size_t uLen = m_oMap.Size();
+    SI_CONVERTER converter(m_bStoreIsUtf8);
+    if (!m_oMap.IsTerminated() || converter.SizeFromStore(pData, uLen) != uLen) {
+        m_oMap.Close();
+        return LoadFile(a_pszFile);
+    }
+
+    // consume the UTF-8 BOM if it exists
+    if (m_bStoreIsUtf8 && uLen >= 3) {
+        if (memcmp(pData, SI_UTF8_SIGNATURE, 3) == 0) {
+            pData += 3;
+            uLen  -= 3;
+        }
+    }
+
+    // the entries point into the view so it is owned from here on, even if
+    // we fail part way through
+    m_pData = (SI_CHAR *) pData;
+    m_uDataLen = uLen+1;
+    SetIncludeBase(a_pszFile);
+    SI_Error rc = LoadEntries(m_pData, false);
+    SetIncludeBase(NULL);
+    return rc;
+#else // !SI_HAS_MMAP
+    return LoadFile(a_pszFile);
+#endif // SI_HAS_MMAP
+}
+
+#ifdef SI_HAS_WIDE_FILE
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
+    const SI_WCHAR_T * a_pwszFile
+    )
+{
+#ifdef _WIN32
+    FILE * fp = NULL;
+#if __STDC_WANT_SECURE_LIB__ && !_WIN32_WCE
+    _wfopen_s(&fp, a_pwszFile, L"rb");
+#else // !__STDC_WANT_SECURE_LIB__
+    fp = _wfopen(a_pwszFile, L"rb");
+#endif // __STDC_WANT_SECURE_LIB__
+    if (!fp) return SI_FILE;
+    SI_Error rc = LoadFile(fp);
+    fclose(fp);
+    return rc;
+#else // !_WIN32 (therefore SI_CONVERT_ICU)
+    char szFile[256];
+    u_austrncpy(szFile, a_pwszFile, sizeof(szFile));
+    return LoadFile(szFile);
+#endif // _WIN32
+}
+#endif // SI_HAS_WIDE_FILE
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
+    FILE * a_fpFile
+    )
+{
+    // load the raw file data
+    int retval = fseek(a_fpFile, 0, SEEK_END);
+    if (retval != 0) {
+        return SI_FILE;
+    }
+    long lSize = ftell(a_fpFile);
+    if (lSize < 0) {
+        return SI_FILE;
+    }
+    if (lSize == 0) {
+        return SI_OK;
+    }
+
+    // when no conversion is required the file is read straight into the
+    // buffer that will be parsed, which avoids holding a second copy
+    if (sizeof(SI_CHAR) == sizeof(char) && !m_pData) {
+        SI_CHAR * pData = new SI_CHAR[lSize+1];
+        if (!pData) {
+            return SI_NOMEM;
+        }
+        fseek(a_fpFile, 0, SEEK_SET);
+        size_t uRead = fread(pData, sizeof(char), lSize, a_fpFile);
+        if (uRead != (size_t) lSize) {
+            delete[] pData;
+            return SI_FILE;
+        }
+        pData[uRead] = 0;
+
+        SI_CONVERTER converter(m_bStoreIsUtf8);
+        if (converter.SizeFromStore((const char *) pData, uRead) == uRead) {
+            // consume the UTF-8 BOM if it exists
+            if (m_bStoreIsUtf8 && uRead >= 3) {
+                if (memcmp(pData, SI_UTF8_SIGNATURE, 3) == 0) {
+                    uRead -= 3;
+                    memmove(pData, pData + 3, uRead + 1);
+                }
+            }
+            m_pData = pData;
+            m_uDataLen = uRead+1;
+            return LoadEntries(m_pData, false);
+        }
+
+        SI_Error rc = Load((const char *) pData, uRead);
+        delete[] pData;
+        return rc;
+    }
+
+    char * pData = new char[lSize];
+    if (!pData) {
+        return SI_NOMEM;
+    }
+    fseek(a_fpFile, 0, SEEK_SET);
+    size_t uRead = fread(pData, sizeof(char), lSize, a_fpFile);
+    if (uRead != (size_t) lSize) {
+        delete[] pData;
+        return SI_FILE;
+    }
+
+    // convert the raw data to unicode
+    SI_Error rc = Load(pData, uRead);
+    delete[] pData;
+    return rc;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Load(
+    const char *    a_pData,
+    size_t          a_uDataLen
+    )
+{
+    if (a_uDataLen == 0) {
+        return SI_OK;
+    }
+
+    SI_CHAR * pData;
+    size_t uLen;
+    SI_Error rc = ConvertData(a_pData, a_uDataLen, pData, uLen);
+    if (rc < 0) return rc;
+
+    // We copy the strings if we are loading data into this class when we
+    // already have stored some.
+    bool bCopyStrings = (m_pData != NULL);
+
+    // parse it
+    rc = LoadEntries(pData, bCopyStrings);
+    if (rc < 0) return rc;
+
+    // store these strings if we didn't copy them
+    if (bCopyStrings) {
+        delete[] pData;
+    }
+    else {
+        m_pData = pData;
+        m_uDataLen = uLen+1;
+    }
+
+    return SI_OK;
+}
 
-    /** Add the section/key/value to our data.
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadEntries(
+    SI_CHAR *       a_pData,
+    bool            a_bCopyStrings
+    )
+{
+    const static SI_CHAR empty = 0;
+    SI_CHAR * pWork = a_pData;
+    const SI_CHAR * pSection = &empty;
+    const SI_CHAR * pItem = NULL;
+    const SI_CHAR * pVal = NULL;
+    const SI_CHAR * pComment = NULL;
+    BeginDiagnostics(a_pData, 1);
 
-        @param a_pSection   Section name. Sections will be created if they
-                            don't already exist.
-        @param a_pKey       Key name. May be NULL to create an empty section.
-                            Existing entries will be updated. New entries will
-                            be created.
-        @param a_pValue     Value for the key.
-        @param a_pComment   Comment to be associated with the section or the
-                            key. If a_pKey is NULL then it will be associated
-                            with the section, otherwise the key. This must be
-                            a string in full comment form already (have a
-                            comment character starting every line).
-        @param a_bCopyStrings   Should copies of the strings be made or not.
-                            If false then the pointers will be used as is.
-    */
-    SI_Error AddEntry(
-        const SI_CHAR * a_pSection,
-        const SI_CHAR * a_pKey,
-        const SI_CHAR * a_pValue,
-        const SI_CHAR * a_pComment,
-        bool            a_bCopyStrings
-        );
+    // find a file comment if it exists, this is a comment that starts at the
+    // beginning of the file and continues until the first blank line.
+    SI_Error rc = FindFileComment(pWork, a_bCopyStrings);
+    if (rc < 0) return rc;
 
-    /** Is the supplied character a whitespace character? */
-    inline bool IsSpace(SI_CHAR ch) const {
-        return (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n');
+    if (m_bAllowIncludes) {
+        return LoadEntriesWithIncludes(pWork, a_bCopyStrings);
     }
 
-    /** Does the supplied character start a comment line? */
-    inline bool IsComment(SI_CHAR ch) const {
-        return (ch == ';' || ch == '#');
+    // add every entry in the file to the data table
+    while (FindEntry(pWork, pSection, pItem, pVal, pComment)) {
+        rc = AddEntry(pSection, pItem, pVal, pComment, a_bCopyStrings);
+        if (rc < 0) return rc;
     }
 
+    return SI_OK;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadEntriesWithIncludes(
+    SI_CHAR *       a_pData,
+    bool            a_bCopyStrings
+    )
+{
+    const static SI_CHAR empty = 0;
+    PendingEntry entry;
+    entry.pSection = &empty;
+    entry.pKey = NULL;
+    entry.pVal = NULL;
+    entry.pComment = NULL;
+    SI_Error rc;
 
-    /** Skip over a newline character (or characters) for either DOS or UNIX */
-    inline void SkipNewLine(SI_CHAR *& a_pData) const {
-        a_pData += (*a_pData == '\r' && *(a_pData+1) == '\n') ? 2 : 1;
+    // find all of the entries and the included files first, so that the
+    // included files can all be loaded at once
+    std::vector<PendingEntry> entries;
+    IncludedFiles included;
+    while (FindEntry(a_pData, entry.pSection, entry.pKey, entry.pVal,
+        entry.pComment, &entry.bInclude))
+    {
+        if (entry.bInclude) {
+            if (m_nIncludeDepth >= SI_MAX_INCLUDE_DEPTH) {
+                return SI_FAIL;
+            }
+            rc = FindIncludedFiles(entry.pKey, entry.pVal, included.files);
+            if (rc < 0) return rc;
+        }
+        entry.uFilesEnd = included.files.size();
+        entries.push_back(entry);
     }
 
-    /** Make a copy of the supplied string, replacing the original pointer */
-    SI_Error CopyString(const SI_CHAR *& a_pString);
-
-    /** Delete a string from the copied strings buffer if necessary */
-    void DeleteString(const SI_CHAR * a_pString);
+    // nested includes are loaded on the thread loading the including file
+    if (!included.files.empty()) {
+        if (m_nIncludeDepth == 0) {
+            included.uThreads = SI_ProcessorCount();
+            if (included.uThreads > included.files.size()) {
+                included.uThreads = included.files.size();
+            }
+        }
+        SI_RunParallel(included.uThreads, LoadIncludedFiles, &included);
+        for (size_t n = 0; n < included.files.size(); ++n) {
+            if (included.files[n].rc < 0) return included.files[n].rc;
+        }
+    }
 
-    /** Internal use of our string comparison function */
-    bool IsLess(const SI_CHAR * a_pLeft, const SI_CHAR * a_pRight) const {
-        const static SI_STRLESS isLess = SI_STRLESS();
-        return isLess(a_pLeft, a_pRight);
+    // add everything in the order it was found
+    size_t uFile = 0;
+    for (size_t n = 0; n < entries.size(); ++n) {
+        const PendingEntry & pending = entries[n];
+        if (!pending.bInclude) {
+            rc = AddEntry(pending.pSection, pending.pKey, pending.pVal,
+                pending.pComment, a_bCopyStrings);
+            if (rc < 0) return rc;
+            continue;
+        }
+        for (; uFile < pending.uFilesEnd; ++uFile) {
+            rc = MergeIncluded(*included.files[uFile].pIni);
+            if (rc < 0) return rc;
+        }
     }
 
-    bool IsMultiLineTag(const SI_CHAR * a_pData) const;
-    bool IsMultiLineData(const SI_CHAR * a_pData) const;
-    bool LoadMultiLineText(
-        SI_CHAR *&          a_pData,
-        const SI_CHAR *&    a_pVal,
-        const SI_CHAR *     a_pTagName,
-        bool                a_bAllowBlankLinesInComment = false
-        ) const;
-    bool IsNewLineChar(SI_CHAR a_c) const;
+    return SI_OK;
+}
 
-    bool OutputMultiLineText(
-        OutputWriter &  a_oOutput,
-        Converter &     a_oConverter,
-        const SI_CHAR * a_pText
-        ) const;
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadIncludedFiles(
+    void *  a_pFiles,
+    size_t  a_uThread
+    )
+{
+    IncludedFiles * pIncluded = (IncludedFiles *) a_pFiles;
+    for (size_t n = a_uThread; n < pIncluded->files.size(); n += pIncluded->uThreads) {
+        IncludedFile & file = pIncluded->files[n];
+        file.rc = file.pIni->LoadFile(file.strPath.c_str());
+    }
+}
 
-private:
-    /** Copy of the INI file data in our character format. This will be
-        modified when parsed to have NULL characters added after all
-        interesting string entries. All of the string pointers to sections,
-        keys and values point into this block of memory.
-     */
-    SI_CHAR * m_pData;
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindIncludedFiles(
+    const SI_CHAR *             a_pDirective,
+    const SI_CHAR *             a_pPath,
+    std::vector<IncludedFile> & a_files
+    )
+{
+    // file names are in the storage format, as for LoadFile(const char *)
+    Converter converter(m_bStoreIsUtf8);
+    if (!converter.ConvertToStore(a_pPath)) {
+        return SI_FAIL;
+    }
+    std::string strPath(converter.Data());
+    if (strPath.empty()) {
+        return SI_FILE;
+    }
+    bool bAbsolute = strPath[0] == '/';
+#ifdef _WIN32
+    bAbsolute = bAbsolute || strPath[0] == '\\'
+        || (strPath.size() > 1 && strPath[1] == ':');
+#endif
+    if (!bAbsolute) {
+        strPath.insert(0, m_strIncludeBase);
+    }
 
-    /** Length of the data that we have stored. Used when deleting strings
-        to determine if the string is stored here or in the allocated string
-        buffer.
-     */
-    size_t m_uDataLen;
+    // the directive is either "!include" or "!includedir"
+    std::vector<std::string> paths;
+    if (!a_pDirective[sizeof("!include") - 1]) {
+        paths.push_back(strPath);
+    }
+    else if (!SI_ListIncludeDir(strPath, paths)) {
+        return SI_FILE;
+    }
 
-    /** File comment for this data, if one exists. */
-    const SI_CHAR * m_pFileComment;
+    for (size_t n = 0; n < paths.size(); ++n) {
+        IncludedFile file;
+        file.strPath = paths[n];
+        file.pIni = NULL;
+        file.rc = SI_OK;
+        a_files.push_back(file);
+
+        CSimpleIniTempl * pIni = new(std::nothrow) CSimpleIniTempl(
+            m_bStoreIsUtf8, m_bAllowMultiKey, m_bAllowMultiLine);
+        if (!pIni) {
+            return SI_NOMEM;
+        }
+        pIni->m_bAllowIncludes = true;
+        pIni->m_nIncludeDepth = m_nIncludeDepth + 1;
+        a_files.back().pIni = pIni;
+    }
+    return SI_OK;
+}
 
-    /** Parsed INI data. Section -> (Key -> Value). */
-    TSection m_data;
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::MergeIncluded(
+    const CSimpleIniTempl & a_ini
+    )
+{
+    // Add every section and key in the order they were loaded, so they are
+    // numbered after the entries already here as if the file had been
+    // loaded at this point. The file was loaded into a new object so every
+    // section and key has its own order.
+    std::vector<IncludedEntry> entries;
+    typename TSection::const_iterator iSection = a_ini.m_data.begin();
+    for ( ; iSection != a_ini.m_data.end(); ++iSection) {
+        IncludedEntry entry = {
+            iSection->first.nOrder, &iSection->first, NULL, NULL
+        };
+        entries.push_back(entry);
+        typename TKeyVal::const_iterator iKey = iSection->second.begin();
+        for ( ; iKey != iSection->second.end(); ++iKey) {
+            IncludedEntry key = {
+                iKey->first.nOrder, &iSection->first, &iKey->first, iKey->second
+            };
+            entries.push_back(key);
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+
+    for (size_t n = 0; n < entries.size(); ++n) {
+        const IncludedEntry & entry = entries[n];
+        const Entry & comment = entry.pKey ? *entry.pKey : *entry.pSection;
+        SI_Error rc = AddEntry(entry.pSection->pItem,
+            entry.pKey ? entry.pKey->pItem : NULL, entry.pValue,
+            comment.pComment, true);
+        if (rc < 0) return rc;
+    }
+    return SI_OK;
+}
 
-    /** This vector stores allocated memory for copies of strings that have
-        been supplied after the file load. It will be empty unless SetValue()
-        has been called.
-     */
-    TNamesDepend m_strings;
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SetIncludeBase(
+    const char * a_pszFile
+    )
+{
+    m_strIncludeBase.clear();
+    if (!a_pszFile) {
+        return;
+    }
+    const char * pEnd = strrchr(a_pszFile, '/');
+#ifdef _WIN32
+    const char * pBackslash = strrchr(a_pszFile, '\\');
+    if (pBackslash > pEnd) {
+        pEnd = pBackslash;
+    }
+#endif
+    if (pEnd) {
+        m_strIncludeBase.assign(a_pszFile, pEnd + 1);
+    }
+}
 
-    /** Is the format of our datafile UTF-8 or MBCS? */
-    bool m_bStoreIsUtf8;
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::ConvertData(
+    const char *    a_pData,
+    size_t          a_uDataLen,
+    SI_CHAR *&      a_pConverted,
+    size_t &        a_uConvertedLen
+    ) const
+{
+    SI_CONVERTER converter(m_bStoreIsUtf8);
 
-    /** Are multiple values permitted for the same key? */
-    bool m_bAllowMultiKey;
+    // consume the UTF-8 BOM if it exists
+    size_t uStart = 0;
+    if (m_bStoreIsUtf8 && a_uDataLen >= 3) {
+        if (memcmp(a_pData, SI_UTF8_SIGNATURE, 3) == 0) {
+            a_pData    += 3;
+            a_uDataLen -= 3;
+            uStart      = 3;
+        }
+    }
 
-    /** Are data values permitted to span multiple lines? */
-    bool m_bAllowMultiLine;
+    // determine the length of the converted data
+    size_t uLen = converter.SizeFromStore(a_pData, a_uDataLen);
+    if (uLen == (size_t)(-1)) {
+        SetErrorOffset(a_pData, a_uDataLen, uStart);
+        return SI_FAIL;
+    }
 
-    /** Next order value, used to ensure sections and keys are output in the
-        same order that they are loaded/added.
-     */
-    int m_nOrder;
-};
+    // allocate memory for the data, ensure that there is a NULL
+    // terminator wherever the converted data ends
+    SI_CHAR * pData = new SI_CHAR[uLen+1];
+    if (!pData) {
+        return SI_NOMEM;
+    }
+    memset(pData, 0, sizeof(SI_CHAR)*(uLen+1));
 
-// ---------------------------------------------------------------------------
-//                                  IMPLEMENTATION
-// ---------------------------------------------------------------------------
+    // convert the data
+    if (!converter.ConvertFromStore(a_pData, a_uDataLen, pData, uLen)) {
+        delete[] pData;
+        SetErrorOffset(a_pData, a_uDataLen, uStart);
+        return SI_FAIL;
+    }
+
+    a_pConverted = pData;
+    a_uConvertedLen = uLen;
+    return SI_OK;
+}
 
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::CSimpleIniTempl(
-    bool a_bIsUtf8,
-    bool a_bAllowMultiKey,
-    bool a_bAllowMultiLine
-    )
-  : m_pData(0)
-  , m_uDataLen(0)
-  , m_pFileComment(NULL)
-  , m_bStoreIsUtf8(a_bIsUtf8)
-  , m_bAllowMultiKey(a_bAllowMultiKey)
-  , m_bAllowMultiLine(a_bAllowMultiLine)
-  , m_nOrder(0)
-{ }
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SetErrorOffset(
+    const char *    a_pData,
+    size_t          a_uDataLen,
+    size_t          a_uStart
+    ) const
+{
+    // the data is only checked again once the conversion has failed
+    if (m_bStoreIsUtf8) {
+        size_t uValid = SI_Utf8Validate(a_pData, a_uDataLen);
+        if (uValid != a_uDataLen) {
+            m_uErrorOffset = a_uStart + uValid;
+        }
+    }
+}
 
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::~CSimpleIniTempl()
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFileSection(
+    const char *    a_pszFile,
+    const SI_CHAR * a_pSection
+    )
 {
-    Reset();
+    EntryLoader loader(*this, a_pSection);
+    SI_Error rc = ParseFile(a_pszFile, loader);
+    if (rc < 0) return rc;
+    return loader.Result();
 }
 
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-void
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Reset()
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Parse(
+    const char *    a_pData,
+    size_t          a_uDataLen,
+    EntryHandler &  a_handler
+    ) const
 {
-    // remove all data
-    delete[] m_pData;
-    m_pData = NULL;
-    m_uDataLen = 0;
-    m_pFileComment = NULL;
-    if (!m_data.empty()) {
-        m_data.erase(m_data.begin(), m_data.end());
+    if (a_uDataLen == 0) {
+        return SI_OK;
     }
 
-    // remove all strings
-    if (!m_strings.empty()) {
-        typename TNamesDepend::iterator i = m_strings.begin();
-        for (; i != m_strings.end(); ++i) {
-            delete[] const_cast<SI_CHAR*>(i->pItem);
-        }
-        m_strings.erase(m_strings.begin(), m_strings.end());
-    }
+    SI_CHAR * pData;
+    size_t uLen;
+    SI_Error rc = ConvertData(a_pData, a_uDataLen, pData, uLen);
+    if (rc < 0) return rc;
+
+    ParseEntries(pData, a_handler);
+    delete[] pData;
+    return SI_OK;
 }
 
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
-    const char * a_pszFile
-    )
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::ParseFile(
+    const char *    a_pszFile,
+    EntryHandler &  a_handler
+    ) const
 {
+#ifdef SI_HAS_MMAP
+    // parse in place in a private mapping of the file if no conversion is
+    // necessary, see LoadFileMapped()
+    if (sizeof(SI_CHAR) == sizeof(char)) {
+        SI_FileMap oMap;
+        if (!oMap.Open(a_pszFile)) {
+            return SI_FILE;
+        }
+        if (oMap.Size() == 0) {
+            return SI_OK;
+        }
+
+        char * pData = oMap.Data();
+        size_t uLen = oMap.Size();
+        SI_CONVERTER converter(m_bStoreIsUtf8);
+        if (oMap.IsTerminated() && converter.SizeFromStore(pData, uLen) == uLen) {
+            if (m_bStoreIsUtf8 && uLen >= 3) {
+                if (memcmp(pData, SI_UTF8_SIGNATURE, 3) == 0) {
+                    pData += 3;
+                }
+            }
+            ParseEntries((SI_CHAR *) pData, a_handler);
+            return SI_OK;
+        }
+    }
+#endif // SI_HAS_MMAP
+
     FILE * fp = NULL;
 #if __STDC_WANT_SECURE_LIB__ && !_WIN32_WCE
     fopen_s(&fp, a_pszFile, "rb");
@@ -1195,165 +3615,351 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
     if (!fp) {
         return SI_FILE;
     }
-    SI_Error rc = LoadFile(fp);
+
+    SI_Error rc = SI_FILE;
+    long lSize = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        lSize = ftell(fp);
+    }
+    if (lSize == 0) {
+        rc = SI_OK;
+    }
+    else if (lSize > 0) {
+        char * pData = new char[lSize];
+        if (!pData) {
+            rc = SI_NOMEM;
+        }
+        else {
+            fseek(fp, 0, SEEK_SET);
+            size_t uRead = fread(pData, sizeof(char), lSize, fp);
+            if (uRead == (size_t) lSize) {
+                rc = Parse(pData, uRead, a_handler);
+            }
+            delete[] pData;
+        }
+    }
     fclose(fp);
     return rc;
 }
 
-#ifdef SI_HAS_WIDE_FILE
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
-    const SI_WCHAR_T * a_pwszFile
-    )
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::ParseEntries(
+    SI_CHAR *       a_pData,
+    EntryHandler &  a_handler
+    ) const
 {
-#ifdef _WIN32
-    FILE * fp = NULL;
-#if __STDC_WANT_SECURE_LIB__ && !_WIN32_WCE
-    _wfopen_s(&fp, a_pwszFile, L"rb");
-#else // !__STDC_WANT_SECURE_LIB__
-    fp = _wfopen(a_pwszFile, L"rb");
-#endif // __STDC_WANT_SECURE_LIB__
-    if (!fp) return SI_FILE;
-    SI_Error rc = LoadFile(fp);
-    fclose(fp);
-    return rc;
-#else // !_WIN32 (therefore SI_CONVERT_ICU)
-    char szFile[256];
-    u_austrncpy(szFile, a_pwszFile, sizeof(szFile));
-    return LoadFile(szFile);
-#endif // _WIN32
+    const static SI_CHAR empty = 0;
+    SI_CHAR * pWork = a_pData;
+    const SI_CHAR * pSection = &empty;
+    const SI_CHAR * pItem = NULL;
+    const SI_CHAR * pVal = NULL;
+    const SI_CHAR * pComment = NULL;
+    BeginDiagnostics(a_pData, 1);
+
+    // the file comment is found as for a first Load(), see FindFileComment()
+    if (LoadMultiLineText(pWork, pComment, NULL, false)) {
+        if (!a_handler.OnFileComment(pComment)) {
+            return false;
+        }
+    }
+
+    while (FindEntry(pWork, pSection, pItem, pVal, pComment)) {
+        if (!a_handler.OnEntry(pSection, pItem, pVal, pComment)) {
+            return false;
+        }
+    }
+    return true;
 }
-#endif // SI_HAS_WIDE_FILE
 
+#ifdef SI_SUPPORT_IOSTREAMS
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadFile(
-    FILE * a_fpFile
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Load(
+    std::istream & a_istream
     )
 {
-    // load the raw file data
-    int retval = fseek(a_fpFile, 0, SEEK_END);
-    if (retval != 0) {
-        return SI_FILE;
-    }
-    long lSize = ftell(a_fpFile);
-    if (lSize < 0) {
-        return SI_FILE;
-    }
-    if (lSize == 0) {
-        return SI_OK;
-    }
-    char * pData = new char[lSize];
-    if (!pData) {
-        return SI_NOMEM;
-    }
-    fseek(a_fpFile, 0, SEEK_SET);
-    size_t uRead = fread(pData, sizeof(char), lSize, a_fpFile);
-    if (uRead != (size_t) lSize) {
-        delete[] pData;
-        return SI_FILE;
+    // parse the entries as they are read, the leading comment only becomes
+    // the file comment if there isn't one already (see FindFileComment)
+    EntryLoader loader(*this, NULL);
+    StreamParser parser(*this, loader, m_pFileComment == NULL);
+    SI_Error rc;
+    char szBuf[512];
+    do {
+        a_istream.get(szBuf, sizeof(szBuf), '\0');
+        rc = parser.Feed(szBuf, (size_t) a_istream.gcount());
+        if (rc < 0) return rc;
     }
+    while (a_istream.good() && !parser.IsStopped());
 
-    // convert the raw data to unicode
-    SI_Error rc = Load(pData, uRead);
-    delete[] pData;
-    return rc;
+    rc = parser.Finish();
+    if (rc < 0) return rc;
+    return loader.Result();
 }
+#endif // SI_SUPPORT_IOSTREAMS
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::StreamParser::StreamParser(
+    const CSimpleIniTempl & a_ini,
+    EntryHandler &          a_handler,
+    bool                    a_bFileComment
+    )
+  : m_ini(a_ini)
+  , m_handler(a_handler)
+  , m_uConverted(0)
+#ifndef SI_NO_DIAGNOSTICS
+  , m_uLine(1)
+#endif
+  , m_bCheckBom(true)
+  , m_bFileComment(a_bFileComment)
+  , m_bStopped(false)
+  , m_bEnded(false)
+{ }
 
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
 SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Load(
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::StreamParser::Feed(
     const char *    a_pData,
     size_t          a_uDataLen
     )
 {
-    SI_CONVERTER converter(m_bStoreIsUtf8);
+    if (m_bStopped || m_bEnded || a_uDataLen == 0) {
+        return SI_OK;
+    }
 
-    if (a_uDataLen == 0) {
+    // as for Load() the data ends at the first NULL character
+    const char * pNull = (const char *) memchr(a_pData, 0, a_uDataLen);
+    if (pNull) {
+        a_uDataLen = pNull - a_pData;
+        m_bEnded = true;
+    }
+    m_store.append(a_pData, a_uDataLen);
+
+    // an entry can't be complete until the end of its line has been seen,
+    // so only parse again if another line was converted
+    size_t uPending = m_pending.size();
+    SI_Error rc = Convert(false);
+    if (rc < 0) return rc;
+    if (m_pending.size() > uPending) {
+        ParsePending(false);
+    }
+    return SI_OK;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::StreamParser::Finish()
+{
+    if (m_bStopped) {
         return SI_OK;
     }
+    SI_Error rc = Convert(true);
+    if (rc < 0) return rc;
+    ParsePending(true);
+    return SI_OK;
+}
 
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::StreamParser::Convert(
+    bool a_bFinal
+    )
+{
     // consume the UTF-8 BOM if it exists
-    if (m_bStoreIsUtf8 && a_uDataLen >= 3) {
-        if (memcmp(a_pData, SI_UTF8_SIGNATURE, 3) == 0) {
-            a_pData    += 3;
-            a_uDataLen -= 3;
+    if (m_bCheckBom) {
+        if (m_store.size() < 3 && !a_bFinal) {
+            return SI_OK;
+        }
+        if (m_ini.m_bStoreIsUtf8 && m_store.size() >= 3
+            && memcmp(m_store.data(), SI_UTF8_SIGNATURE, 3) == 0)
+        {
+            m_store.erase(0, 3);
+            m_uConverted = 3;
         }
+        m_bCheckBom = false;
     }
 
-    // determine the length of the converted data
-    size_t uLen = converter.SizeFromStore(a_pData, a_uDataLen);
-    if (uLen == (size_t)(-1)) {
-        return SI_FAIL;
+    // convert up to the end of the last complete line so that a multi-byte
+    // character is never split. The newline bytes can't be part of one.
+    size_t uLen = m_store.size();
+    if (!a_bFinal) {
+        size_t uEnd = m_store.find_last_of("\r\n");
+        uLen = (uEnd == std::string::npos) ? 0 : uEnd + 1;
     }
-
-    // allocate memory for the data, ensure that there is a NULL
-    // terminator wherever the converted data ends
-    SI_CHAR * pData = new SI_CHAR[uLen+1];
-    if (!pData) {
-        return SI_NOMEM;
+    if (uLen == 0) {
+        return SI_OK;
     }
-    memset(pData, 0, sizeof(SI_CHAR)*(uLen+1));
 
-    // convert the data
-    if (!converter.ConvertFromStore(a_pData, a_uDataLen, pData, uLen)) {
-        delete[] pData;
+    SI_CONVERTER converter(m_ini.m_bStoreIsUtf8);
+    size_t uSize = converter.SizeFromStore(m_store.data(), uLen);
+    if (uSize == (size_t)(-1)) {
+        m_ini.SetErrorOffset(m_store.data(), uLen, m_uConverted);
         return SI_FAIL;
     }
+    if (uSize > 0) {
+        size_t uOffset = m_pending.size();
+        m_pending.resize(uOffset + uSize);
+        if (!converter.ConvertFromStore(m_store.data(), uLen,
+            &m_pending[uOffset], uSize))
+        {
+            m_pending.resize(uOffset);
+            m_ini.SetErrorOffset(m_store.data(), uLen, m_uConverted);
+            return SI_FAIL;
+        }
 
-    // parse it
+        // the size may be a worst case estimate, so remove the unused space
+        while (uSize > 0 && m_pending[uOffset + uSize - 1] == 0) {
+            --uSize;
+        }
+        m_pending.resize(uOffset + uSize);
+    }
+    m_store.erase(0, uLen);
+    m_uConverted += uLen;
+    return SI_OK;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::StreamParser::ParsePending(
+    bool a_bFinal
+    )
+{
     const static SI_CHAR empty = 0;
-    SI_CHAR * pWork = pData;
-    const SI_CHAR * pSection = &empty;
+    if (m_pending.empty()) {
+        return;
+    }
+
+    // FindEntry() modifies the data so a copy is parsed, and only the data
+    // of the entries that are complete is removed from m_pending.
+    m_work.assign(m_pending.begin(), m_pending.end());
+    m_work.push_back(0);
+    SI_CHAR * pStart = &m_work[0];
+    SI_CHAR * pEnd = pStart + m_pending.size();
+    SI_CHAR * pWork = pStart;
+    SI_CHAR * pDone = pStart;
+    const SI_CHAR * pSection = m_section.empty() ? &empty : &m_section[0];
+    const SI_CHAR * pDoneSection = pSection;
     const SI_CHAR * pItem = NULL;
     const SI_CHAR * pVal = NULL;
     const SI_CHAR * pComment = NULL;
+#ifndef SI_NO_DIAGNOSTICS
+    size_t uDiagnostics = m_ini.m_pDiagnostics ? m_ini.m_pDiagnostics->size() : 0;
+    m_ini.BeginDiagnostics(pStart, m_uLine);
+#endif
 
-    // We copy the strings if we are loading data into this class when we
-    // already have stored some.
-    bool bCopyStrings = (m_pData != NULL);
+    // An entry is only complete when there is data after it, until then
+    // the line, multi-line value or comment may continue in the next chunk.
+    if (m_bFileComment) {
+        bool bFound = m_ini.LoadMultiLineText(pWork, pComment, NULL, false);
+        if (pWork == pEnd && !a_bFinal) {
+            return;
+        }
+        m_bFileComment = false;
+        if (bFound && !m_handler.OnFileComment(pComment)) {
+            m_bStopped = true;
+        }
+        pDone = pWork;
+    }
 
-    // find a file comment if it exists, this is a comment that starts at the
-    // beginning of the file and continues until the first blank line.
-    SI_Error rc = FindFileComment(pWork, bCopyStrings);
-    if (rc < 0) return rc;
+    while (!m_bStopped
+        && m_ini.FindEntry(pWork, pSection, pItem, pVal, pComment))
+    {
+        if (pWork == pEnd && !a_bFinal) {
+            break;
+        }
+        if (!m_handler.OnEntry(pSection, pItem, pVal, pComment)) {
+            m_bStopped = true;
+        }
+        pDone = pWork;
+        pDoneSection = pSection;
+    }
 
-    // add every entry in the file to the data table
-    while (FindEntry(pWork, pSection, pItem, pVal, pComment)) {
-        rc = AddEntry(pSection, pItem, pVal, pComment, bCopyStrings);
-        if (rc < 0) return rc;
+    if (m_bStopped || a_bFinal) {
+        m_pending.clear();
+        return;
     }
 
-    // store these strings if we didn't copy them
-    if (bCopyStrings) {
-        delete[] pData;
+    // the current section may be in the data that is about to be removed
+    if (m_section.empty() || pDoneSection != &m_section[0]) {
+        m_section.assign(pDoneSection,
+            pDoneSection + CSimpleIniTempl::StringLength(pDoneSection) + 1);
     }
-    else {
-        m_pData = pData;
-        m_uDataLen = uLen+1;
+    m_pending.erase(m_pending.begin(), m_pending.begin() + (pDone - pStart));
+
+#ifndef SI_NO_DIAGNOSTICS
+    // the data after pDone is parsed again with the next chunk, so any
+    // diagnostics for it would be repeated
+    if (m_ini.m_pDiagnostics) {
+        SI_Diagnostic done;
+        m_ini.DiagnosticPosition(pDone, done);
+        SI_Diagnostics & diagnostics = *m_ini.m_pDiagnostics;
+        while (diagnostics.size() > uDiagnostics
+            && (diagnostics.back().uLine > done.uLine
+                || (diagnostics.back().uLine == done.uLine
+                    && diagnostics.back().uColumn >= done.uColumn)))
+        {
+            diagnostics.pop_back();
+        }
+        m_uLine = done.uLine;
     }
+#endif // SI_NO_DIAGNOSTICS
+}
 
-    return SI_OK;
+#ifndef SI_NO_DIAGNOSTICS
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::BeginDiagnostics(
+    const SI_CHAR * a_pData,
+    size_t          a_uFirstLine
+    ) const
+{
+    m_pDiagData = NULL;
+    if (!m_pDiagnostics) {
+        return;
+    }
+
+    // newlines are "\r\n", "\n" or "\r" as for SkipNewLine()
+    m_diagLines.clear();
+    m_diagLines.push_back(0);
+    for (const SI_CHAR * pData = a_pData; *pData; ++pData) {
+        if (*pData == '\n' || (*pData == '\r' && pData[1] != '\n')) {
+            m_diagLines.push_back((size_t) (pData + 1 - a_pData));
+        }
+    }
+    m_pDiagData = a_pData;
+    m_uDiagLine = a_uFirstLine;
 }
 
-#ifdef SI_SUPPORT_IOSTREAMS
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
-SI_Error
-CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Load(
-    std::istream & a_istream
-    )
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::DiagnosticPosition(
+    const SI_CHAR * a_pPos,
+    SI_Diagnostic & a_diagnostic
+    ) const
 {
-    std::string strData;
-    char szBuf[512];
-    do {
-        a_istream.get(szBuf, sizeof(szBuf), '\0');
-        strData.append(szBuf);
+    size_t uOffset = (size_t) (a_pPos - m_pDiagData);
+    std::vector<size_t>::const_iterator iLine = std::upper_bound(
+        m_diagLines.begin(), m_diagLines.end(), uOffset) - 1;
+    a_diagnostic.uLine = m_uDiagLine + (size_t) (iLine - m_diagLines.begin());
+    a_diagnostic.uColumn = uOffset - *iLine + 1;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Diagnose(
+    const SI_CHAR * a_pPos,
+    SI_DiagReason   a_eReason
+    ) const
+{
+    if (!m_pDiagData) {
+        return;
     }
-    while (a_istream.good());
-    return Load(strData);
+    SI_Diagnostic diagnostic;
+    DiagnosticPosition(a_pPos, diagnostic);
+    diagnostic.eReason = a_eReason;
+    m_pDiagnostics->push_back(diagnostic);
 }
-#endif // SI_SUPPORT_IOSTREAMS
+#endif // SI_NO_DIAGNOSTICS
 
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
 SI_Error
@@ -1389,10 +3995,14 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
     const SI_CHAR *&  a_pSection,
     const SI_CHAR *&  a_pKey,
     const SI_CHAR *&  a_pVal,
-    const SI_CHAR *&  a_pComment
+    const SI_CHAR *&  a_pComment,
+    bool *            a_pbInclude
     ) const
 {
     a_pComment = NULL;
+    if (a_pbInclude) {
+        *a_pbInclude = false;
+    }
 
     SI_CHAR * pTrail = NULL;
     while (*a_pData) {
@@ -1411,8 +4021,36 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
             continue;
         }
 
+        // process include directives, the path is the rest of the line
+        size_t uDirective = a_pbInclude ? IncludeDirective(a_pData) : 0;
+        if (uDirective) {
+            a_pKey = a_pData;
+            a_pData += uDirective;
+            *a_pData++ = 0;
+            while (*a_pData && !IsNewLineChar(*a_pData) && IsSpace(*a_pData)) {
+                ++a_pData;
+            }
+
+            a_pVal = a_pData;
+            a_pData = SI_ScanLine(a_pData, (SI_CHAR) 0);
+            pTrail = a_pData - 1;
+            if (*a_pData) {
+                SkipNewLine(a_pData);
+            }
+            while (pTrail >= a_pVal && IsSpace(*pTrail)) {
+                --pTrail;
+            }
+            ++pTrail;
+            *pTrail = 0;
+
+            *a_pbInclude = true;
+            return true;
+        }
+
         // process section names
         if (*a_pData == '[') {
+            const SI_CHAR * pLine = a_pData;
+
             // skip leading spaces
             ++a_pData;
             while (*a_pData && IsSpace(*a_pData)) {
@@ -1422,12 +4060,11 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
             // find the end of the section name (it may contain spaces)
             // and convert it to lowercase as necessary
             a_pSection = a_pData;
-            while (*a_pData && *a_pData != ']' && !IsNewLineChar(*a_pData)) {
-                ++a_pData;
-            }
+            a_pData = SI_ScanLine(a_pData, (SI_CHAR) ']');
 
             // if it's an invalid line, just skip it
             if (*a_pData != ']') {
+                Diagnose(pLine, SI_DIAG_SECTION);
                 continue;
             }
 
@@ -1441,9 +4078,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
 
             // skip to the end of the line
             ++a_pData;  // safe as checked that it == ']' above
-            while (*a_pData && !IsNewLineChar(*a_pData)) {
-                ++a_pData;
-            }
+            a_pData = SI_ScanLine(a_pData, (SI_CHAR) 0);
 
             a_pKey = NULL;
             a_pVal = NULL;
@@ -1453,20 +4088,18 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
         // find the end of the key name (it may contain spaces)
         // and convert it to lowercase as necessary
         a_pKey = a_pData;
-        while (*a_pData && *a_pData != '=' && !IsNewLineChar(*a_pData)) {
-            ++a_pData;
-        }
+        a_pData = SI_ScanLine(a_pData, (SI_CHAR) '=');
 
         // if it's an invalid line, just skip it
         if (*a_pData != '=') {
+            Diagnose(a_pKey, SI_DIAG_NO_EQUALS);
             continue;
         }
 
         // empty keys are invalid
         if (a_pKey == a_pData) {
-            while (*a_pData && !IsNewLineChar(*a_pData)) {
-                ++a_pData;
-            }
+            Diagnose(a_pKey, SI_DIAG_EMPTY_KEY);
+            a_pData = SI_ScanLine(a_pData, (SI_CHAR) 0);
             continue;
         }
 
@@ -1486,9 +4119,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindEntry(
 
         // find the end of the value which is the end of this line
         a_pVal = a_pData;
-        while (*a_pData && !IsNewLineChar(*a_pData)) {
-            ++a_pData;
-        }
+        a_pData = SI_ScanLine(a_pData, (SI_CHAR) 0);
 
         // remove trailing spaces from the value
         pTrail = a_pData - 1;
@@ -1639,7 +4270,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadMultiLineText(
 
         // find the end of this line
         pCurrLine = a_pData;
-        while (*a_pData && !IsNewLineChar(*a_pData)) ++a_pData;
+        a_pData = SI_ScanLine(a_pData, (SI_CHAR) 0);
 
         // move this line down to the location that it should be if necessary
         if (pDataLine < pCurrLine) {
@@ -1662,8 +4293,12 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadMultiLineText(
         }
 
         // if we are at the end of the data then we just automatically end
-        // this entry and return the current data.
+        // this entry and return the current data. The tag name follows
+        // the "<<<" on the line of the key.
         if (!cEndOfLineChar) {
+            if (a_pTagName) {
+                Diagnose(a_pTagName - 3, SI_DIAG_NO_END_TAG);
+            }
             return true;
         }
 
@@ -1684,8 +4319,12 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::LoadMultiLineText(
     // the data (which ends at the end of the last line) needs to be
     // null-terminated BEFORE before the newline character(s). If the
     // user wants a new line in the multi-line data then they need to
-    // add an empty line before the tag.
-    *--pDataLine = '\0';
+    // add an empty line before the tag. When the tag is the first line
+    // the value is empty.
+    if (pDataLine > a_pVal) {
+        --pDataLine;
+    }
+    *pDataLine = '\0';
 
     // if looking for a tag and if we aren't at the end of the data,
     // then move a_pData to the start of the next line.
@@ -1704,23 +4343,12 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::CopyString(
     const SI_CHAR *& a_pString
     )
 {
-    size_t uLen = 0;
-    if (sizeof(SI_CHAR) == sizeof(char)) {
-        uLen = strlen((const char *)a_pString);
-    }
-    else if (sizeof(SI_CHAR) == sizeof(wchar_t)) {
-        uLen = wcslen((const wchar_t *)a_pString);
-    }
-    else {
-        for ( ; a_pString[uLen]; ++uLen) /*loop*/ ;
-    }
-    ++uLen; // NULL character
-    SI_CHAR * pCopy = new SI_CHAR[uLen];
+    size_t uLen = StringLength(a_pString) + 1; // NULL character
+    SI_CHAR * pCopy = (SI_CHAR *) m_arena.Allocate(sizeof(SI_CHAR)*uLen);
     if (!pCopy) {
         return SI_NOMEM;
     }
     memcpy(pCopy, a_pString, sizeof(SI_CHAR)*uLen);
-    m_strings.push_back(pCopy);
     a_pString = pCopy;
     return SI_OK;
 }
@@ -1749,8 +4377,10 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::AddEntry(
 
     // check for existence of the section first if we need string copies
     typename TSection::iterator iSection = m_data.end();
+    if (a_bCopyStrings || m_bUseHashIndex) {
+        iSection = FindSection(a_pSection);
+    }
     if (a_bCopyStrings) {
-        iSection = m_data.find(a_pSection);
         if (iSection == m_data.end()) {
             // if the section doesn't exist then we need a copy as the
             // string needs to last beyond the end of this function
@@ -1766,12 +4396,16 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::AddEntry(
         if (a_pComment && (!a_pKey || !a_pValue)) {
             oKey.pComment = a_pComment;
         }
-        typename TSection::value_type oEntry(oKey, TKeyVal());
+        typename TSection::value_type oEntry(oKey,
+            TKeyVal(typename Entry::KeyOrder(), m_data.get_allocator()));
         typedef typename TSection::iterator SectionIterator;
         std::pair<SectionIterator,bool> i =
             m_data.insert(oEntry);
         iSection = i.first;
         bInserted = true;
+        if (m_bUseHashIndex && i.second) {
+            IndexSection(iSection);
+        }
     }
     if (!a_pKey || !a_pValue) {
         // section only entries are specified with pItem and pVal as NULL
@@ -1780,7 +4414,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::AddEntry(
 
     // check for existence of the key
     TKeyVal & keyval = iSection->second;
-    typename TKeyVal::iterator iKey = keyval.find(a_pKey);
+    typename TKeyVal::iterator iKey = FindKey(iSection, a_pKey);
 
     // make string copies if necessary
     if (a_bCopyStrings) {
@@ -1804,13 +4438,267 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::AddEntry(
             oKey.pComment = a_pComment;
         }
         typename TKeyVal::value_type oEntry(oKey, NULL);
+        bool bNewKey = (iKey == keyval.end());
         iKey = keyval.insert(oEntry);
         bInserted = true;
+        if (m_bUseHashIndex && bNewKey) {
+            IndexKey(iSection, iKey);
+        }
     }
     iKey->second = a_pValue;
     return bInserted ? SI_INSERTED : SI_UPDATED;
 }
 
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SetHashIndex(
+    bool a_bUseHashIndex
+    )
+{
+    if (a_bUseHashIndex == m_bUseHashIndex) {
+        return;
+    }
+    m_bUseHashIndex = a_bUseHashIndex;
+    if (m_bUseHashIndex) {
+        RebuildIndex();
+    }
+    else {
+        TIndex().swap(m_sectionIndex);
+        TIndex().swap(m_keyIndex);
+        m_uSectionIndexUsed = 0;
+        m_uKeyIndexUsed = 0;
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+typename CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::TSection::iterator
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindSection(
+    const SI_CHAR * a_pSection
+    )
+{
+    if (!m_bUseHashIndex) {
+        return m_data.find(a_pSection);
+    }
+    size_t n = FindSectionSlot(a_pSection);
+    return n == (size_t) -1 ? m_data.end() : m_sectionIndex[n].iSection;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+typename CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::TSection::const_iterator
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindSection(
+    const SI_CHAR * a_pSection
+    ) const
+{
+    if (!m_bUseHashIndex) {
+        return m_data.find(a_pSection);
+    }
+    size_t n = FindSectionSlot(a_pSection);
+    if (n == (size_t) -1) {
+        return m_data.end();
+    }
+    return m_sectionIndex[n].iSection;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+typename CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::TKeyVal::iterator
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindKey(
+    typename TSection::iterator a_iSection,
+    const SI_CHAR *             a_pKey
+    )
+{
+    if (!m_bUseHashIndex) {
+        return a_iSection->second.find(a_pKey);
+    }
+    size_t n = FindKeySlot(a_iSection, a_pKey);
+    return n == (size_t) -1 ? a_iSection->second.end() : m_keyIndex[n].iKey;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+typename CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::TKeyVal::const_iterator
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindKey(
+    typename TSection::const_iterator a_iSection,
+    const SI_CHAR *                   a_pKey
+    ) const
+{
+    if (!m_bUseHashIndex) {
+        return a_iSection->second.find(a_pKey);
+    }
+    size_t n = FindKeySlot(a_iSection, a_pKey);
+    if (n == (size_t) -1) {
+        return a_iSection->second.end();
+    }
+    return m_keyIndex[n].iKey;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+size_t
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindSectionSlot(
+    const SI_CHAR * a_pSection
+    ) const
+{
+    if (m_sectionIndex.empty()) {
+        return (size_t) -1;
+    }
+
+    // the index is never more than half full so there is always an empty
+    // slot to terminate the probe sequence
+    size_t uHash = HashName(a_pSection);
+    size_t uMask = m_sectionIndex.size() - 1;
+    for (size_t n = uHash & uMask; ; n = (n + 1) & uMask) {
+        const IndexSlot & slot = m_sectionIndex[n];
+        if (slot.nState == IndexSlot::EMPTY) {
+            return (size_t) -1;
+        }
+        if (slot.nState == IndexSlot::USED && slot.uHash == uHash
+            && !IsLess(a_pSection, slot.iSection->first.pItem)
+            && !IsLess(slot.iSection->first.pItem, a_pSection))
+        {
+            return n;
+        }
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+size_t
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::FindKeySlot(
+    typename TSection::const_iterator a_iSection,
+    const SI_CHAR *                   a_pKey
+    ) const
+{
+    if (m_keyIndex.empty()) {
+        return (size_t) -1;
+    }
+
+    size_t uHash = HashKey(a_iSection, a_pKey);
+    size_t uMask = m_keyIndex.size() - 1;
+    for (size_t n = uHash & uMask; ; n = (n + 1) & uMask) {
+        const IndexSlot & slot = m_keyIndex[n];
+        if (slot.nState == IndexSlot::EMPTY) {
+            return (size_t) -1;
+        }
+        if (slot.nState == IndexSlot::USED && slot.uHash == uHash
+            && typename TSection::const_iterator(slot.iSection) == a_iSection
+            && !IsLess(a_pKey, slot.iKey->first.pItem)
+            && !IsLess(slot.iKey->first.pItem, a_pKey))
+        {
+            return n;
+        }
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::IndexSection(
+    typename TSection::iterator a_iSection
+    )
+{
+    IndexSlot slot;
+    slot.uHash = HashName(a_iSection->first.pItem);
+    slot.iSection = a_iSection;
+    IndexInsert(m_sectionIndex, m_uSectionIndexUsed, slot);
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::IndexKey(
+    typename TSection::iterator a_iSection,
+    typename TKeyVal::iterator  a_iKey
+    )
+{
+    IndexSlot slot;
+    slot.uHash = HashKey(a_iSection, a_iKey->first.pItem);
+    slot.iSection = a_iSection;
+    slot.iKey = a_iKey;
+    IndexInsert(m_keyIndex, m_uKeyIndexUsed, slot);
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::IndexInsert(
+    TIndex &            a_index,
+    size_t &            a_uUsed,
+    const IndexSlot &   a_slot
+    )
+{
+    // keep the load factor (including deleted slots) at or below 1/2
+    if ((a_uUsed + 1) * 2 > a_index.size()) {
+        IndexRehash(a_index, a_uUsed, a_uUsed + 1);
+    }
+
+    size_t uMask = a_index.size() - 1;
+    size_t n = a_slot.uHash & uMask;
+    while (a_index[n].nState != IndexSlot::EMPTY) {
+        n = (n + 1) & uMask;
+    }
+    a_index[n] = a_slot;
+    a_index[n].nState = IndexSlot::USED;
+    ++a_uUsed;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::IndexRehash(
+    TIndex &    a_index,
+    size_t &    a_uUsed,
+    size_t      a_uCount
+    )
+{
+    // size the table as a power of 2 at no more than 1/4 full so that there
+    // is room to grow before the next rehash. Deleted slots are dropped.
+    size_t uSize = 16;
+    while (uSize < a_uCount * 4) {
+        uSize <<= 1;
+    }
+
+    TIndex oldIndex(uSize);
+    oldIndex.swap(a_index);
+    a_uUsed = 0;
+
+    size_t uMask = uSize - 1;
+    typename TIndex::const_iterator i = oldIndex.begin();
+    for ( ; i != oldIndex.end(); ++i) {
+        if (i->nState != IndexSlot::USED) continue;
+        size_t n = i->uHash & uMask;
+        while (a_index[n].nState != IndexSlot::EMPTY) {
+            n = (n + 1) & uMask;
+        }
+        a_index[n] = *i;
+        ++a_uUsed;
+    }
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::RebuildIndex()
+{
+    TIndex().swap(m_sectionIndex);
+    TIndex().swap(m_keyIndex);
+    m_uSectionIndexUsed = 0;
+    m_uKeyIndexUsed = 0;
+
+    size_t uKeys = 0;
+    typename TSection::iterator iSection = m_data.begin();
+    for ( ; iSection != m_data.end(); ++iSection) {
+        uKeys += iSection->second.size();
+    }
+    IndexRehash(m_sectionIndex, m_uSectionIndexUsed, m_data.size());
+    IndexRehash(m_keyIndex, m_uKeyIndexUsed, uKeys);
+
+    // only the first entry of each key is indexed, the others follow it
+    // in the multimap
+    for (iSection = m_data.begin(); iSection != m_data.end(); ++iSection) {
+        IndexSection(iSection);
+        const SI_CHAR * pLastKey = NULL;
+        typename TKeyVal::iterator iKey = iSection->second.begin();
+        for ( ; iKey != iSection->second.end(); ++iKey) {
+            if (!pLastKey || IsLess(pLastKey, iKey->first.pItem)) {
+                IndexKey(iSection, iKey);
+                pLastKey = iKey->first.pItem;
+            }
+        }
+    }
+}
+
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
 const SI_CHAR *
 CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetValue(
@@ -1826,11 +4714,11 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetValue(
     if (!a_pSection || !a_pKey) {
         return a_pDefault;
     }
-    typename TSection::const_iterator iSection = m_data.find(a_pSection);
+    typename TSection::const_iterator iSection = FindSection(a_pSection);
     if (iSection == m_data.end()) {
         return a_pDefault;
     }
-    typename TKeyVal::const_iterator iKeyVal = iSection->second.find(a_pKey);
+    typename TKeyVal::const_iterator iKeyVal = FindKey(iSection, a_pKey);
     if (iKeyVal == iSection->second.end()) {
         return a_pDefault;
     }
@@ -1848,6 +4736,51 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetValue(
     return iKeyVal->second;
 }
 
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+typename CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::StringRef
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetValueRef(
+    StringRef       a_section,
+    StringRef       a_key,
+    StringRef       a_default,
+    bool *          a_pHasMultiple
+    ) const
+{
+    if (a_pHasMultiple) {
+        *a_pHasMultiple = false;
+    }
+    if (a_section.IsNull() || a_key.IsNull()) {
+        return a_default;
+    }
+
+    // the maps need NULL terminated names. These are copied to the stack
+    // unless they are too long for it.
+    enum { NAME_BUFSIZE = 256 };
+    SI_CHAR szSection[NAME_BUFSIZE];
+    SI_CHAR szKey[NAME_BUFSIZE];
+    SI_CHAR * pSection = szSection;
+    SI_CHAR * pKey = szKey;
+    if (a_section.uLen >= NAME_BUFSIZE) {
+        pSection = new SI_CHAR[a_section.uLen + 1];
+    }
+    if (a_key.uLen >= NAME_BUFSIZE) {
+        pKey = new SI_CHAR[a_key.uLen + 1];
+    }
+    memcpy(pSection, a_section.pData, a_section.uLen * sizeof(SI_CHAR));
+    pSection[a_section.uLen] = 0;
+    memcpy(pKey, a_key.pData, a_key.uLen * sizeof(SI_CHAR));
+    pKey[a_key.uLen] = 0;
+
+    const SI_CHAR * pValue = GetValue(pSection, pKey, NULL, a_pHasMultiple);
+
+    if (pSection != szSection) {
+        delete[] pSection;
+    }
+    if (pKey != szKey) {
+        delete[] pKey;
+    }
+    return pValue ? StringRef(pValue) : a_default;
+}
+
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
 long
 CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetLongValue(
@@ -1949,6 +4882,100 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetBoolValue(
     return a_bDefault;
 }
 
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+long
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetDurationValue(
+    const SI_CHAR * a_pSection,
+    const SI_CHAR * a_pKey,
+    long            a_nDefault,
+    bool *          a_pHasMultiple
+    ) const
+{
+    // return the default if we don't have a value
+    const SI_CHAR * pszValue = GetValue(a_pSection, a_pKey, NULL, a_pHasMultiple);
+    if (!pszValue || !*pszValue) return a_nDefault;
+
+    static const char szUnits[] = "ms\0s\0m\0h\0";
+    static const unsigned long uScales[] = { 1, 1000, 60000, 3600000 };
+    long nValue;
+    if (!ParseScaledValue(pszValue, szUnits, uScales, nValue)) {
+        return a_nDefault;
+    }
+    return nValue;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+long
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetByteSizeValue(
+    const SI_CHAR * a_pSection,
+    const SI_CHAR * a_pKey,
+    long            a_nDefault,
+    bool *          a_pHasMultiple
+    ) const
+{
+    // return the default if we don't have a value
+    const SI_CHAR * pszValue = GetValue(a_pSection, a_pKey, NULL, a_pHasMultiple);
+    if (!pszValue || !*pszValue) return a_nDefault;
+
+    static const char szUnits[] = "b\0k\0kb\0m\0mb\0g\0gb\0";
+    static const unsigned long uScales[] = {
+        1, 1024UL, 1024UL, 1024UL*1024, 1024UL*1024,
+        1024UL*1024*1024, 1024UL*1024*1024
+    };
+    long nValue;
+    if (!ParseScaledValue(pszValue, szUnits, uScales, nValue)) {
+        return a_nDefault;
+    }
+    return nValue;
+}
+
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+bool
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::ParseScaledValue(
+    const SI_CHAR *         a_pszValue,
+    const char *            a_pszUnits,
+    const unsigned long *   a_uScales,
+    long &                  a_nValue
+    ) const
+{
+    // whole number, checking for overflow as we go
+    const SI_CHAR * p = a_pszValue;
+    if (*p < '0' || *p > '9') return false;
+    unsigned long uValue = 0;
+    for ( ; *p >= '0' && *p <= '9'; ++p) {
+        unsigned long uDigit = (unsigned long) (*p - '0');
+        if (uValue > ((unsigned long) LONG_MAX - uDigit) / 10) return false;
+        uValue = uValue * 10 + uDigit;
+    }
+    while (*p == ' ' || *p == '\t') {
+        ++p;
+    }
+    if (!*p) {
+        a_nValue = (long) uValue;
+        return true;
+    }
+
+    // the unit must match the rest of the value exactly
+    for (size_t n = 0; *a_pszUnits; ++n) {
+        const SI_CHAR * q = p;
+        const char * pszUnit = a_pszUnits;
+        for ( ; *pszUnit && *q; ++pszUnit, ++q) {
+            SI_CHAR ch = *q;
+            if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+            if (ch != (SI_CHAR) *pszUnit) break;
+        }
+        if (!*pszUnit && !*q) {
+            if (uValue > (unsigned long) LONG_MAX / a_uScales[n]) return false;
+            a_nValue = (long) (uValue * a_uScales[n]);
+            return true;
+        }
+
+        // next unit, the list ends with an empty string
+        a_pszUnits += strlen(a_pszUnits) + 1;
+    }
+    return false;
+}
+
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
 SI_Error 
 CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SetBoolValue(
@@ -1985,11 +5012,11 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetAllValues(
     if (!a_pSection || !a_pKey) {
         return false;
     }
-    typename TSection::const_iterator iSection = m_data.find(a_pSection);
+    typename TSection::const_iterator iSection = FindSection(a_pSection);
     if (iSection == m_data.end()) {
         return false;
     }
-    typename TKeyVal::const_iterator iKeyVal = iSection->second.find(a_pKey);
+    typename TKeyVal::const_iterator iKeyVal = FindKey(iSection, a_pKey);
     if (iKeyVal == iSection->second.end()) {
         return false;
     }
@@ -2017,7 +5044,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetSectionSize(
         return -1;
     }
 
-    typename TSection::const_iterator iSection = m_data.find(a_pSection);
+    typename TSection::const_iterator iSection = FindSection(a_pSection);
     if (iSection == m_data.end()) {
         return -1;
     }
@@ -2049,7 +5076,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetSection(
     ) const
 {
     if (a_pSection) {
-        typename TSection::const_iterator i = m_data.find(a_pSection);
+        typename TSection::const_iterator i = FindSection(a_pSection);
         if (i != m_data.end()) {
             return &(i->second);
         }
@@ -2080,7 +5107,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetAllKeys(
         return false;
     }
 
-    typename TSection::const_iterator iSection = m_data.find(a_pSection);
+    typename TSection::const_iterator iSection = FindSection(a_pSection);
     if (iSection == m_data.end()) {
         return false;
     }
@@ -2117,6 +5144,22 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SaveFile(
     return rc;
 }
 
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::SaveFileAtomic(
+    const char *    a_pszFile,
+    bool            a_bAddSignature
+    ) const
+{
+    std::string strData;
+    StringWriter writer(strData);
+    SI_Error rc = Save(writer, a_bAddSignature);
+    if (rc < 0) {
+        return rc;
+    }
+    return SI_ReplaceFile(a_pszFile, strData.data(), strData.size());
+}
+
 #ifdef SI_HAS_WIDE_FILE
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
 SI_Error
@@ -2158,115 +5201,117 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Save(
     ) const
 {
     Converter convert(m_bStoreIsUtf8);
+    OutputBuffer output(a_oOutput);
 
     // add the UTF-8 signature if it is desired
     if (m_bStoreIsUtf8 && a_bAddSignature) {
-        a_oOutput.Write(SI_UTF8_SIGNATURE);
+        output.Write(SI_UTF8_SIGNATURE);
     }
 
     // get all of the sections sorted in load order
-    TNamesDepend oSections;
-    GetAllSections(oSections);
-#if defined(_MSC_VER) && _MSC_VER <= 1200
-    oSections.sort();
-#else
-    oSections.sort(typename Entry::LoadOrder());
-#endif
+    TSectionOrder oSections;
+    oSections.reserve(m_data.size());
+    typename TSection::const_iterator iData = m_data.begin();
+    for ( ; iData != m_data.end(); ++iData) {
+        oSections.push_back(iData);
+    }
+    std::sort(oSections.begin(), oSections.end());
 
     // write the file comment if we have one
     bool bNeedNewLine = false;
     if (m_pFileComment) {
-        if (!OutputMultiLineText(a_oOutput, convert, m_pFileComment)) {
+        if (!OutputMultiLineText(output, convert, m_pFileComment)) {
             return SI_FAIL;
         }
         bNeedNewLine = true;
     }
 
+    // get the keys of all sections sorted in load order
+    TKeyOrder oKeys;
+    std::vector<size_t> oKeyStart;
+    GetKeysInLoadOrder(oSections, oKeys, oKeyStart);
+
     // iterate through our sections and output the data
-    typename TNamesDepend::const_iterator iSection = oSections.begin();
-    for ( ; iSection != oSections.end(); ++iSection ) {
+    for (size_t n = 0; n < oSections.size(); ++n) {
+        const Entry & section = oSections[n].iEntry->first;
+        const TKeyVal & keyVal = oSections[n].iEntry->second;
+
         // write out the comment if there is one
-        if (iSection->pComment) {
-            if (!convert.ConvertToStore(iSection->pComment)) {
+        if (section.pComment) {
+            if (!convert.ConvertToStore(section.pComment)) {
                 return SI_FAIL;
             }
             if (bNeedNewLine) {
-                a_oOutput.Write(SI_NEWLINE_A);
-                a_oOutput.Write(SI_NEWLINE_A);
+                output.Write(SI_NEWLINE_A);
+                output.Write(SI_NEWLINE_A);
             }
-            a_oOutput.Write(convert.Data());
-            a_oOutput.Write(SI_NEWLINE_A);
+            output.Write(convert.Data(), convert.Length());
+            output.Write(SI_NEWLINE_A);
             bNeedNewLine = false;
         }
 
         if (bNeedNewLine) {
-            a_oOutput.Write(SI_NEWLINE_A);
-            a_oOutput.Write(SI_NEWLINE_A);
+            output.Write(SI_NEWLINE_A);
+            output.Write(SI_NEWLINE_A);
             bNeedNewLine = false;
         }
 
         // write the section (unless there is no section name)
-        if (*iSection->pItem) {
-            if (!convert.ConvertToStore(iSection->pItem)) {
+        if (*section.pItem) {
+            if (!convert.ConvertToStore(section.pItem)) {
                 return SI_FAIL;
             }
-            a_oOutput.Write("[");
-            a_oOutput.Write(convert.Data());
-            a_oOutput.Write("]");
-            a_oOutput.Write(SI_NEWLINE_A);
+            output.Write("[");
+            output.Write(convert.Data(), convert.Length());
+            output.Write("]");
+            output.Write(SI_NEWLINE_A);
         }
 
-        // get all of the keys sorted in load order
-        TNamesDepend oKeys;
-        GetAllKeys(iSection->pItem, oKeys);
-#if defined(_MSC_VER) && _MSC_VER <= 1200
-        oKeys.sort();
-#else
-        oKeys.sort(typename Entry::LoadOrder());
-#endif
-
         // write all keys and values
-        typename TNamesDepend::const_iterator iKey = oKeys.begin();
-        for ( ; iKey != oKeys.end(); ++iKey) {
-            // get all values for this key
-            TNamesDepend oValues;
-            GetAllValues(iSection->pItem, iKey->pItem, oValues);
+        typename TKeyOrder::const_iterator iKey = oKeys.begin() + oKeyStart[n];
+        typename TKeyOrder::const_iterator iKeyEnd = oKeys.begin() + oKeyStart[n + 1];
+        for ( ; iKey != iKeyEnd; ++iKey) {
+            const Entry & key = iKey->iEntry->first;
 
             // write out the comment if there is one
-            if (iKey->pComment) {
-                a_oOutput.Write(SI_NEWLINE_A);
-                if (!OutputMultiLineText(a_oOutput, convert, iKey->pComment)) {
+            if (key.pComment) {
+                output.Write(SI_NEWLINE_A);
+                if (!OutputMultiLineText(output, convert, key.pComment)) {
                     return SI_FAIL;
                 }
             }
 
-            typename TNamesDepend::const_iterator iValue = oValues.begin();
-            for ( ; iValue != oValues.end(); ++iValue) {
+            // the values for this key follow the first one in the map
+            typename TKeyVal::const_iterator iValue = iKey->iEntry;
+            do {
                 // write the key
-                if (!convert.ConvertToStore(iKey->pItem)) {
+                if (!convert.ConvertToStore(key.pItem)) {
                     return SI_FAIL;
                 }
-                a_oOutput.Write(convert.Data());
+                output.Write(convert.Data(), convert.Length());
 
                 // write the value
-                if (!convert.ConvertToStore(iValue->pItem)) {
+                if (!convert.ConvertToStore(iValue->second)) {
                     return SI_FAIL;
                 }
-                a_oOutput.Write("=");
-                if (m_bAllowMultiLine && IsMultiLineData(iValue->pItem)) {
+                output.Write("=");
+                if (m_bAllowMultiLine && IsMultiLineData(iValue->second)) {
                     // multi-line data needs to be processed specially to ensure
                     // that we use the correct newline format for the current system
-                    a_oOutput.Write("<<<SI-END-OF-MULTILINE-TEXT" SI_NEWLINE_A);
-                    if (!OutputMultiLineText(a_oOutput, convert, iValue->pItem)) {
+                    output.Write("<<<SI-END-OF-MULTILINE-TEXT" SI_NEWLINE_A);
+                    if (!OutputMultiLineText(output, convert, iValue->second)) {
                         return SI_FAIL;
                     }
-                    a_oOutput.Write("SI-END-OF-MULTILINE-TEXT");
+                    output.Write("SI-END-OF-MULTILINE-TEXT");
                 }
                 else {
-                    a_oOutput.Write(convert.Data());
+                    output.Write(convert.Data(), convert.Length());
                 }
-                a_oOutput.Write(SI_NEWLINE_A);
+                output.Write(SI_NEWLINE_A);
+                ++iValue;
             }
+            while (m_bAllowMultiKey && iValue != keyVal.end()
+                && !IsLess(key.pItem, iValue->first.pItem));
         }
 
         bNeedNewLine = true;
@@ -2275,10 +5320,79 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Save(
     return SI_OK;
 }
 
+template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
+void
+CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::GetKeysInLoadOrder(
+    const TSectionOrder &   a_sections,
+    TKeyOrder &             a_keys,
+    std::vector<size_t> &   a_start
+    ) const
+{
+    // get the first entry of all keys grouped by section. Keys are only
+    // repeated in the map with multi-key.
+    a_keys.clear();
+    a_start.resize(a_sections.size() + 1);
+    for (size_t n = 0; n < a_sections.size(); ++n) {
+        a_start[n] = a_keys.size();
+        const TKeyVal & keyVal = a_sections[n].iEntry->second;
+        const SI_CHAR * pLastKey = NULL;
+        typename TKeyVal::const_iterator iKeyVal = keyVal.begin();
+        for ( ; iKeyVal != keyVal.end(); ++iKeyVal) {
+            if (!m_bAllowMultiKey) {
+                a_keys.push_back(iKeyVal);
+            }
+            else if (!pLastKey || IsLess(pLastKey, iKeyVal->first.pItem)) {
+                a_keys.push_back(iKeyVal);
+                pLastKey = iKeyVal->first.pItem;
+            }
+        }
+    }
+    a_start[a_sections.size()] = a_keys.size();
+
+    // AddEntry numbers every new section and key with the next load order,
+    // so the numbers are normally unique and no greater than m_nOrder. Then
+    // all keys are put in order with one counting sort over the numbers
+    // instead of sorting the keys of each section.
+    size_t uOrders = (size_t) m_nOrder + 1;
+    if (m_nOrder >= 0 && uOrders <= 4 * a_keys.size() + 1024) {
+        const size_t uEmpty = (size_t) -1;
+        std::vector<size_t> oSlots(uOrders, uEmpty);
+        std::vector<size_t> oSection(a_keys.size());
+        bool bUnique = true;
+        for (size_t n = 0; n < a_sections.size() && bUnique; ++n) {
+            for (size_t i = a_start[n]; i < a_start[n + 1]; ++i) {
+                size_t uOrder = (size_t) a_keys[i].nOrder;
+                if (uOrder >= uOrders || oSlots[uOrder] != uEmpty) {
+                    bUnique = false;
+                    break;
+                }
+                oSlots[uOrder] = i;
+                oSection[i] = n;
+            }
+        }
+        if (bUnique) {
+            TKeyOrder oSorted(a_keys);
+            std::vector<size_t> oNext(a_start);
+            for (size_t uOrder = 0; uOrder < uOrders; ++uOrder) {
+                size_t i = oSlots[uOrder];
+                if (i != uEmpty) {
+                    oSorted[oNext[oSection[i]]++] = a_keys[i];
+                }
+            }
+            a_keys.swap(oSorted);
+            return;
+        }
+    }
+
+    for (size_t n = 0; n < a_sections.size(); ++n) {
+        std::sort(a_keys.begin() + a_start[n], a_keys.begin() + a_start[n + 1]);
+    }
+}
+
 template<class SI_CHAR, class SI_STRLESS, class SI_CONVERTER>
 bool
 CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::OutputMultiLineText(
-    OutputWriter &  a_oOutput,
+    OutputBuffer &  a_oOutput,
     Converter &     a_oConverter,
     const SI_CHAR * a_pText
     ) const
@@ -2298,7 +5412,7 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::OutputMultiLineText(
         }
         *const_cast<SI_CHAR*>(pEndOfLine) = cEndOfLineChar;
         a_pText += (pEndOfLine - a_pText) + 1;
-        a_oOutput.Write(a_oConverter.Data());
+        a_oOutput.Write(a_oConverter.Data(), a_oConverter.Length());
         a_oOutput.Write(SI_NEWLINE_A);
     }
     return true;
@@ -2316,18 +5430,26 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Delete(
         return false;
     }
 
-    typename TSection::iterator iSection = m_data.find(a_pSection);
+    typename TSection::iterator iSection = FindSection(a_pSection);
     if (iSection == m_data.end()) {
         return false;
     }
 
     // remove a single key if we have a keyname
     if (a_pKey) {
-        typename TKeyVal::iterator iKeyVal = iSection->second.find(a_pKey);
+        typename TKeyVal::iterator iKeyVal = FindKey(iSection, a_pKey);
         if (iKeyVal == iSection->second.end()) {
             return false;
         }
 
+        // remove the key from the index while the key string still exists
+        if (m_bUseHashIndex) {
+            size_t n = FindKeySlot(iSection, a_pKey);
+            if (n != (size_t) -1) {
+                m_keyIndex[n].nState = IndexSlot::DELETED;
+            }
+        }
+
         // remove any copied strings and then the key
         typename TKeyVal::iterator iDelete;
         do {
@@ -2352,12 +5474,24 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::Delete(
         // entries will be removed when the section is removed.
         typename TKeyVal::iterator iKeyVal = iSection->second.begin();
         for ( ; iKeyVal != iSection->second.end(); ++iKeyVal) {
+            if (m_bUseHashIndex) {
+                size_t n = FindKeySlot(iSection, iKeyVal->first.pItem);
+                if (n != (size_t) -1) {
+                    m_keyIndex[n].nState = IndexSlot::DELETED;
+                }
+            }
             DeleteString(iKeyVal->first.pItem);
             DeleteString(iKeyVal->second);
         }
     }
 
     // delete the section itself
+    if (m_bUseHashIndex) {
+        size_t n = FindSectionSlot(iSection->first.pItem);
+        if (n != (size_t) -1) {
+            m_sectionIndex[n].nState = IndexSlot::DELETED;
+        }
+    }
     DeleteString(iSection->first.pItem);
     m_data.erase(iSection);
 
@@ -2370,17 +5504,13 @@ CSimpleIniTempl<SI_CHAR,SI_STRLESS,SI_CONVERTER>::DeleteString(
     const SI_CHAR * a_pString
     )
 {
-    // strings may exist either inside the data block, or they will be
-    // individually allocated and stored in m_strings. We only physically
-    // delete those stored in m_strings.
-    if (a_pString < m_pData || a_pString >= m_pData + m_uDataLen) {
-        typename TNamesDepend::iterator i = m_strings.begin();
-        for (;i != m_strings.end(); ++i) {
-            if (a_pString == i->pItem) {
-                delete[] const_cast<SI_CHAR*>(i->pItem);
-                m_strings.erase(i);
-                break;
-            }
+    // strings may exist inside the data block, be individually allocated
+    // from the arena, or be static / owned by the caller (e.g. the empty
+    // section name). We only physically delete those the arena owns.
+    if (a_pString && (a_pString < m_pData || a_pString >= m_pData + m_uDataLen)) {
+        size_t uSize = sizeof(SI_CHAR) * (StringLength(a_pString) + 1);
+        if (m_arena.Owns(a_pString, uSize)) {
+            m_arena.Deallocate(const_cast<SI_CHAR*>(a_pString), uSize);
         }
     }
 }
@@ -2484,10 +5614,15 @@ public:
         const char *    a_pInputData,
         size_t          a_uInputDataLen)
     {
-        (void)a_pInputData;
         SI_ASSERT(a_uInputDataLen != (size_t) -1);
 
-        // ASCII/MBCS/UTF-8 needs no conversion
+        // ASCII/MBCS/UTF-8 needs no conversion, but UTF-8 is checked so
+        // that corrupt data is rejected before it is parsed
+        if (m_bStoreIsUtf8
+            && SI_Utf8Validate(a_pInputData, a_uInputDataLen) != a_uInputDataLen)
+        {
+            return (size_t) -1;
+        }
         return a_uInputDataLen;
     }
 
@@ -2646,28 +5781,10 @@ public:
         size_t          a_uOutputDataSize)
     {
         if (m_bStoreIsUtf8) {
-            // This uses the Unicode reference implementation to do the
-            // conversion from UTF-8 to wchar_t. The required files are
-            // ConvertUTF.h and ConvertUTF.c which should be included in
-            // the distribution but are publically available from unicode.org
-            // at http://www.unicode.org/Public/PROGRAMS/CVTUTF/
-            ConversionResult retval;
-            const UTF8 * pUtf8 = (const UTF8 *) a_pInputData;
-            if (sizeof(wchar_t) == sizeof(UTF32)) {
-                UTF32 * pUtf32 = (UTF32 *) a_pOutputData;
-                retval = ConvertUTF8toUTF32(
-                    &pUtf8, pUtf8 + a_uInputDataLen,
-                    &pUtf32, pUtf32 + a_uOutputDataSize,
-                    lenientConversion);
-            }
-            else if (sizeof(wchar_t) == sizeof(UTF16)) {
-                UTF16 * pUtf16 = (UTF16 *) a_pOutputData;
-                retval = ConvertUTF8toUTF16(
-                    &pUtf8, pUtf8 + a_uInputDataLen,
-                    &pUtf16, pUtf16 + a_uOutputDataSize,
-                    lenientConversion);
-            }
-            return retval == conversionOK;
+            // UTF-8 to UTF-32 or UTF-16 depending on the size of wchar_t,
+            // invalid UTF-8 fails the conversion
+            return SI_Utf8ToWide(a_pInputData, a_uInputDataLen,
+                a_pOutputData, a_uOutputDataSize) != (size_t) -1;
         }
         else {
             size_t retval = mbstowcs(a_pOutputData,
@@ -3044,6 +6161,15 @@ public:
     {
         SI_ASSERT(a_uInputDataLen != (size_t) -1);
 
+        // MultiByteToWideChar() replaces invalid UTF-8 rather than failing,
+        // so it is checked here. The worst case is 1 char -> 1 wchar_t.
+        if (m_uCodePage == CP_UTF8) {
+            if (SI_Utf8Validate(a_pInputData, a_uInputDataLen) != a_uInputDataLen) {
+                return (size_t) -1;
+            }
+            return a_uInputDataLen;
+        }
+
         int retval = MultiByteToWideChar(
             m_uCodePage, 0,
             a_pInputData, (int) a_uInputDataLen,
@@ -3070,6 +6196,11 @@ public:
         SI_CHAR *       a_pOutputData,
         size_t          a_uOutputDataSize)
     {
+        if (m_uCodePage == CP_UTF8) {
+            return SI_Utf8ToWide(a_pInputData, a_uInputDataLen,
+                a_pOutputData, a_uOutputDataSize) != (size_t) -1;
+        }
+
         int nSize = MultiByteToWideChar(
             m_uCodePage, 0,
             a_pInputData, (int) a_uInputDataLen,
@@ -0,0 +1,1074 @@
+/** @file SimpleIniSnapshot.h
+
+    Compiled binary snapshots of CSimpleIni data. A snapshot holds the
+    sections, keys and values of a char based CSimpleIniTempl object in a
+    single block of memory which is used directly from a mapping of the file,
+    so there is no parsing and no allocation when it is loaded. The block is:
+
+    - SI_SnapshotHeader. This has the format version, a checksum of the
+      whole block, and the identity (modification time, size and hash)
+      of the INI file that the snapshot was compiled from.
+    - the sections and their entries in load order
+    - a hash index of the section and key names
+    - a sorted table of every distinct string
+
+    The integers are stored in the native byte order, so a snapshot is only
+    a cache for the machine that wrote it. IsCurrent() tells if the INI file
+    has changed since the snapshot was compiled.
+
+    @code
+        SI_SnapshotSource source;
+        CSimpleIniSnapshot::GetSource("config.ini", source);
+
+        CSimpleIniSnapshot snapshot;
+        if (snapshot.LoadFile("config.ini.snap") < 0
+            || !snapshot.IsCurrent(source))
+        {
+            CSimpleIniA ini;
+            ini.LoadFile("config.ini");
+            std::string data;
+            CSimpleIniSnapshot::Compile(ini, source, data);
+            snapshot.Load(data.data(), data.size());
+            snapshot.SaveFile("config.ini.snap");
+        }
+        const char * pVal = snapshot.GetValue("section", "key", "default");
+    @endcode
+*/
+
+#ifndef INCLUDED_SimpleIniSnapshot
+#define INCLUDED_SimpleIniSnapshot
+
+#include "SimpleIni.h"
+
+#ifndef _WIN32
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sched.h>
+# include <pthread.h>
+#endif
+
+#ifdef _MSC_VER
+typedef unsigned __int32    SI_UINT32;
+typedef unsigned __int64    SI_UINT64;
+#else
+# include <stdint.h>
+typedef uint32_t            SI_UINT32;
+typedef uint64_t            SI_UINT64;
+#endif
+
+/** Current version of the snapshot format */
+#define SI_SNAPSHOT_VERSION     1
+
+/** Section and key names are compared without case (ASCII only) */
+#define SI_SNAPSHOT_NOCASE      0x0001
+
+/** Identity of the INI file that a snapshot was compiled from */
+struct SI_SnapshotSource {
+    SI_UINT64   uTime;      //!< last write time in the native file system units
+    SI_UINT64   uSize;      //!< size of the file in bytes
+    SI_UINT64   uHash;      //!< hash of the file contents
+};
+
+/** Header at the start of every snapshot */
+struct SI_SnapshotHeader {
+    char                szMagic[8];     //!< SI_SNAPSHOT_MAGIC
+    SI_UINT32           uVersion;       //!< SI_SNAPSHOT_VERSION
+    SI_UINT32           uHeaderSize;    //!< sizeof(SI_SnapshotHeader)
+    SI_UINT32           uFlags;         //!< SI_SNAPSHOT_NOCASE
+    SI_UINT32           uDataSize;      //!< bytes following the header
+    SI_UINT64           uChecksum;      //!< hash of the header and data
+    SI_SnapshotSource   source;         //!< the INI file compiled
+    SI_UINT32           uSectionCount;
+    SI_UINT32           uEntryCount;
+    SI_UINT32           uIndexSize;     //!< number of slots, a power of 2
+    SI_UINT32           uStringsSize;   //!< bytes in the string table
+};
+
+#define SI_SNAPSHOT_MAGIC       "SISNAP\r\n"
+
+/** Reader and compiler of snapshots. All strings are char, in the same
+    encoding as the CSimpleIniTempl data that was compiled.
+ */
+class CSimpleIniSnapshot
+{
+    /** A section and the range of its entries */
+    struct Section {
+        SI_UINT32   uName;      // offset in the string table
+        SI_UINT32   uFirst;     // index of the first entry
+        SI_UINT32   uCount;     // number of entries
+    };
+
+    /** A single value. Multiple values for a key follow each other. */
+    struct Entry {
+        SI_UINT32   uSection;   // index of the section
+        SI_UINT32   uKey;       // offset in the string table
+        SI_UINT32   uValue;     // offset in the string table
+        SI_UINT32   uValueLen;  // length of the value
+    };
+
+    /** Hash index slot, uEntry is the index of the entry + 1 or 0 if the
+        slot is empty. Only the first value of a key is indexed.
+     */
+    struct Slot {
+        SI_UINT32   uHash;
+        SI_UINT32   uEntry;
+    };
+
+public:
+    CSimpleIniSnapshot() { Clear(); }
+    ~CSimpleIniSnapshot() { Reset(); }
+
+    /** Release the snapshot data */
+    void Reset();
+
+    /** Has no snapshot been loaded? */
+    bool IsEmpty() const { return m_pHeader == NULL; }
+
+    /** Read the identity of an INI file.
+
+        @param a_pszFile    Path of the INI file
+        @param a_source     Receives the identity of the file
+
+        @return SI_Error    See error definitions
+     */
+    static SI_Error GetSource(
+        const char *        a_pszFile,
+        SI_SnapshotSource & a_source
+        );
+
+    /** Compile the data of an INI object into a snapshot.
+
+        @param a_ini        Data to be compiled
+        @param a_source     Identity of the INI file the data was loaded
+                            from. This should be read by GetSource() before
+                            the file was loaded, so that a change while it
+                            is being loaded causes the snapshot to be stale.
+        @param a_strData    Receives the snapshot
+
+        @return SI_Error    See error definitions
+     */
+    template<class SI_STRLESS, class SI_CONVERTER>
+    static SI_Error Compile(
+        const CSimpleIniTempl<char,SI_STRLESS,SI_CONVERTER> & a_ini,
+        const SI_SnapshotSource &   a_source,
+        std::string &               a_strData
+        );
+
+    /** Map a snapshot file into memory and check that it is valid. Any
+        previous snapshot is released.
+
+        @param a_pszFile    Path of the snapshot file
+        @param a_bMapFile   Map the file if possible. Set to false to read
+                            the file into memory instead, for a snapshot
+                            that is kept while the file may be replaced.
+                            Windows doesn't allow a mapped file to be
+                            replaced.
+
+        @return SI_Error    See error definitions. SI_FAIL if the file isn't
+                            a valid snapshot of the current version.
+     */
+    SI_Error LoadFile(
+        const char *    a_pszFile,
+        bool            a_bMapFile = true
+        );
+
+    /** Load a snapshot from memory, the data is copied.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error Load(
+        const char *    a_pData,
+        size_t          a_uDataLen
+        );
+
+    /** Load a snapshot of the current data of an INI object. Unlike the
+        INI object the snapshot can't be changed and has no scratch buffers,
+        so any number of threads can read it at the same time. See
+        CSimpleIniSharedSnapshot for replacing it while it is being read.
+
+        @return SI_Error    See error definitions
+     */
+    template<class SI_STRLESS, class SI_CONVERTER>
+    SI_Error Load(
+        const CSimpleIniTempl<char,SI_STRLESS,SI_CONVERTER> & a_ini
+        );
+
+    /** Save the current snapshot to a file. The file is replaced with
+        SI_ReplaceFile(), so other processes loading it never see a partly
+        written snapshot.
+
+        @return SI_Error    See error definitions
+     */
+    SI_Error SaveFile(
+        const char * a_pszFile
+        ) const;
+
+    /** Was the snapshot compiled from this version of the INI file? */
+    bool IsCurrent(
+        const SI_SnapshotSource & a_source
+        ) const;
+
+    /** Retrieve the value for a specific key. If multiple keys are
+        enabled the first value is returned.
+
+        @param a_pSection   Section to search
+        @param a_pKey       Key to search for
+        @param a_pDefault   Value returned if the key is not found
+        @param a_pValueLen  If not NULL, receives the length of the string
+                            returned, or 0 for NULL.
+
+        @return a_pDefault  Key was not found in the section
+        @return other       Value of the key, valid for the lifetime of the
+                            snapshot
+     */
+    const char * GetValue(
+        const char *    a_pSection,
+        const char *    a_pKey,
+        const char *    a_pDefault = NULL,
+        size_t *        a_pValueLen = NULL
+        ) const;
+
+    /** Number of sections in the snapshot */
+    size_t GetSectionCount() const {
+        return m_pHeader ? m_pHeader->uSectionCount : 0;
+    }
+
+private:
+    void Clear();
+
+    /** Check that the data is a valid snapshot and use it */
+    SI_Error Attach(
+        const char *    a_pData,
+        size_t          a_uDataLen
+        );
+
+    /** Hash of a section and key name, folding the case if required */
+    static SI_UINT32 HashName(
+        const char *    a_pSection,
+        const char *    a_pKey,
+        bool            a_bNoCase
+        );
+
+    static bool IsEqual(
+        const char *    a_pLeft,
+        const char *    a_pRight,
+        bool            a_bNoCase
+        );
+
+    /** Hash of a block of data used for the checksum and the source hash */
+    static SI_UINT64 HashData(
+        const char *    a_pData,
+        size_t          a_uDataLen,
+        SI_UINT64       a_uHash = 14695981039346656037ULL
+        );
+
+    /** Checksum of the header, as if uChecksum was 0, and the data */
+    static SI_UINT64 Checksum(
+        const SI_SnapshotHeader &   a_header,
+        const char *                a_pData
+        );
+
+    /** Sort order of the string table */
+    struct StringLess {
+        bool operator()(const char * a_pLeft, const char * a_pRight) const {
+            return strcmp(a_pLeft, a_pRight) < 0;
+        }
+    };
+
+    /** Offset of a string in the string table built by Compile() */
+    static SI_UINT32 StringOffset(
+        const std::vector<const char *> &   a_strings,
+        const std::vector<SI_UINT32> &      a_offsets,
+        const char *                        a_pString
+        );
+
+    CSimpleIniSnapshot(const CSimpleIniSnapshot &);             // disable
+    CSimpleIniSnapshot & operator=(const CSimpleIniSnapshot &); // disable
+
+private:
+#ifdef SI_HAS_MMAP
+    /** Mapping of the snapshot file */
+    SI_FileMap m_oMap;
+#endif
+
+    /** Snapshot data when it isn't mapped */
+    std::string m_strData;
+
+    const SI_SnapshotHeader *   m_pHeader;
+    const Section *             m_pSections;
+    const Entry *               m_pEntries;
+    const Slot *                m_pIndex;
+    const char *                m_pStrings;
+};
+
+// ---------------------------------------------------------------------------
+//                              SHARED SNAPSHOTS
+// ---------------------------------------------------------------------------
+
+// Atomic operations used by CSimpleIniSharedSnapshot. All of them are
+// sequentially consistent.
+#ifdef _WIN32
+inline long SI_AtomicIncrement(volatile long * a_pValue) {
+    return InterlockedIncrement(a_pValue);
+}
+inline long SI_AtomicDecrement(volatile long * a_pValue) {
+    return InterlockedDecrement(a_pValue);
+}
+inline bool SI_AtomicSwap(volatile long * a_pValue, long a_nOld, long a_nNew) {
+    return InterlockedCompareExchange(a_pValue, a_nNew, a_nOld) == a_nOld;
+}
+inline void SI_AtomicFence() { MemoryBarrier(); }
+inline void SI_Yield() { SwitchToThread(); }
+inline size_t SI_ThreadId() { return (size_t) GetCurrentThreadId(); }
+#else // !_WIN32
+inline long SI_AtomicIncrement(volatile long * a_pValue) {
+    return __atomic_add_fetch(a_pValue, 1, __ATOMIC_SEQ_CST);
+}
+inline long SI_AtomicDecrement(volatile long * a_pValue) {
+    return __atomic_sub_fetch(a_pValue, 1, __ATOMIC_SEQ_CST);
+}
+inline bool SI_AtomicSwap(volatile long * a_pValue, long a_nOld, long a_nNew) {
+    return __atomic_compare_exchange_n(a_pValue, &a_nOld, a_nNew, false,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+inline void SI_AtomicFence() { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+inline void SI_Yield() { sched_yield(); }
+inline size_t SI_ThreadId() { return (size_t) pthread_self(); }
+#endif // _WIN32
+
+/** Holder of the current snapshot of a configuration which any number of
+    threads can read without locks while another thread replaces it.
+
+    A Reader pins the snapshot that was current when it was created.
+    Replace() publishes a new snapshot and then waits until no Reader pins
+    the previous one before deleting it, in the manner of RCU. Readers
+    announce themselves in one of two epochs, which the writer flips, so it
+    only waits for the readers that may have seen the previous snapshot.
+    The reader counts are spread over cache lines by thread so that readers
+    don't contend with each other.
+
+    @code
+        CSimpleIniSharedSnapshot config;
+
+        // writer
+        CSimpleIniSnapshot * pSnapshot = new CSimpleIniSnapshot;
+        if (pSnapshot->Load(ini) >= 0) {
+            config.Replace(pSnapshot);
+        }
+        else {
+            delete pSnapshot;
+        }
+
+        // any thread
+        CSimpleIniSharedSnapshot::Reader reader(config);
+        if (reader.Get()) {
+            const char * pVal = reader->GetValue("section", "key", "default");
+        }
+    @endcode
+ */
+class CSimpleIniSharedSnapshot
+{
+public:
+    CSimpleIniSharedSnapshot();
+
+    /** Deletes the current snapshot. There must be no Reader left. */
+    ~CSimpleIniSharedSnapshot();
+
+    /** Make a snapshot the current one. Only one thread replaces the
+        snapshot at a time, other callers wait.
+
+        @param a_pSnapshot  Snapshot allocated with new, which is owned and
+                            deleted by this object. NULL removes the current
+                            snapshot.
+
+        Returns once the previous snapshot has been deleted, so it must not
+        be called by a thread which holds a Reader.
+     */
+    void Replace(
+        CSimpleIniSnapshot * a_pSnapshot
+        );
+
+    /** Pins the snapshot that is current when it is created for the life of
+        the Reader. Readers should be short lived as Replace() waits for
+        them. Values returned by the snapshot are only valid while the
+        Reader exists.
+     */
+    class Reader {
+    public:
+        Reader(const CSimpleIniSharedSnapshot & a_shared);
+        ~Reader();
+
+        /** The pinned snapshot, or NULL if there is none */
+        const CSimpleIniSnapshot * Get() const { return m_pSnapshot; }
+        const CSimpleIniSnapshot * operator->() const { return m_pSnapshot; }
+    private:
+        Reader(const Reader &);             // disable
+        Reader & operator=(const Reader &); // disable
+
+        volatile long *             m_pCount;
+        const CSimpleIniSnapshot *  m_pSnapshot;
+    };
+
+private:
+    CSimpleIniSharedSnapshot(const CSimpleIniSharedSnapshot &);             // disable
+    CSimpleIniSharedSnapshot & operator=(const CSimpleIniSharedSnapshot &); // disable
+
+    /** Number of reader counts in each epoch, a power of 2 */
+    enum { STRIPES = 16 };
+
+    /** Count of active readers, alone in its cache line */
+    struct Counter {
+        volatile long   nCount;
+        char            szPad[64 - sizeof(long)];
+    };
+
+    mutable Counter             m_readers[2][STRIPES];
+    volatile long               m_nEpoch;
+    volatile long               m_nWriting;
+    CSimpleIniSnapshot * volatile m_pCurrent;
+};
+
+// ---------------------------------------------------------------------------
+//                              IMPLEMENTATION
+// ---------------------------------------------------------------------------
+
+inline void
+CSimpleIniSnapshot::Clear()
+{
+    m_pHeader   = NULL;
+    m_pSections = NULL;
+    m_pEntries  = NULL;
+    m_pIndex    = NULL;
+    m_pStrings  = NULL;
+}
+
+inline void
+CSimpleIniSnapshot::Reset()
+{
+    Clear();
+#ifdef SI_HAS_MMAP
+    m_oMap.Close();
+#endif
+    std::string().swap(m_strData);
+}
+
+inline SI_Error
+CSimpleIniSnapshot::GetSource(
+    const char *        a_pszFile,
+    SI_SnapshotSource & a_source
+    )
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExA(a_pszFile, GetFileExInfoStandard, &attr)) {
+        return SI_FILE;
+    }
+    a_source.uTime = ((SI_UINT64) attr.ftLastWriteTime.dwHighDateTime << 32)
+        | attr.ftLastWriteTime.dwLowDateTime;
+#else // !_WIN32
+    struct stat st;
+    if (stat(a_pszFile, &st) != 0) {
+        return SI_FILE;
+    }
+    a_source.uTime = (SI_UINT64) st.st_mtime;
+#endif // _WIN32
+
+    // the file is hashed in fixed size blocks, which are a multiple of
+    // the word size of HashData()
+    FILE * fp = NULL;
+#if __STDC_WANT_SECURE_LIB__ && !_WIN32_WCE
+    fopen_s(&fp, a_pszFile, "rb");
+#else // !__STDC_WANT_SECURE_LIB__
+    fp = fopen(a_pszFile, "rb");
+#endif // __STDC_WANT_SECURE_LIB__
+    if (!fp) {
+        return SI_FILE;
+    }
+    a_source.uSize = 0;
+    a_source.uHash = 14695981039346656037ULL;
+    char szBuf[16384];
+    size_t uRead;
+    while ((uRead = fread(szBuf, 1, sizeof(szBuf), fp)) > 0) {
+        a_source.uSize += uRead;
+        a_source.uHash = HashData(szBuf, uRead, a_source.uHash);
+    }
+    bool bError = ferror(fp) != 0;
+    fclose(fp);
+    if (bError) {
+        return SI_FILE;
+    }
+    return SI_OK;
+}
+
+template<class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniSnapshot::Compile(
+    const CSimpleIniTempl<char,SI_STRLESS,SI_CONVERTER> & a_ini,
+    const SI_SnapshotSource &   a_source,
+    std::string &               a_strData
+    )
+{
+    typedef CSimpleIniTempl<char,SI_STRLESS,SI_CONVERTER> TIni;
+    typedef typename TIni::TNamesDepend TNames;
+
+    // names are looked up without case if the INI object does so
+    SI_STRLESS isLess;
+    bool bNoCase = !isLess("A", "a") && !isLess("a", "A");
+
+    // collect the sections and values in load order
+    TNames sections;
+    a_ini.GetAllSections(sections);
+#if defined(_MSC_VER) && _MSC_VER <= 1200
+    sections.sort();
+#else
+    sections.sort(typename TIni::Entry::LoadOrder());
+#endif
+
+    std::vector<Section> vSections;
+    std::vector<Entry> vEntries;
+    std::vector<const char *> vNames;       // section, key of each entry
+    std::vector<const char *> vValues;      // value of each entry
+    std::vector<const char *> vStrings;     // all strings
+    vStrings.push_back("");
+
+    typename TNames::const_iterator iSection = sections.begin();
+    for ( ; iSection != sections.end(); ++iSection) {
+        Section section;
+        section.uFirst = (SI_UINT32) vEntries.size();
+        vStrings.push_back(iSection->pItem);
+
+        TNames keys;
+        a_ini.GetAllKeys(iSection->pItem, keys);
+#if defined(_MSC_VER) && _MSC_VER <= 1200
+        keys.sort();
+#else
+        keys.sort(typename TIni::Entry::LoadOrder());
+#endif
+        typename TNames::const_iterator iKey = keys.begin();
+        for ( ; iKey != keys.end(); ++iKey) {
+            vStrings.push_back(iKey->pItem);
+
+            TNames values;
+            a_ini.GetAllValues(iSection->pItem, iKey->pItem, values);
+            typename TNames::const_iterator iValue = values.begin();
+            for ( ; iValue != values.end(); ++iValue) {
+                Entry entry;
+                entry.uSection = (SI_UINT32) vSections.size();
+                entry.uValueLen = (SI_UINT32) strlen(iValue->pItem);
+                vEntries.push_back(entry);
+                vNames.push_back(iSection->pItem);
+                vNames.push_back(iKey->pItem);
+                vValues.push_back(iValue->pItem);
+                vStrings.push_back(iValue->pItem);
+            }
+        }
+
+        section.uCount = (SI_UINT32) vEntries.size() - section.uFirst;
+        vSections.push_back(section);
+    }
+
+    // the string table holds each distinct string once, in sorted order
+    std::sort(vStrings.begin(), vStrings.end(), StringLess());
+    std::vector<const char *> vUnique;
+    std::vector<SI_UINT32> vOffsets;
+    size_t uStringsSize = 0;
+    for (size_t n = 0; n < vStrings.size(); ++n) {
+        if (!vUnique.empty() && strcmp(vUnique.back(), vStrings[n]) == 0) {
+            continue;
+        }
+        size_t uLen = strlen(vStrings[n]) + 1;
+        if (uStringsSize + uLen > 0x7FFFFFFF) {
+            return SI_FAIL;
+        }
+        vUnique.push_back(vStrings[n]);
+        vOffsets.push_back((SI_UINT32) uStringsSize);
+        uStringsSize += uLen;
+    }
+
+    size_t uSection = 0;
+    for (iSection = sections.begin(); iSection != sections.end(); ++iSection) {
+        vSections[uSection++].uName =
+            StringOffset(vUnique, vOffsets, iSection->pItem);
+    }
+    for (size_t n = 0; n < vEntries.size(); ++n) {
+        vEntries[n].uKey = StringOffset(vUnique, vOffsets, vNames[n*2+1]);
+        vEntries[n].uValue = StringOffset(vUnique, vOffsets, vValues[n]);
+    }
+
+    // the index is kept at most half full so that probes are short and
+    // always reach an empty slot
+    size_t uIndexSize = 8;
+    while (uIndexSize < vEntries.size() * 2) {
+        uIndexSize *= 2;
+    }
+    Slot empty = { 0, 0 };
+    std::vector<Slot> vIndex(uIndexSize, empty);
+    for (size_t n = 0; n < vEntries.size(); ++n) {
+        const char * pSection = vNames[n*2];
+        const char * pKey = vNames[n*2+1];
+        SI_UINT32 uHash = HashName(pSection, pKey, bNoCase);
+        size_t uSlot = uHash & (uIndexSize - 1);
+        for (;;) {
+            Slot & slot = vIndex[uSlot];
+            if (!slot.uEntry) {
+                slot.uHash = uHash;
+                slot.uEntry = (SI_UINT32) n + 1;
+                break;
+            }
+            size_t uOther = slot.uEntry - 1;
+            if (slot.uHash == uHash
+                && IsEqual(vNames[uOther*2], pSection, bNoCase)
+                && IsEqual(vNames[uOther*2+1], pKey, bNoCase))
+            {
+                break; // later value of a multi-key
+            }
+            uSlot = (uSlot + 1) & (uIndexSize - 1);
+        }
+    }
+
+    // write it all out
+    size_t uDataSize = vSections.size() * sizeof(Section)
+        + vEntries.size() * sizeof(Entry)
+        + vIndex.size() * sizeof(Slot)
+        + uStringsSize;
+    if (uDataSize > 0x7FFFFFFF) {
+        return SI_FAIL;
+    }
+
+    SI_SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.szMagic, SI_SNAPSHOT_MAGIC, sizeof(header.szMagic));
+    header.uVersion         = SI_SNAPSHOT_VERSION;
+    header.uHeaderSize      = sizeof(SI_SnapshotHeader);
+    header.uFlags           = bNoCase ? SI_SNAPSHOT_NOCASE : 0;
+    header.uDataSize        = (SI_UINT32) uDataSize;
+    header.source           = a_source;
+    header.uSectionCount    = (SI_UINT32) vSections.size();
+    header.uEntryCount      = (SI_UINT32) vEntries.size();
+    header.uIndexSize       = (SI_UINT32) vIndex.size();
+    header.uStringsSize     = (SI_UINT32) uStringsSize;
+
+    a_strData.erase();
+    a_strData.reserve(sizeof(header) + uDataSize);
+    a_strData.append((const char *) &header, sizeof(header));
+    if (!vSections.empty()) {
+        a_strData.append((const char *) &vSections[0],
+            vSections.size() * sizeof(Section));
+    }
+    if (!vEntries.empty()) {
+        a_strData.append((const char *) &vEntries[0],
+            vEntries.size() * sizeof(Entry));
+    }
+    a_strData.append((const char *) &vIndex[0], vIndex.size() * sizeof(Slot));
+    for (size_t n = 0; n < vUnique.size(); ++n) {
+        a_strData.append(vUnique[n], strlen(vUnique[n]) + 1);
+    }
+
+    // the checksum is filled in last
+    SI_UINT64 uChecksum = Checksum(header, a_strData.data() + sizeof(header));
+    a_strData.replace(offsetof(SI_SnapshotHeader, uChecksum),
+        sizeof(uChecksum), (const char *) &uChecksum, sizeof(uChecksum));
+    return SI_OK;
+}
+
+inline SI_Error
+CSimpleIniSnapshot::LoadFile(
+    const char *    a_pszFile,
+    bool            a_bMapFile
+    )
+{
+    Reset();
+
+#ifdef SI_HAS_MMAP
+    if (a_bMapFile) {
+        if (!m_oMap.Open(a_pszFile)) {
+            return SI_FILE;
+        }
+        SI_Error rc = Attach(m_oMap.Data(), m_oMap.Size());
+        if (rc < 0) {
+            Reset();
+        }
+        return rc;
+    }
+#else // !SI_HAS_MMAP
+    (void) a_bMapFile;
+#endif // SI_HAS_MMAP
+
+    FILE * fp = NULL;
+#if __STDC_WANT_SECURE_LIB__ && !_WIN32_WCE
+    fopen_s(&fp, a_pszFile, "rb");
+#else // !__STDC_WANT_SECURE_LIB__
+    fp = fopen(a_pszFile, "rb");
+#endif // __STDC_WANT_SECURE_LIB__
+    if (!fp) {
+        return SI_FILE;
+    }
+    char szBuf[4096];
+    size_t uRead;
+    while ((uRead = fread(szBuf, 1, sizeof(szBuf), fp)) > 0) {
+        m_strData.append(szBuf, uRead);
+    }
+    bool bError = ferror(fp) != 0;
+    fclose(fp);
+    if (bError) {
+        Reset();
+        return SI_FILE;
+    }
+    SI_Error rc = Attach(m_strData.data(), m_strData.size());
+    if (rc < 0) {
+        Reset();
+    }
+    return rc;
+}
+
+inline SI_Error
+CSimpleIniSnapshot::Load(
+    const char *    a_pData,
+    size_t          a_uDataLen
+    )
+{
+    Reset();
+    m_strData.assign(a_pData, a_uDataLen);
+    SI_Error rc = Attach(m_strData.data(), m_strData.size());
+    if (rc < 0) {
+        Reset();
+    }
+    return rc;
+}
+
+inline SI_Error
+CSimpleIniSnapshot::SaveFile(
+    const char * a_pszFile
+    ) const
+{
+    if (!m_pHeader) {
+        return SI_FAIL;
+    }
+
+    size_t uSize = m_pHeader->uHeaderSize + m_pHeader->uDataSize;
+    return SI_ReplaceFile(a_pszFile, (const char *) m_pHeader, uSize);
+}
+
+inline bool
+CSimpleIniSnapshot::IsCurrent(
+    const SI_SnapshotSource & a_source
+    ) const
+{
+    return m_pHeader
+        && m_pHeader->source.uTime == a_source.uTime
+        && m_pHeader->source.uSize == a_source.uSize
+        && m_pHeader->source.uHash == a_source.uHash;
+}
+
+inline const char *
+CSimpleIniSnapshot::GetValue(
+    const char *    a_pSection,
+    const char *    a_pKey,
+    const char *    a_pDefault,
+    size_t *        a_pValueLen
+    ) const
+{
+    if (a_pValueLen) {
+        *a_pValueLen = a_pDefault ? strlen(a_pDefault) : 0;
+    }
+    if (!m_pHeader || !a_pSection || !a_pKey) {
+        return a_pDefault;
+    }
+
+    bool bNoCase = (m_pHeader->uFlags & SI_SNAPSHOT_NOCASE) != 0;
+    SI_UINT32 uHash = HashName(a_pSection, a_pKey, bNoCase);
+    SI_UINT32 uMask = m_pHeader->uIndexSize - 1;
+    for (SI_UINT32 uSlot = uHash & uMask; ; uSlot = (uSlot + 1) & uMask) {
+        const Slot & slot = m_pIndex[uSlot];
+        if (!slot.uEntry) {
+            return a_pDefault;
+        }
+        if (slot.uHash != uHash) {
+            continue;
+        }
+        const Entry & entry = m_pEntries[slot.uEntry - 1];
+        const Section & section = m_pSections[entry.uSection];
+        if (IsEqual(m_pStrings + entry.uKey, a_pKey, bNoCase)
+            && IsEqual(m_pStrings + section.uName, a_pSection, bNoCase))
+        {
+            if (a_pValueLen) *a_pValueLen = entry.uValueLen;
+            return m_pStrings + entry.uValue;
+        }
+    }
+}
+
+inline SI_Error
+CSimpleIniSnapshot::Attach(
+    const char *    a_pData,
+    size_t          a_uDataLen
+    )
+{
+    // the header must be for this version and cover all of the data
+    const SI_SnapshotHeader * pHeader = (const SI_SnapshotHeader *) a_pData;
+    if (a_uDataLen < sizeof(SI_SnapshotHeader)
+        || memcmp(pHeader->szMagic, SI_SNAPSHOT_MAGIC, sizeof(pHeader->szMagic)) != 0
+        || pHeader->uVersion != SI_SNAPSHOT_VERSION
+        || pHeader->uHeaderSize != sizeof(SI_SnapshotHeader)
+        || (pHeader->uFlags & ~SI_SNAPSHOT_NOCASE) != 0
+        || pHeader->uDataSize != a_uDataLen - sizeof(SI_SnapshotHeader))
+    {
+        return SI_FAIL;
+    }
+    SI_UINT64 uSize = (SI_UINT64) pHeader->uSectionCount * sizeof(Section)
+        + (SI_UINT64) pHeader->uEntryCount * sizeof(Entry)
+        + (SI_UINT64) pHeader->uIndexSize * sizeof(Slot)
+        + pHeader->uStringsSize;
+    if (uSize != pHeader->uDataSize
+        || pHeader->uIndexSize == 0
+        || (pHeader->uIndexSize & (pHeader->uIndexSize - 1)) != 0
+        || pHeader->uStringsSize == 0)
+    {
+        return SI_FAIL;
+    }
+    const char * pData = a_pData + sizeof(SI_SnapshotHeader);
+    if (Checksum(*pHeader, pData) != pHeader->uChecksum) {
+        return SI_FAIL;
+    }
+
+    const Section * pSections = (const Section *) pData;
+    const Entry * pEntries = (const Entry *) (pSections + pHeader->uSectionCount);
+    const Slot * pIndex = (const Slot *) (pEntries + pHeader->uEntryCount);
+    const char * pStrings = (const char *) (pIndex + pHeader->uIndexSize);
+
+    // every offset and index must be in range so that lookups can trust
+    // them. As the string table ends with a NULL every string is terminated.
+    SI_UINT32 uStringsSize = pHeader->uStringsSize;
+    if (pStrings[uStringsSize - 1] != 0) {
+        return SI_FAIL;
+    }
+    for (SI_UINT32 n = 0; n < pHeader->uSectionCount; ++n) {
+        if (pSections[n].uName >= uStringsSize
+            || pSections[n].uFirst > pHeader->uEntryCount
+            || pSections[n].uCount > pHeader->uEntryCount - pSections[n].uFirst)
+        {
+            return SI_FAIL;
+        }
+    }
+    for (SI_UINT32 n = 0; n < pHeader->uEntryCount; ++n) {
+        const Entry & entry = pEntries[n];
+        if (entry.uSection >= pHeader->uSectionCount
+            || entry.uKey >= uStringsSize
+            || entry.uValue >= uStringsSize
+            || entry.uValueLen >= uStringsSize - entry.uValue
+            || pStrings[entry.uValue + entry.uValueLen] != 0)
+        {
+            return SI_FAIL;
+        }
+    }
+    bool bHasEmpty = false;
+    for (SI_UINT32 n = 0; n < pHeader->uIndexSize; ++n) {
+        if (!pIndex[n].uEntry) {
+            bHasEmpty = true;
+        }
+        else if (pIndex[n].uEntry > pHeader->uEntryCount) {
+            return SI_FAIL;
+        }
+    }
+    if (!bHasEmpty) {
+        return SI_FAIL;
+    }
+
+    m_pHeader   = pHeader;
+    m_pSections = pSections;
+    m_pEntries  = pEntries;
+    m_pIndex    = pIndex;
+    m_pStrings  = pStrings;
+    return SI_OK;
+}
+
+inline SI_UINT32
+CSimpleIniSnapshot::HashName(
+    const char *    a_pSection,
+    const char *    a_pKey,
+    bool            a_bNoCase
+    )
+{
+    // FNV-1a of both names with a separator that can't be in either
+    SI_UINT32 uHash = 2166136261u;
+    const char * pName = a_pSection;
+    for (int n = 0; n < 2; ++n, pName = a_pKey) {
+        for ( ; *pName; ++pName) {
+            unsigned char ch = (unsigned char) *pName;
+            if (a_bNoCase && ch >= 'A' && ch <= 'Z') {
+                ch = (unsigned char) (ch - 'A' + 'a');
+            }
+            uHash = (uHash ^ ch) * 16777619u;
+        }
+        uHash = (uHash ^ 0xFF) * 16777619u;
+    }
+    return uHash;
+}
+
+inline bool
+CSimpleIniSnapshot::IsEqual(
+    const char *    a_pLeft,
+    const char *    a_pRight,
+    bool            a_bNoCase
+    )
+{
+    if (!a_bNoCase) {
+        return strcmp(a_pLeft, a_pRight) == 0;
+    }
+    for ( ; *a_pLeft && *a_pRight; ++a_pLeft, ++a_pRight) {
+        char chLeft = *a_pLeft, chRight = *a_pRight;
+        if (chLeft >= 'A' && chLeft <= 'Z') chLeft = chLeft - 'A' + 'a';
+        if (chRight >= 'A' && chRight <= 'Z') chRight = chRight - 'A' + 'a';
+        if (chLeft != chRight) {
+            return false;
+        }
+    }
+    return *a_pLeft == *a_pRight;
+}
+
+inline SI_UINT64
+CSimpleIniSnapshot::HashData(
+    const char *    a_pData,
+    size_t          a_uDataLen,
+    SI_UINT64       a_uHash
+    )
+{
+    // FNV-1a taken a word at a time, with a shift to fold the high bits
+    // of each word back down
+    const SI_UINT64 uPrime = 1099511628211ULL;
+    SI_UINT64 uHash = a_uHash ^ a_uDataLen;
+    for ( ; a_uDataLen >= 8; a_pData += 8, a_uDataLen -= 8) {
+        SI_UINT64 uWord;
+        memcpy(&uWord, a_pData, sizeof(uWord));
+        uHash = (uHash ^ uWord) * uPrime;
+        uHash ^= uHash >> 32;
+    }
+    for ( ; a_uDataLen > 0; ++a_pData, --a_uDataLen) {
+        uHash = (uHash ^ (unsigned char) *a_pData) * uPrime;
+    }
+    return uHash;
+}
+
+inline SI_UINT64
+CSimpleIniSnapshot::Checksum(
+    const SI_SnapshotHeader &   a_header,
+    const char *                a_pData
+    )
+{
+    SI_SnapshotHeader header = a_header;
+    header.uChecksum = 0;
+    SI_UINT64 uHash = HashData((const char *) &header, sizeof(header));
+    return HashData(a_pData, a_header.uDataSize, uHash);
+}
+
+inline SI_UINT32
+CSimpleIniSnapshot::StringOffset(
+    const std::vector<const char *> &   a_strings,
+    const std::vector<SI_UINT32> &      a_offsets,
+    const char *                        a_pString
+    )
+{
+    std::vector<const char *>::const_iterator i = std::lower_bound(
+        a_strings.begin(), a_strings.end(), a_pString, StringLess());
+    return a_offsets[i - a_strings.begin()];
+}
+
+template<class SI_STRLESS, class SI_CONVERTER>
+SI_Error
+CSimpleIniSnapshot::Load(
+    const CSimpleIniTempl<char,SI_STRLESS,SI_CONVERTER> & a_ini
+    )
+{
+    Reset();
+    SI_SnapshotSource source = { 0, 0, 0 };
+    SI_Error rc = Compile(a_ini, source, m_strData);
+    if (rc >= 0) {
+        rc = Attach(m_strData.data(), m_strData.size());
+    }
+    if (rc < 0) {
+        Reset();
+    }
+    return rc;
+}
+
+inline
+CSimpleIniSharedSnapshot::CSimpleIniSharedSnapshot()
+  : m_nEpoch(0)
+  , m_nWriting(0)
+  , m_pCurrent(NULL)
+{
+    for (int e = 0; e < 2; ++e) {
+        for (int n = 0; n < STRIPES; ++n) {
+            m_readers[e][n].nCount = 0;
+        }
+    }
+}
+
+inline
+CSimpleIniSharedSnapshot::~CSimpleIniSharedSnapshot()
+{
+    delete m_pCurrent;
+}
+
+inline void
+CSimpleIniSharedSnapshot::Replace(
+    CSimpleIniSnapshot * a_pSnapshot
+    )
+{
+    while (!SI_AtomicSwap(&m_nWriting, 0, 1)) {
+        SI_Yield();
+    }
+
+    // publish the new snapshot before flipping the epoch. Readers which
+    // see the new epoch also see the new snapshot.
+    CSimpleIniSnapshot * pOld = m_pCurrent;
+    m_pCurrent = a_pSnapshot;
+    SI_AtomicFence();
+    long nEpoch = m_nEpoch;
+    m_nEpoch = 1 - nEpoch;
+    SI_AtomicFence();
+
+    // only readers of the previous epoch may still use the old snapshot
+    for (int n = 0; n < STRIPES; ++n) {
+        while (m_readers[nEpoch][n].nCount != 0) {
+            SI_Yield();
+        }
+    }
+    SI_AtomicFence();
+    delete pOld;
+
+    SI_AtomicSwap(&m_nWriting, 1, 0);
+}
+
+inline
+CSimpleIniSharedSnapshot::Reader::Reader(
+    const CSimpleIniSharedSnapshot & a_shared
+    )
+{
+    // spread the threads over the stripes. Thread ids may be addresses
+    // with many low bits clear, so all of the bits are mixed in.
+    size_t uId = SI_ThreadId();
+    uId = (uId ^ (uId >> 12) ^ (uId >> 24)) * 2654435761U;
+    size_t uStripe = (uId >> 16) & (STRIPES - 1);
+
+    // announce this reader in the current epoch. If the epoch flipped in
+    // the meantime the writer may not have seen it, so try again.
+    for (;;) {
+        long nEpoch = a_shared.m_nEpoch;
+        m_pCount = &a_shared.m_readers[nEpoch][uStripe].nCount;
+        SI_AtomicIncrement(m_pCount);
+        if (a_shared.m_nEpoch == nEpoch) {
+            break;
+        }
+        SI_AtomicDecrement(m_pCount);
+    }
+    SI_AtomicFence();
+    m_pSnapshot = a_shared.m_pCurrent;
+}
+
+inline
+CSimpleIniSharedSnapshot::Reader::~Reader()
+{
+    SI_AtomicDecrement(m_pCount);
+}
+
+#endif // INCLUDED_SimpleIniSnapshot
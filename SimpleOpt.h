@@ -59,6 +59,8 @@
         files will be returned to the application in the same order they were 
         supplied on the command line
     -   short-circuit option matching: "--man" will match "--mandate"
+    -   optional hash index for exact matching with large option tables
+    -   optional expansion of "@file" response files
         invalid options can be handled while continuing to parse the command 
         line valid options list can be changed dynamically during command line
         processing, i.e. accept different options depending on an option 
@@ -207,6 +209,32 @@ ShowFiles(args.FileCount(), args.Files());
 # define SO_STATICBUF   50
 #endif
 
+// Response files (see SO_O_RESPFILE) are memory mapped, which needs the 
+// OS functions that are avoided when SO_MAX_ARGS is defined.
+#if !defined(SO_MAX_ARGS) && !defined(SO_NO_RESPFILE) && !defined(_WIN32_WCE)
+# if defined(_WIN32)
+#  include <windows.h>
+#  define SO_HAS_RESPFILE
+# elif defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  define SO_HAS_RESPFILE
+# endif
+#endif
+
+// Maximum nesting of response files, this also stops response file loops
+#ifndef SO_MAX_RESPFILE_DEPTH
+# define SO_MAX_RESPFILE_DEPTH  8
+#endif
+
+// Size of the blocks that arguments read from response files are stored in
+#ifndef SO_RESPFILE_BLOCK
+# define SO_RESPFILE_BLOCK      4096
+#endif
+
 //! Error values
 typedef enum _ESOError
 {
@@ -271,6 +299,14 @@ enum _ESOFlags
         an error. */
     SO_O_PEDANTIC    = 0x0040, 
 
+    /*! Find exact matches with a hash index of the options table instead
+        of comparing against every option, for large option tables. The
+        index is built on first use and again after SetOptions(), so the
+        table must not be changed without calling SetOptions(). Partial
+        matches still compare against every option. Has no effect if 
+        SO_MAX_ARGS is defined. */
+    SO_O_HASHINDEX   = 0x0080, 
+
     /*! Case-insensitive comparisons for short arguments */
     SO_O_ICASE_SHORT = 0x0100, 
 
@@ -282,7 +318,16 @@ enum _ESOFlags
     SO_O_ICASE_WORD  = 0x0400, 
 
     /*! Case-insensitive comparisons for all arg types */
-    SO_O_ICASE       = 0x0700  
+    SO_O_ICASE       = 0x0700, 
+
+    /*! Replace "@file" arguments with the arguments read from the file 
+        when Init() is called. Arguments in the file are separated by 
+        whitespace and may be quoted as on the Windows command line, e.g. 
+        "C:\Program Files\app.exe". Files may name further response 
+        files up to SO_MAX_RESPFILE_DEPTH deep. A file that can't be read
+        is left as the "@file" argument. Has no effect if SO_MAX_ARGS or
+        SO_NO_RESPFILE is defined. */
+    SO_O_RESPFILE    = 0x0800  
 };
 
 /*! Types of arguments that options may have. Note that some of the _ESOFlags
@@ -328,6 +373,144 @@ typedef enum _ESOArgType {
 # define SO_ASSERT(b)   //!< assertion used to test input data
 #endif
 
+#ifdef SO_HAS_RESPFILE
+// ---------------------------------------------------------------------------
+//                              RESPONSE FILES
+// ---------------------------------------------------------------------------
+
+/*! @brief Read-only view of an entire response file. */
+class SO_FileMap
+{
+public:
+    SO_FileMap() : m_pView(NULL), m_uSize(0) { }
+    ~SO_FileMap() { Close(); }
+
+#ifdef _WIN32
+    bool Open(const char * a_pszFile) {
+        return Map(CreateFileA(a_pszFile, GENERIC_READ, FILE_SHARE_READ,
+            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+    }
+    bool Open(const wchar_t * a_pszFile) {
+        return Map(CreateFileW(a_pszFile, GENERIC_READ, FILE_SHARE_READ,
+            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+    }
+#else
+    bool Open(const char * a_pszFile) {
+        return Map(open(a_pszFile, O_RDONLY));
+    }
+    bool Open(const wchar_t * a_pszFile) {
+        char szFile[4096];
+        size_t uLen = wcstombs(szFile, a_pszFile, sizeof(szFile));
+        if (uLen == (size_t) -1 || uLen == sizeof(szFile)) {
+            return false;
+        }
+        return Open(szFile);
+    }
+#endif
+
+    /*! Unmap the file. */
+    void Close() {
+        if (m_pView) {
+#ifdef _WIN32
+            UnmapViewOfFile(m_pView);
+#else
+            munmap((void *) m_pView, m_uSize);
+#endif
+        }
+        m_pView = NULL;
+        m_uSize = 0;
+    }
+
+    const unsigned char * Data() const { return m_pView; }
+    size_t Size() const { return m_uSize; }
+
+private:
+    SO_FileMap(const SO_FileMap &); // disabled
+    SO_FileMap & operator=(const SO_FileMap &); // disabled
+
+    // Map the open file and close it. An empty file has no view.
+#ifdef _WIN32
+    bool Map(HANDLE hFile) {
+        Close();
+        if (hFile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        DWORD dwSizeHigh = 0;
+        DWORD dwSize = GetFileSize(hFile, &dwSizeHigh);
+        bool bOk = (dwSize != INVALID_FILE_SIZE || GetLastError() == NO_ERROR)
+            && dwSizeHigh == 0;
+        if (bOk && dwSize > 0) {
+            HANDLE hMap = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (hMap) {
+                m_pView = (const unsigned char *) 
+                    MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(hMap);
+            }
+            bOk = m_pView != NULL;
+        }
+        CloseHandle(hFile);
+        m_uSize = bOk ? (size_t) dwSize : 0;
+        return bOk;
+    }
+#else
+    bool Map(int fd) {
+        Close();
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        bool bOk = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+        if (bOk && st.st_size > 0) {
+            void * pView = mmap(NULL, (size_t) st.st_size, PROT_READ, 
+                MAP_PRIVATE, fd, 0);
+            if (pView != MAP_FAILED) {
+                m_pView = (const unsigned char *) pView;
+            }
+            bOk = m_pView != NULL;
+        }
+        close(fd);
+        m_uSize = bOk ? (size_t) st.st_size : 0;
+        return bOk;
+    }
+#endif
+
+    const unsigned char *   m_pView;    //!< the file, NULL if empty
+    size_t                  m_uSize;    //!< size of the file
+};
+
+// Whitespace between the arguments in a response file
+inline bool SO_IsSpace(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Decode the rest of a UTF-8 sequence starting with a_uLead. Bytes that
+// are not valid UTF-8 are returned as they are (i.e. as Latin-1).
+inline unsigned long 
+SO_DecodeUtf8(
+    unsigned long           a_uLead, 
+    const unsigned char *&  a_pNext, 
+    const unsigned char *   a_pEnd
+    )
+{
+    int nExtra = a_uLead >= 0xF8 ? -1 
+               : a_uLead >= 0xF0 ? 3 
+               : a_uLead >= 0xE0 ? 2 
+               : a_uLead >= 0xC0 ? 1 : -1;
+    if (nExtra < 0 || a_pEnd - a_pNext < nExtra) {
+        return a_uLead;
+    }
+    unsigned long uChar = a_uLead & (0x3F >> nExtra);
+    for (int n = 0; n < nExtra; ++n) {
+        if ((a_pNext[n] & 0xC0) != 0x80) {
+            return a_uLead;
+        }
+        uChar = (uChar << 6) | (a_pNext[n] & 0x3F);
+    }
+    a_pNext += nExtra;
+    return uChar;
+}
+#endif // SO_HAS_RESPFILE
+
 // ---------------------------------------------------------------------------
 //                              MAIN TEMPLATE CLASS
 // ---------------------------------------------------------------------------
@@ -353,7 +536,10 @@ public:
 
     /*! @brief Initialize the class. Init() must be called later. */
     CSimpleOptTempl() 
-        : m_rgShuffleBuf(NULL) 
+        : m_rgFileBuf(NULL) 
+        , m_rgIndex(NULL) 
+        , m_rgArgs(NULL) 
+        , m_pArena(NULL) 
     { 
         Init(0, NULL, NULL, 0); 
     }
@@ -365,14 +551,23 @@ public:
         const SOption * a_rgOptions, 
         int             a_nFlags = 0
         ) 
-        : m_rgShuffleBuf(NULL) 
+        : m_rgFileBuf(NULL) 
+        , m_rgIndex(NULL) 
+        , m_rgArgs(NULL) 
+        , m_pArena(NULL) 
     { 
         Init(argc, argv, a_rgOptions, a_nFlags); 
     }
 
 #ifndef SO_MAX_ARGS
     /*! @brief Deallocate any allocated memory. */
-    ~CSimpleOptTempl() { if (m_rgShuffleBuf) free(m_rgShuffleBuf); }
+    ~CSimpleOptTempl() { 
+        if (m_rgFileBuf) free(m_rgFileBuf); 
+        if (m_rgIndex) free(m_rgIndex); 
+#ifdef SO_HAS_RESPFILE
+        FreeResponseFiles();
+#endif
+    }
 #endif
 
     /*! @brief Initialize the class in preparation for calling Next.
@@ -384,7 +579,8 @@ public:
 
         NOTE: the array pointed to by a_argv will be modified by this
         class and must not be used or modified outside of member calls to
-        this class.
+        this class. With SO_O_RESPFILE a new array is used instead if any
+        response files are given.
 
         @param a_argc       Argument array size
         @param a_argv       Argument array
@@ -409,6 +605,7 @@ public:
      */
     inline void SetOptions(const SOption * a_rgOptions) { 
         m_rgOptions = a_rgOptions; 
+        m_rgIndexOptions = NULL;
     }
 
     /*! @brief Change the current flags during option parsing.
@@ -495,7 +692,7 @@ public:
         After Next() has returned false, this will be the list of files (or
         otherwise unprocessed arguments).
      */
-    inline int FileCount() const { return m_argc - m_nLastArg; }
+    inline int FileCount() const { return m_nFileCount; }
 
     /*! @brief Return the specified file argument.
 
@@ -504,11 +701,13 @@ public:
      */
     inline SOCHAR * File(int n) const {
         SO_ASSERT(n >= 0 && n < FileCount());
-        return m_argv[m_nLastArg + n];
+        return Files()[n];
     }
 
     /*! @brief Return the array of files. */
-    inline SOCHAR ** Files() const { return &m_argv[m_nLastArg]; }
+    inline SOCHAR ** Files() const { 
+        return m_nLastArg < m_argc ? &m_argv[m_nLastArg] : m_rgFiles; 
+    }
 
 private:
     CSimpleOptTempl(const CSimpleOptTempl &); // disabled
@@ -516,9 +715,32 @@ private:
 
     SOCHAR PrepareArg(SOCHAR * a_pszString) const;
     bool NextClumped();
-    void ShuffleArg(int a_nStartIdx, int a_nCount);
-    int LookupOption(const SOCHAR * a_pszOption) const;
+    void MoveFiles();
+
+    // Move an option down to the next option position, over any files 
+    // found before it. The files have been copied to m_rgFiles.
+    inline void MoveOption(int a_nArgIdx) {
+        m_argv[m_nNextOption++] = m_argv[a_nArgIdx];
+        m_nNextArg = a_nArgIdx + 1;
+    }
+    int LookupOption(const SOCHAR * a_pszOption);
     int CalcMatch(const SOCHAR *a_pszSource, const SOCHAR *a_pszTest) const;
+#ifndef SO_MAX_ARGS
+    bool LookupExact(const SOCHAR * a_pszOption, int & a_nTableIdx);
+    bool BuildIndex();
+#endif
+
+    // Hash of an option name for the index. Letters are hashed without 
+    // case so that case-insensitive matches are found in the same slot.
+    inline unsigned int HashOption(const SOCHAR * s) const {
+        unsigned int uHash = 2166136261u;
+        for (; *s; ++s) {
+            SOCHAR c = *s;
+            if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+            uHash = (uHash ^ (unsigned int) c) * 16777619u;
+        }
+        return uHash;
+    }
 
     // Find the '=' character within a string.
     inline SOCHAR * FindEquals(SOCHAR *s) const {
@@ -536,13 +758,39 @@ private:
 #endif
     }
 
+#ifdef SO_HAS_RESPFILE
+    bool ExpandResponseFiles();
+    int AddResponseFile(const SOCHAR * a_pszFile, int a_nDepth);
+    bool AddArg(SOCHAR * a_pszArg);
+    bool AddTokenChar(unsigned long a_uChar);
+    void FreeResponseFiles();
+
+    // Is the argument a response file, i.e. "@file"
+    inline bool IsResponseFile(const SOCHAR * a_pszArg) const {
+        return a_pszArg[0] == (SOCHAR)'@' && a_pszArg[1];
+    }
+#endif
+
+    //! block of arguments read from response files
+    struct SArenaBlock {
+        SArenaBlock *   pNext;       //!< previously allocated block
+    };
+
+    //! slot of the hash index, see SO_O_HASHINDEX
+    struct SIndexSlot {
+        unsigned int    uHash;       //!< HashOption() of the option
+        int             nTableIdx;   //!< option table index, -1 = empty
+    };
+
 private:
     const SOption * m_rgOptions;     //!< pointer to options table 
     int             m_nFlags;        //!< flags 
     int             m_nOptionIdx;    //!< current argv option index
     int             m_nOptionId;     //!< id of current option (-1 = invalid)
     int             m_nNextOption;   //!< index of next option 
+    int             m_nNextArg;      //!< index of next unprocessed argument
     int             m_nLastArg;      //!< last argument, after this are files
+    int             m_nFileCount;    //!< number of files found
     int             m_argc;          //!< argc to process
     SOCHAR **       m_argv;          //!< argv
     const SOCHAR *  m_pszOptionText; //!< curr option text, e.g. "-f"
@@ -550,7 +798,20 @@ private:
     SOCHAR *        m_pszClump;      //!< clumped single character options
     SOCHAR          m_szShort[3];    //!< temp for clump and combined args
     ESOError        m_nLastError;    //!< error status from the last call
-    SOCHAR **       m_rgShuffleBuf;  //!< shuffle buffer for large argc
+    SOCHAR **       m_rgFiles;       //!< files in the order found
+    SOCHAR **       m_rgFileBuf;     //!< allocated m_rgFiles for large argc
+    SOCHAR *        m_rgStaticFiles[SO_STATICBUF]; //!< m_rgFiles otherwise
+    SIndexSlot *    m_rgIndex;       //!< hash index of the options table
+    int             m_nIndexMask;    //!< number of index slots - 1
+    const SOption * m_rgIndexOptions;//!< table indexed, NULL = rebuild
+    SOCHAR **       m_rgArgs;        //!< argv with response files expanded
+    int             m_nArgCount;     //!< number of entries in m_rgArgs
+    int             m_nArgSize;      //!< allocated size of m_rgArgs
+    SArenaBlock *   m_pArena;        //!< blocks holding m_rgArgs strings
+    SOCHAR *        m_pArenaData;    //!< characters of the newest block
+    int             m_nArenaUsed;    //!< characters used in m_pArenaData
+    int             m_nArenaSize;    //!< size of m_pArenaData
+    int             m_nTokenStart;   //!< start of the argument being read
 };
 
 // ---------------------------------------------------------------------------
@@ -576,24 +837,43 @@ CSimpleOptTempl<SOCHAR>::Init(
     m_pszOptionText  = NULL;
     m_pszOptionArg   = NULL;
     m_nNextOption    = (a_nFlags & SO_O_USEALL) ? 0 : 1;
+    m_nNextArg       = m_nNextOption;
+    m_nFileCount     = 0;
+    m_rgFiles        = m_rgStaticFiles;
     m_szShort[0]     = (SOCHAR)'-';
     m_szShort[2]     = (SOCHAR)'\0';
     m_nFlags         = a_nFlags;
     m_pszClump       = NULL;
+    m_rgIndexOptions = NULL;
+
+#ifdef SO_HAS_RESPFILE
+    if (!ExpandResponseFiles()) {
+        m_nLastArg = 0;
+        m_nFileCount = m_argc;
+        m_rgFiles = NULL;
+        return false;
+    }
+    m_nLastArg = m_argc;
+#endif
 
 #ifdef SO_MAX_ARGS
 	if (m_argc > SO_MAX_ARGS) {
         m_nLastError = SO_ARG_INVALID_DATA;
         m_nLastArg = 0;
+        m_nFileCount = m_argc;
 		return false;
 	}
 #else
-    if (m_rgShuffleBuf) {
-        free(m_rgShuffleBuf);
+    if (m_rgFileBuf) {
+        free(m_rgFileBuf);
+        m_rgFileBuf = NULL;
     }
     if (m_argc > SO_STATICBUF) {
-        m_rgShuffleBuf = (SOCHAR**) malloc(sizeof(SOCHAR*) * m_argc);
-        if (!m_rgShuffleBuf) {
+        m_rgFileBuf = (SOCHAR**) malloc(sizeof(SOCHAR*) * m_argc);
+        m_rgFiles = m_rgFileBuf;
+        if (!m_rgFileBuf) {
+            m_nLastArg = 0;
+            m_nFileCount = m_argc;
             return false;
         }
     }
@@ -611,6 +891,11 @@ CSimpleOptTempl<SOCHAR>::Next()
         SO_ASSERT(!"Too many args! Check the return value of Init()!");
         return false;
     }
+#else
+    if (!m_rgFiles) {
+        SO_ASSERT(!"Out of memory! Check the return value of Init()!");
+        return false;
+    }
 #endif
 
     // process a clumped option string if appropriate
@@ -639,8 +924,8 @@ CSimpleOptTempl<SOCHAR>::Next()
     // find the next option
     SOCHAR cFirst;
     int nTableIdx = -1;
-    int nOptIdx = m_nOptionIdx;
-    while (nTableIdx < 0 && nOptIdx < m_nLastArg) {
+    int nOptIdx = m_nNextArg;
+    while (nTableIdx < 0 && nOptIdx < m_argc) {
         SOCHAR * pszArg = m_argv[nOptIdx];
         m_pszOptionArg  = NULL;
 
@@ -682,10 +967,7 @@ CSimpleOptTempl<SOCHAR>::Next()
             // match on the short-form argument above
             if (nTableIdx < 0 && HasFlag(SO_O_CLUMP))  {
                 m_pszClump = &pszArg[1];
-                ++m_nNextOption;
-                if (nOptIdx > m_nOptionIdx) {
-                    ShuffleArg(m_nOptionIdx, nOptIdx - m_nOptionIdx);
-                }
+                MoveOption(nOptIdx);
                 return Next();
             }
         }
@@ -700,21 +982,20 @@ CSimpleOptTempl<SOCHAR>::Next()
             }
             
             pszArg[0] = cFirst;
-            ++nOptIdx;
             if (m_pszOptionArg) {
                 *(--m_pszOptionArg) = (SOCHAR)'=';
             }
+            m_rgFiles[m_nFileCount++] = m_argv[nOptIdx++];
         }
     }
 
     // end of options
-    if (nOptIdx >= m_nLastArg) {
-        if (nOptIdx > m_nOptionIdx) {
-            ShuffleArg(m_nOptionIdx, nOptIdx - m_nOptionIdx);
-        }
+    if (nOptIdx >= m_argc) {
+        m_nNextArg = nOptIdx;
+        MoveFiles();
         return false;
     }
-    ++m_nNextOption;
+    MoveOption(nOptIdx);
 
     // get the option id
     ESOArgType nArgType = SO_NONE;
@@ -762,11 +1043,6 @@ CSimpleOptTempl<SOCHAR>::Next()
         }
     }
 
-    // shuffle the files out of the way
-    if (nOptIdx > m_nOptionIdx) {
-        ShuffleArg(m_nOptionIdx, nOptIdx - m_nOptionIdx);
-    }
-
     // we need to return the separate arg if required, just re-use the
     // multi-arg code because it all does the same thing
     if (   nArgType == SO_REQ_SEP 
@@ -786,9 +1062,10 @@ template<class SOCHAR>
 void
 CSimpleOptTempl<SOCHAR>::Stop()
 {
-    if (m_nNextOption < m_nLastArg) {
-        ShuffleArg(m_nNextOption, m_nLastArg - m_nNextOption);
+    while (m_nNextArg < m_argc) {
+        m_rgFiles[m_nFileCount++] = m_argv[m_nNextArg++];
     }
+    MoveFiles();
 }
 
 template<class SOCHAR>
@@ -827,7 +1104,7 @@ CSimpleOptTempl<SOCHAR>::NextClumped()
 
     // lookup this option, ensure that we are using exact matching
     int nSavedFlags = m_nFlags;
-    m_nFlags = SO_O_EXACT;
+    m_nFlags = SO_O_EXACT | (nSavedFlags & SO_O_HASHINDEX);
     int nTableIdx = LookupOption(m_szShort);
     m_nFlags = nSavedFlags;
 
@@ -857,50 +1134,266 @@ CSimpleOptTempl<SOCHAR>::NextClumped()
     return true;
 }
 
-// Shuffle arguments to the end of the argv array.
+// Move the files to the end of the argv array once all arguments have 
+// been processed. While processing, each option and its arguments are
+// moved down over the files before it, and the files are copied to 
+// m_rgFiles in the order they were found, so every argument is moved 
+// only once however the options and files are mixed.
 //
-// For example:
-//      argv[] = { "0", "1", "2", "3", "4", "5", "6", "7", "8" };
+// For example, when "o" are options and "f" are files:
+//      argv[] = { "0", "f1", "o2", "f3", "f4", "o5", "f6" };
 //
-//  ShuffleArg(1, 1) = { "0", "2", "3", "4", "5", "6", "7", "8", "1" };
-//  ShuffleArg(5, 2) = { "0", "1", "2", "3", "4", "7", "8", "5", "6" };
-//  ShuffleArg(2, 4) = { "0", "1", "6", "7", "8", "2", "3", "4", "5" };
+//  after "o2"   { "0", "o2", "o2", "f3", "f4", "o5", "f6" }, files = f1
+//  after "o5"   { "0", "o2", "o5", "f3", "f4", "o5", "f6" }, files = f1 f3 f4
+//  MoveFiles()  { "0", "o2", "o5", "f1", "f3", "f4", "f6" }
 template<class SOCHAR>
 void
-CSimpleOptTempl<SOCHAR>::ShuffleArg(
-    int a_nStartIdx,
-    int a_nCount
+CSimpleOptTempl<SOCHAR>::MoveFiles()
+{
+    SO_ASSERT(m_nNextArg == m_argc && m_nNextOption + m_nFileCount == m_argc);
+    m_nLastArg = m_argc - m_nFileCount;
+    Copy(m_argv + m_nLastArg, m_rgFiles, m_nFileCount);
+}
+
+#ifdef SO_HAS_RESPFILE
+// Replace m_argv with an array where the arguments of each "@file" are
+// read from the file. m_argv is left alone if there are no "@file" args.
+template<class SOCHAR>
+bool
+CSimpleOptTempl<SOCHAR>::ExpandResponseFiles()
+{
+    FreeResponseFiles();
+    if (!HasFlag(SO_O_RESPFILE)) {
+        return true;
+    }
+
+    int nFirst = m_nNextOption;
+    int n = nFirst;
+    while (n < m_argc && !IsResponseFile(m_argv[n])) ++n;
+    if (n == m_argc) {
+        return true;
+    }
+
+    for (n = 0; n < m_argc; ++n) {
+        if (n >= nFirst && IsResponseFile(m_argv[n])) {
+            int nResult = AddResponseFile(m_argv[n] + 1, 1);
+            if (nResult < 0) {
+                return false;
+            }
+            if (nResult > 0) {
+                continue;
+            }
+        }
+        if (!AddArg(m_argv[n])) {
+            return false;
+        }
+    }
+
+    m_argv = m_rgArgs;
+    m_argc = m_nArgCount;
+    return true;
+}
+
+// Add the arguments from a response file. The file is read directly from
+// the mapped view one argument at a time, and only the arguments are 
+// stored. Returns 1 if the file was read, 0 if it couldn't be opened and
+// -1 if memory couldn't be allocated.
+template<class SOCHAR>
+int
+CSimpleOptTempl<SOCHAR>::AddResponseFile(
+    const SOCHAR *  a_pszFile,
+    int             a_nDepth
     )
 {
-    SOCHAR * staticBuf[SO_STATICBUF];
-    SOCHAR ** buf = m_rgShuffleBuf ? m_rgShuffleBuf : staticBuf;
-    int nTail = m_argc - a_nStartIdx - a_nCount;
+    SO_FileMap file;
+    if (!file.Open(a_pszFile)) {
+        return 0;
+    }
+    const unsigned char * p = file.Data();
+    const unsigned char * pEnd = p + file.Size();
 
-    // make a copy of the elements to be moved
-    Copy(buf, m_argv + a_nStartIdx, a_nCount);
+    // skip the UTF-8 signature if it exists
+    if (pEnd - p >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF) {
+        p += 3;
+    }
 
-    // move the tail down
-    Copy(m_argv + a_nStartIdx, m_argv + a_nStartIdx + a_nCount, nTail);
+    for (;;) {
+        while (p < pEnd && SO_IsSpace(*p)) ++p;
+        if (p == pEnd) {
+            break;
+        }
 
-    // append the moved elements to the tail
-    Copy(m_argv + a_nStartIdx + nTail, buf, a_nCount);
+        // read one argument. Quotes group characters including spaces, 
+        // backslashes are only special before a quote: 2N backslashes 
+        // become N and the quote starts or ends a quoted part, 2N+1 
+        // become N and a literal quote.
+        m_nTokenStart = m_nArenaUsed;
+        bool bQuoted = false;
+        bool bOk = true;
+        while (p < pEnd && bOk && (bQuoted || !SO_IsSpace(*p))) {
+            if (*p == '"') {
+                bQuoted = !bQuoted;
+                ++p;
+                continue;
+            }
+            if (*p == '\\') {
+                const unsigned char * pSlash = p;
+                while (p < pEnd && *p == '\\') ++p;
+                int nSlash = (int) (p - pSlash);
+                if (p < pEnd && *p == '"') {
+                    if (nSlash & 1) {
+                        ++p;
+                    }
+                    for (int n = 0; n < nSlash / 2 && bOk; ++n) {
+                        bOk = AddTokenChar('\\');
+                    }
+                    if (nSlash & 1) {
+                        bOk = bOk && AddTokenChar('"');
+                    }
+                }
+                else {
+                    for (int n = 0; n < nSlash && bOk; ++n) {
+                        bOk = AddTokenChar('\\');
+                    }
+                }
+                continue;
+            }
+
+            // wide characters are read as UTF-8, others are copied
+            unsigned long uChar = *p++;
+            if (sizeof(SOCHAR) > 1 && uChar >= 0x80) {
+                uChar = SO_DecodeUtf8(uChar, p, pEnd);
+            }
+            bOk = AddTokenChar(uChar);
+        }
+        if (!bOk || !AddTokenChar(0)) {
+            return -1;
+        }
 
-    // update the index of the last unshuffled arg
-    m_nLastArg -= a_nCount;
+        // the argument may be another response file
+        SOCHAR * pszArg = m_pArenaData + m_nTokenStart;
+        if (IsResponseFile(pszArg) && a_nDepth < SO_MAX_RESPFILE_DEPTH) {
+            int nResult = AddResponseFile(pszArg + 1, a_nDepth + 1);
+            if (nResult < 0) {
+                return -1;
+            }
+            if (nResult > 0) {
+                continue;
+            }
+        }
+        if (!AddArg(pszArg)) {
+            return -1;
+        }
+    }
+
+    return 1;
 }
 
+// add an argument to m_rgArgs
+template<class SOCHAR>
+bool
+CSimpleOptTempl<SOCHAR>::AddArg(
+    SOCHAR *    a_pszArg
+    )
+{
+    if (m_nArgCount == m_nArgSize) {
+        int nSize = m_nArgSize ? m_nArgSize * 2 : 64;
+        SOCHAR ** rgArgs = (SOCHAR **) realloc(m_rgArgs, sizeof(SOCHAR*) * nSize);
+        if (!rgArgs) {
+            return false;
+        }
+        m_rgArgs = rgArgs;
+        m_nArgSize = nSize;
+    }
+    m_rgArgs[m_nArgCount++] = a_pszArg;
+    return true;
+}
+
+// Add a character to the argument being read from a response file. The
+// arguments are stored in blocks which are never moved, when the newest
+// block is full the argument so far is copied to a new block.
+template<class SOCHAR>
+bool
+CSimpleOptTempl<SOCHAR>::AddTokenChar(
+    unsigned long   a_uChar
+    )
+{
+    // characters outside of the BMP need a surrogate pair in UTF-16
+    if (sizeof(SOCHAR) == 2 && a_uChar > 0xFFFF) {
+        a_uChar -= 0x10000;
+        if (!AddTokenChar(0xD800 + (a_uChar >> 10))) {
+            return false;
+        }
+        a_uChar = 0xDC00 + (a_uChar & 0x3FF);
+    }
+
+    if (m_nArenaUsed == m_nArenaSize) {
+        int nLen = m_nArenaUsed - m_nTokenStart;
+        int nSize = 2 * nLen > SO_RESPFILE_BLOCK ? 2 * nLen : SO_RESPFILE_BLOCK;
+        SArenaBlock * pBlock = (SArenaBlock *) malloc(
+            sizeof(SArenaBlock) + sizeof(SOCHAR) * nSize);
+        if (!pBlock) {
+            return false;
+        }
+        pBlock->pNext = m_pArena;
+        m_pArena = pBlock;
+        SOCHAR * pData = (SOCHAR *) (pBlock + 1);
+        if (nLen > 0) {
+            memcpy(pData, m_pArenaData + m_nTokenStart, sizeof(SOCHAR) * nLen);
+        }
+        m_pArenaData = pData;
+        m_nArenaUsed = nLen;
+        m_nArenaSize = nSize;
+        m_nTokenStart = 0;
+    }
+    m_pArenaData[m_nArenaUsed++] = (SOCHAR) a_uChar;
+    return true;
+}
+
+template<class SOCHAR>
+void
+CSimpleOptTempl<SOCHAR>::FreeResponseFiles()
+{
+    while (m_pArena) {
+        SArenaBlock * pNext = m_pArena->pNext;
+        free(m_pArena);
+        m_pArena = pNext;
+    }
+    if (m_rgArgs) {
+        free(m_rgArgs);
+        m_rgArgs = NULL;
+    }
+    m_nArgCount = 0;
+    m_nArgSize = 0;
+    m_pArenaData = NULL;
+    m_nArenaUsed = 0;
+    m_nArenaSize = 0;
+    m_nTokenStart = 0;
+}
+#endif // SO_HAS_RESPFILE
+
 // match on the long format strings. partial matches will be
 // accepted only if that feature is enabled.
 template<class SOCHAR>
 int
 CSimpleOptTempl<SOCHAR>::LookupOption(
     const SOCHAR * a_pszOption
-    ) const
+    )
 {
     int nBestMatch = -1;    // index of best match so far
     int nBestMatchLen = 0;  // matching characters of best match
     int nLastMatchLen = 0;  // matching characters of last best match
 
+#ifndef SO_MAX_ARGS
+    // an exact match is found in the index, otherwise we only need to 
+    // look at every option if partial matches are allowed
+    if (HasFlag(SO_O_HASHINDEX) && LookupExact(a_pszOption, nBestMatch)) {
+        if (nBestMatch >= 0 || HasFlag(SO_O_EXACT)) {
+            return nBestMatch >= 0 ? nBestMatch : SO_OPT_INVALID;
+        }
+    }
+#endif
+
     for (int n = 0; m_rgOptions[n].nId >= 0; ++n) {
         // the option table must use hyphens as the option character,
         // the slash character is converted to a hyphen for testing.
@@ -925,6 +1418,76 @@ CSimpleOptTempl<SOCHAR>::LookupOption(
     return (nBestMatchLen > nLastMatchLen) ? nBestMatch : SO_OPT_MULTIPLE;
 }
 
+#ifndef SO_MAX_ARGS
+// find the first option in the table which exactly matches, or -1 if 
+// there isn't one. returns false if the index couldn't be built.
+template<class SOCHAR>
+bool
+CSimpleOptTempl<SOCHAR>::LookupExact(
+    const SOCHAR *  a_pszOption,
+    int &           a_nTableIdx
+    )
+{
+    if (m_rgIndexOptions != m_rgOptions && !BuildIndex()) {
+        return false;
+    }
+
+    // all options with the same name ignoring case are in the same run
+    // of slots, and each table index is in the index only once
+    a_nTableIdx = -1;
+    unsigned int uHash = HashOption(a_pszOption);
+    int nSlot = (int) (uHash & (unsigned int) m_nIndexMask);
+    for (; m_rgIndex[nSlot].nTableIdx >= 0; nSlot = (nSlot + 1) & m_nIndexMask) {
+        int n = m_rgIndex[nSlot].nTableIdx;
+        if (m_rgIndex[nSlot].uHash == uHash 
+            && (a_nTableIdx < 0 || n < a_nTableIdx)
+            && CalcMatch(m_rgOptions[n].pszArg, a_pszOption) == -1)
+        {
+            a_nTableIdx = n;
+        }
+    }
+    return true;
+}
+
+// build the hash index of the current options table
+template<class SOCHAR>
+bool
+CSimpleOptTempl<SOCHAR>::BuildIndex()
+{
+    int nCount = 0;
+    while (m_rgOptions[nCount].nId >= 0) ++nCount;
+
+    // keep the index no more than half full
+    int nSlots = 16;
+    while (nSlots < 2 * nCount) nSlots *= 2;
+    if (!m_rgIndex || m_nIndexMask + 1 < nSlots) {
+        if (m_rgIndex) free(m_rgIndex);
+        m_rgIndex = (SIndexSlot *) malloc(sizeof(SIndexSlot) * nSlots);
+        if (!m_rgIndex) {
+            return false;
+        }
+        m_nIndexMask = nSlots - 1;
+    }
+    for (int n = 0; n <= m_nIndexMask; ++n) {
+        m_rgIndex[n].nTableIdx = -1;
+    }
+
+    for (int n = 0; n < nCount; ++n) {
+        if (!m_rgOptions[n].pszArg) continue;
+        unsigned int uHash = HashOption(m_rgOptions[n].pszArg);
+        int nSlot = (int) (uHash & (unsigned int) m_nIndexMask);
+        while (m_rgIndex[nSlot].nTableIdx >= 0) {
+            nSlot = (nSlot + 1) & m_nIndexMask;
+        }
+        m_rgIndex[nSlot].uHash = uHash;
+        m_rgIndex[nSlot].nTableIdx = n;
+    }
+
+    m_rgIndexOptions = m_rgOptions;
+    return true;
+}
+#endif // SO_MAX_ARGS
+
 // calculate the number of characters that match (case-sensitive)
 // 0 = no match, > 0 == number of characters, -1 == perfect match
 template<class SOCHAR>
@@ -1011,13 +1574,13 @@ CSimpleOptTempl<SOCHAR>::MultiArg(
     )
 {
     // ensure we have enough arguments
-    if (m_nNextOption + a_nCount > m_nLastArg) {
+    if (m_nNextArg + a_nCount > m_argc) {
         m_nLastError = SO_ARG_MISSING;
         return NULL;
     }
 
     // our argument array
-    SOCHAR ** rgpszArg = &m_argv[m_nNextOption];
+    SOCHAR ** rgpszArg = &m_argv[m_nNextArg];
 
     // Ensure that each of the following don't start with an switch character.
     // Only make this check if we are returning errors for unknown arguments.
@@ -1033,8 +1596,13 @@ CSimpleOptTempl<SOCHAR>::MultiArg(
         }
     }
 
-    // all good
+    // all good, move the arguments down after the option
+    for (int n = 0; n < a_nCount; ++n) {
+        m_argv[m_nNextOption + n] = rgpszArg[n];
+    }
+    rgpszArg = &m_argv[m_nNextOption];
     m_nNextOption += a_nCount;
+    m_nNextArg += a_nCount;
     return rgpszArg;
 }
 
@@ -6,11 +6,17 @@ Oisin Mulvihill
 2009-04-20
 
 */
+#include <vector>
+#include <algorithm>
+
 #include "service.hpp"
 #include "SimpleOpt.h"
 
 #define SERVICESTATION_VERSION "1.0.5"
 
+// How many services are installed / removed at the same time:
+#define BATCH_THREADS 8
+
 ServiceBase *service = NULL;
 
 // This will be set up so that windows calls it
@@ -38,17 +44,242 @@ void ShowUsage() \
     _tprintf(_T("\
 Usage: \n \
 [-v] Print out the service station version \n \
-[-c] <absolute path to config.ini> \n \
+[-c] <absolute path to config.ini or a directory of them> \n \
 [-i] Install Service \n \
 [-r] Remove/Uninstall \n \
+[file ...] More config files or directories to install/remove \n \
+[@file] Read more arguments from a file, one or more per line \n \
 [-?] [--help]\n"));
 
 }
 
 
+// Add a config file to the ones to install / remove. For a directory
+// all the *.cfg and *.ini files in it are added. The service finds
+// its config from the registry so the full path is stored.
+//
+void addConfigFiles(const char *path, std::vector<std::string> &config_files)
+{
+	char full_path[MAX_PATH];
+	if (GetFullPathName(path, MAX_PATH, full_path, NULL) == 0)
+	{
+		strncpy(full_path, path, MAX_PATH - 1);
+		full_path[MAX_PATH - 1] = '\0';
+	}
+
+	DWORD attributes = GetFileAttributes(full_path);
+	if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY))
+	{
+		config_files.push_back(full_path);
+		return;
+	}
+
+	std::string dir = full_path;
+	if (dir[dir.length() - 1] != '\\')
+	{
+		dir += "\\";
+	}
+
+	WIN32_FIND_DATA found;
+	HANDLE find = FindFirstFile((dir + "*").c_str(), &found);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+
+	// The extension is checked here rather than in the pattern as
+	// patterns also match the 8.3 short names:
+	//
+	std::vector<std::string> names;
+	do
+	{
+		const char *ext = strrchr(found.cFileName, '.');
+		if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && ext
+			&& (_stricmp(ext, ".cfg") == 0 || _stricmp(ext, ".ini") == 0))
+		{
+			names.push_back(dir + found.cFileName);
+		}
+	}
+	while (FindNextFile(find, &found));
+	FindClose(find);
+
+	std::sort(names.begin(), names.end());
+	config_files.insert(config_files.end(), names.begin(), names.end());
+}
+
+
+// Installing / removing services: each config file gets its own Service
+// instance. They all use one Service Control Manager connection and up
+// to BATCH_THREADS threads, so the SCM calls for different services
+// overlap rather than run one after the other.
+//
+struct BatchEntry
+{
+	std::string config_file;
+	std::string name;
+	bool loaded;
+	bool ok;
+	DWORD error;
+};
+
+struct Batch
+{
+	std::vector<BatchEntry> entries;
+	LONG next;
+	SC_HANDLE manager;
+	bool install;
+};
+
+// Each thread takes the next config file until there are none left:
+//
+unsigned __stdcall batchWorker(void *param)
+{
+	Batch *batch = (Batch *) param;
+
+	for (;;)
+	{
+		LONG i = InterlockedIncrement(&batch->next) - 1;
+		if (i >= (LONG) batch->entries.size())
+		{
+			break;
+		}
+		BatchEntry &entry = batch->entries[i];
+
+		Win32ServiceManager manager(batch->manager);
+		Service *instance = new Service(entry.config_file, serviceMain, serviceControl);
+		instance->setServiceManager(&manager);
+
+		// Only read the config, the service may not exist yet:
+		entry.loaded = (instance->loadConfiguration() == NO_ERROR);
+		if (!entry.loaded)
+		{
+			// Get the error for accessing the file to aid debugging:
+			if (GetFileAttributes(entry.config_file.c_str()) == INVALID_FILE_ATTRIBUTES)
+			{
+				entry.error = GetLastError();
+			}
+		}
+		else
+		{
+			entry.name = instance->getName();
+			entry.ok = batch->install ? instance->install() : instance->unInstall();
+			if (!entry.ok)
+			{
+				entry.error = instance->getLastError();
+			}
+		}
+
+		delete instance;
+	}
+
+	return 0;
+}
+
+// Install or remove the service for each config file and then report
+// how each one went. Returns the number which failed.
+//
+int runBatch(const std::vector<std::string> &config_files, bool install)
+{
+	Batch batch;
+	batch.next = 0;
+	batch.install = install;
+
+	for (size_t i = 0; i < config_files.size(); i++)
+	{
+		BatchEntry entry;
+		entry.config_file = config_files[i];
+		entry.loaded = false;
+		entry.ok = false;
+		entry.error = 0;
+		batch.entries.push_back(entry);
+	}
+
+	// Only ask for what install / unInstall need:
+	//
+	batch.manager = OpenSCManager(
+		NULL, 
+		NULL, 
+		install ? (SC_MANAGER_CONNECT | SC_MANAGER_CREATE_SERVICE) : SC_MANAGER_CONNECT
+	);
+	if (batch.manager == NULL)
+	{
+		std::cout << "Windows Error error: '" 
+			      << GetLastError() 
+				  << "' opening the Service Control Manager." << std::endl;
+		return (int) batch.entries.size();
+	}
+
+	std::cout << (install ? "Installing " : "Uninstalling ") 
+		      << batch.entries.size() << " service(s)... " << std::endl;
+
+	size_t thread_count = min(batch.entries.size(), (size_t) BATCH_THREADS);
+	std::vector<HANDLE> threads;
+	for (size_t i = 0; thread_count > 1 && i < thread_count; i++)
+	{
+		HANDLE thread = (HANDLE) _beginthreadex(NULL, 0, batchWorker, &batch, 0, NULL);
+		if (thread)
+		{
+			threads.push_back(thread);
+		}
+	}
+
+	// Help out, or do it all for a single service or if no threads started:
+	//
+	batchWorker(&batch);
+
+	if (!threads.empty())
+	{
+		WaitForMultipleObjects((DWORD) threads.size(), &threads[0], TRUE, INFINITE);
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			CloseHandle(threads[i]);
+		}
+	}
+	CloseServiceHandle(batch.manager);
+
+	// The results, in the order the config files were given:
+	//
+	int failed = 0;
+	for (size_t i = 0; i < batch.entries.size(); i++)
+	{
+		const BatchEntry &entry = batch.entries[i];
+
+		if (!entry.loaded)
+		{
+			std::cout << "Error loading '" << entry.config_file.c_str() << "'!";
+			if (entry.error)
+			{
+				std::cout << " Windows Error error: '" << entry.error << "'.";
+			}
+			std::cout << std::endl;
+			failed++;
+		}
+		else if (!entry.ok)
+		{
+			std::cout << "Windows Error error: '" << entry.error 
+				      << (install ? "' installing '" : "' uninstalling '") 
+					  << entry.name.c_str() << "' from '" << entry.config_file.c_str() 
+					  << "'." << std::endl;
+			failed++;
+		}
+		else
+		{
+			std::cout << (install ? "Installed '" : "Uninstalled '") 
+				      << entry.name.c_str() << "' from '" << entry.config_file.c_str() 
+					  << "' ok." << std::endl;
+		}
+	}
+
+	std::cout << (batch.entries.size() - failed) << " of " << batch.entries.size() 
+		      << (install ? " service(s) installed ok." : " service(s) uninstalled ok.") 
+			  << std::endl;
+
+	return failed;
+}
+
+
 DWORD main(int argc, char *argv[])
 {
-	int rc = 0;
 	DWORD exitcode = 0;
 
 	// Command line argument setup
@@ -65,12 +296,15 @@ DWORD main(int argc, char *argv[])
 		SO_END_OF_OPTIONS                        // END
 	};
 
-	std::string config_file = "config.ini";
+	std::vector<std::string> config_files;
 	bool show_version = FALSE;
 	bool install_service = FALSE;
 	bool remove_service = FALSE;
 
-	CSimpleOpt args(argc, argv, g_rgOptions);
+	// Arguments can also be given in "@file" response files, for command
+	// lines which would be too long for Windows:
+	//
+	CSimpleOpt args(argc, argv, g_rgOptions, SO_O_RESPFILE);
 
 	while (args.Next()) 
 	{
@@ -95,7 +329,7 @@ DWORD main(int argc, char *argv[])
 			}
 			if (args.OptionId() == OPT_CFG) 
 			{	
-				config_file = args.OptionArg();
+				addConfigFiles(args.OptionArg(), config_files);
 			}
 			if (args.OptionId() == OPT_DEL) 
 			{	
@@ -109,6 +343,17 @@ DWORD main(int argc, char *argv[])
 		}
 	}
 
+	// Config files can also be given without -c, e.g. listed in an @file:
+	//
+	for (int i = 0; i < args.FileCount(); i++)
+	{
+		addConfigFiles(args.File(i), config_files);
+	}
+	if (config_files.empty())
+	{
+		addConfigFiles("config.ini", config_files);
+	}
+
 	if (show_version) 
 	{
 		std::cout << std::endl \
@@ -119,99 +364,32 @@ DWORD main(int argc, char *argv[])
 		return 0;
 	}
 
-	// Create the service instance and then decided based on 
-	// the command line whether we should install/remove/etc
-	// the service.
+	// Decide based on the command line whether we should 
+	// install/remove/etc the services.
 	//
-	service = new Service(
-		config_file,
-		serviceMain, 
-		serviceControl
-	);
-    
-	if(install_service)
-	{
-		// Test file read and get error code for accessing it to aid debugging:
-		HANDLE fd = NULL;
-
-		fd = CreateFile(
-			(LPCSTR) config_file.c_str(),
-			GENERIC_READ,
-			FILE_SHARE_READ,
-			NULL,
-			OPEN_EXISTING,
-			FILE_ATTRIBUTE_NORMAL,
-			NULL
-		);
-
-		if (fd == INVALID_HANDLE_VALUE)
-		{
-			std::cout << "Windows Error error: '" 
-				      << GetLastError() 
-					  << "' opening '" 
-					  << (const char *) config_file.c_str() 
-					  << "'." << std::endl;
-		}
-		CloseHandle(fd);
-
-		rc = service->setupFromConfiguration();
-		if (rc != NO_ERROR) 
-		{
-			// This means we are probably running in service mode. The init() 
-			// call will attempt to use the registry to recover and setup the 
-			// service. If this fails the service will be stopped correctly,
-			// which we can't do at this stage.
-			//
-			std::cout << "Error loading '" << (const char *) config_file.c_str() << "'!" << std::endl;
-			exitcode = 1;
-		}
-		else
-		{
-			// What we have configured / defaults set up:
-			//
-			std::cout << "config_file '" << (const char *) config_file.c_str() << "'." << std::endl;
-			std::cout << "service_name '" << service->getName() << "'." << std::endl;
-
-			std::cout << "Installing... " << std::endl;
-			service->install();
-			std::cout << "Installed ok." << std::endl;
-		}
-	}
-    else if(remove_service)
+	if(install_service || remove_service)
 	{
-		rc = service->setupFromConfiguration();
-		if (rc != NO_ERROR) 
+		if (runBatch(config_files, install_service) != 0)
 		{
-			// This means we are probably running in service mode. The init() 
-			// call will attempt to use the registry to recover and setup the 
-			// service. If this fails the service will be stopped correctly,
-			// which we can't do at this stage.
-			//
-			std::cout << "Error loading '" << (const char *) config_file.c_str() << "'!" << std::endl;
 			exitcode = 1;
 		}
-		else
-		{
-			// What we have configured / defaults set up:
-			//
-			std::cout << "config_file '" << (const char *) config_file.c_str() << "'." << std::endl;
-			std::cout << "service_name '" << service->getName() << "'." << std::endl;
-
-			std::cout << "Uninstalling... " << std::endl;
-	        service->unInstall();
-			std::cout << "Uninstalled ok." << std::endl;
-		}
 	}
 	else
 	{
 		// Default action which windows services will fall through too.
+		service = new Service(
+			config_files[0],
+			serviceMain, 
+			serviceControl
+		);
+
 		std::cout << "Starting '" << service->getName() << "'." << std::endl;
         service->startUp();
 		std::cout << "Started '" << service->getName() << "' ok." << std::endl;
 	    exitcode = service->getExitCode();
-	}
 
-    delete service;
+	    delete service;
+	}
 
 	std::cout << "Exit code: '" << exitcode << "'." << std::endl;
 
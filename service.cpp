@@ -7,6 +7,7 @@ Oisin Mulvihill
 
 */
 #include "SimpleIni.h"
+#include "SimpleIniSnapshot.h"
 
 #include "service.hpp"
 
@@ -38,9 +39,33 @@ Service::Service(
 	this->childStd_OUT_Write = NULL;
 	this->childStd_OUT_tmp = NULL;
 	this->log_file = NULL;
+	this->job_processes = NULL;
+	this->has_gui = false;
 
-	this->service_status.dwControlsAccepted = SERVICE_ACCEPT_STOP 
-		                                    | SERVICE_ACCEPT_SHUTDOWN;
+	// run() reports when the child process is up, see reportProgress():
+	//
+	this->ready_on_start = false;
+	this->ready_after = 0;
+	this->process_started = 0;
+	this->run_started = 0;
+	this->is_ready = false;
+	this->is_suspended = false;
+	this->restarts = 0;
+	ZeroMemory(status_text, sizeof(status_text));
+	ZeroMemory(description, sizeof(description));
+
+	// Config file watching, see startWatcher():
+	//
+	this->watcher_thread = NULL;
+	this->watcher_stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	this->config_size = 0;
+	this->config_hash = 0;
+
+	this->setAcceptedControls(
+		SERVICE_ACCEPT_STOP 
+		| SERVICE_ACCEPT_PAUSE_CONTINUE
+		| SERVICE_ACCEPT_SHUTDOWN
+	);
 
 	// Set up the config file and path and then read in the 
 	// configuration for the rest of the service setup:
@@ -74,6 +99,13 @@ Service::~Service( void )
 	{
 		CloseHandle(this->job_processes);
 	}
+
+	// Config watching clean up, the thread is stopped by run():
+	this->stopWatcher();
+	if (this->watcher_stop)
+	{
+		CloseHandle(this->watcher_stop);
+	}
 }
 
 
@@ -171,23 +203,91 @@ int Service::setupFromConfiguration(void)
 	return this->setupFromConfiguration(this->config_file);
 }
 
-int Service::setupFromConfiguration(const char *config_filename)
+// Load the configuration without changing anything outside this instance:
+// the snapshot isn't written and the service manager isn't asked to change
+// the description or desktop interaction. This is used when installing or
+// removing, where the service may not exist yet. installAid() sets the
+// description and desktop interaction once it does.
+//
+int Service::loadConfiguration(void)
 {
-	bool IsUtf8 = TRUE;
-	bool UseMultiKey = FALSE;
-	bool UseMultiLine = FALSE;
+	// set this name temporarily so loggin will work:
+	this->setName("ServiceStation");
 
-	CSimpleIniA ini(IsUtf8, UseMultiKey, UseMultiLine);
+	ServiceConfig config;
+	SI_SnapshotSource source;
+	CSimpleIniSnapshot snapshot;
 
-	SI_Error rc = ini.LoadFile(config_filename);
-	if (rc < 0) 
+	if (this->readConfiguration(this->config_file, snapshot, source, false) != 0
+		|| this->getConfiguration(snapshot, config) != 0)
 	{
-		char pTemp[MAX_PATH + 255] = "";
-		sprintf(pTemp, "Unable to load configuration from: '%s'.", config_filename);
-		this->logEvent(pTemp, S_ERROR);
 		return 1;
 	}
 
+	this->useConfiguration(config);
+	return NO_ERROR;
+}
+
+// Take on the settings from the config file. Nothing is passed on to the
+// service manager here, see setupFromConfiguration() and installAid().
+//
+void Service::useConfiguration(const ServiceConfig &config)
+{
+	// Set up the name of this service:
+	//
+	this->setName(config.name);
+
+	// The description to give the service manager:
+	//
+	copy_text(this->description, config.description, SERVICE_DESC_MAX_LENGTH, strlen(config.description));
+
+	// Get the GUI flag indicating desktop interaction:
+	//
+	this->has_gui = config.gui;
+
+	// Set up the command which is to be run as a service:
+	//
+	copy_text(this->process_name, config.command_line, NAME_PATH_MAX_LENGTH, strlen(config.command_line));
+
+	// Set up where the process is run from:
+	//
+	copy_text(this->working_path, config.working_dir, NAME_PATH_MAX_LENGTH, strlen(config.working_dir));
+
+	// The file to write the child processes STDOUT/ERR to:
+	//
+	copy_text(this->log_file_name, config.log_file, MAX_PATH, strlen(config.log_file));
+
+	// How long the child must stay up before we count as started:
+	//
+	this->ready_after = config.ready_after;
+}
+
+int Service::setupFromConfiguration(const char *config_filename)
+{
+	ServiceConfig config;
+	SI_SnapshotSource source;
+	CSimpleIniSnapshot *snapshot = new CSimpleIniSnapshot;
+
+	if (this->readConfiguration(config_filename, *snapshot, source) != 0
+		|| this->getConfiguration(*snapshot, config) != 0)
+	{
+		delete snapshot;
+		return 1;
+	}
+
+	// Make the configuration available to all threads:
+	//
+	this->config_snapshot.Replace(snapshot);
+
+	// Remember where the config came from so it can be watched for changes:
+	//
+	if (config_filename != this->config_file)
+	{
+		copy_text(this->config_file, config_filename, NAME_PATH_MAX_LENGTH, strlen(config_filename));
+	}
+	this->config_size = source.uSize;
+	this->config_hash = source.uHash;
+
 	// Create the process job which we'll use to contain our processes in:
 	// ref: http://msdn.microsoft.com/en-us/library/ms684161.aspx
 	//
@@ -200,78 +300,420 @@ int Service::setupFromConfiguration(const char *config_filename)
 	{
 		long err = getLastError();
 		char pTemp[1024];
-		sprintf(pTemp,"Error creating job container for job name '%s'! Windows Error code = %d\n", unique_name, err); 
+		sprintf(pTemp,"Error creating job container for job name '%s'! Windows Error code = %d\n", unique_name, err);
 		this->logEvent(pTemp, S_ERROR);
 		return 1;
 	}
 
-	// Set up the name of this service:
-	//
-	std::string service_name = ini.GetValue("service", "name", "ServiceStation");
-	this->setName(service_name);
+	this->useConfiguration(config);
 
-	// Set the service description based on what we find in the config file:
-	//
-	std::string description = ini.GetValue("service", "description", "ServiceStation Managed Service");
-	this->setDescription(description);
-
-	// Get the GUI flag indicating desktop interaction:
+	// The service is installed by now, so bring its description and desktop
+	// interaction up to date in case the config file changed while it was
+	// stopped:
 	//
-	this->has_gui = ini.GetValue("service", "gui", "no");
-	if (this->has_gui == "yes") 
+	this->setDescription(config.description);
+	if (this->has_gui)
 	{
 		this->interactiveState(true);
-		this->logEvent("This service has the GUI flag set (Desktop Interaction).", S_INFO);		
+		this->logEvent("This service has the GUI flag set (Desktop Interaction).", S_INFO);
 	}
 	else
 	{
-		this->has_gui = "no";
 		this->interactiveState(false);
 		this->logEvent("The service has no desktop interaction flag set.", S_INFO);
 	}
 
-	// Set up the command which is to be run as a service:
+	//this->log_file = CreateFile(
+	//   (LPCTSTR) (log_file_name),
+	//   GENERIC_READ | GENERIC_WRITE,
+	//   0,
+	//   NULL,
+	//   CREATE_NEW,
+	//   FILE_ATTRIBUTE_NORMAL,
+	//   NULL
+	//);
+
+	//if (this->log_file == INVALID_HANDLE_VALUE)
+	//{
+	//  this->log_file = NULL;
+	//  char pTemp[MAX_PATH + 255] = "";
+	//  sprintf(pTemp, "Unable to access/read: '%s'.", this->log_file_name);
+ //     this->logEvent(pTemp, S_ERROR);
+	//  //
+	//  //return 1;
+	//}
+
+	return NO_ERROR;
+}
+
+
+// Load the snapshot of the config file. This is used at start up and by
+// the config watcher thread, so it doesn't change the running service.
+// A rebuilt snapshot is only saved if save_snapshot is set. Returns 0 if
+// the snapshot was loaded.
+//
+int Service::readConfiguration(const char *config_filename, CSimpleIniSnapshot &snapshot, SI_SnapshotSource &source, bool save_snapshot)
+{
+	// A compiled snapshot of the configuration is kept next to the config
+	// file. While the config file is unchanged the snapshot is used as is
+	// and nothing needs to be parsed, otherwise it is rebuilt below. It is
+	// read rather than mapped, as it is kept while the file is rewritten.
+	//
+	std::string snapshot_file = std::string(config_filename) + ".snap";
+
+	SI_Error rc = CSimpleIniSnapshot::GetSource(config_filename, source);
+	if (rc < 0)
+	{
+		char pTemp[MAX_PATH + 255] = "";
+		sprintf(pTemp, "Unable to load configuration from: '%s'.", config_filename);
+		this->logEvent(pTemp, S_ERROR);
+		return 1;
+	}
+
+	if (snapshot.LoadFile(snapshot_file.c_str(), false) < 0 || !snapshot.IsCurrent(source))
+	{
+		bool IsUtf8 = TRUE;
+		bool UseMultiKey = FALSE;
+		bool UseMultiLine = FALSE;
+
+		CSimpleIniA ini(IsUtf8, UseMultiKey, UseMultiLine);
+
+		// Lines the parser has to skip are collected so that they can be
+		// reported, otherwise a typo leaves a setting at its default with
+		// no explanation:
+		//
+		SI_Diagnostics diagnostics;
+		ini.SetDiagnostics(&diagnostics);
+
+		// Only the [service] section is used, so stop parsing once it has been
+		// read rather than loading the whole file.
+		//
+		rc = ini.LoadFileSection(config_filename, "service");
+		if (rc < 0)
+		{
+			char pTemp[MAX_PATH + 255] = "";
+			if (ini.GetErrorOffset() != (size_t) -1)
+			{
+				sprintf(pTemp, "Unable to load configuration from: '%s', invalid UTF-8 at byte %lu.", config_filename, (unsigned long) ini.GetErrorOffset());
+			}
+			else
+			{
+				sprintf(pTemp, "Unable to load configuration from: '%s'.", config_filename);
+			}
+			this->logEvent(pTemp, S_ERROR);
+			return 1;
+		}
+
+		// All of the problems go in one event rather than one each:
+		//
+		if (!diagnostics.empty())
+		{
+			const size_t max_reported = 20;
+			char pTemp[MAX_PATH + 255] = "";
+			sprintf(pTemp, "Problems found in configuration '%s', the lines below were not read as expected:", config_filename);
+			std::string message = pTemp;
+
+			for (size_t i = 0; i < diagnostics.size() && i < max_reported; i++)
+			{
+				sprintf(pTemp, "\r\n  line %lu, column %lu: %s.", (unsigned long) diagnostics[i].uLine, (unsigned long) diagnostics[i].uColumn, SI_DiagReasonText(diagnostics[i].eReason));
+				message += pTemp;
+			}
+			if (diagnostics.size() > max_reported)
+			{
+				sprintf(pTemp, "\r\n  ... and %lu more.", (unsigned long) (diagnostics.size() - max_reported));
+				message += pTemp;
+			}
+			this->logEvent(message.c_str(), S_WARN);
+		}
+
+		std::string data;
+		rc = CSimpleIniSnapshot::Compile(ini, source, data);
+		if (rc >= 0)
+		{
+			rc = snapshot.Load(data.data(), data.size());
+		}
+		if (rc < 0)
+		{
+			char pTemp[MAX_PATH + 255] = "";
+			sprintf(pTemp, "Unable to compile configuration from: '%s'.", config_filename);
+			this->logEvent(pTemp, S_ERROR);
+			return 1;
+		}
+
+		// Not being able to write the snapshot only costs the next start
+		// another parse of the config file:
+		//
+		if (save_snapshot && snapshot.SaveFile(snapshot_file.c_str()) < 0)
+		{
+			char pTemp[MAX_PATH + 255] = "";
+			sprintf(pTemp, "Unable to write configuration snapshot: '%s'.", snapshot_file.c_str());
+			this->logEvent(pTemp, S_WARN);
+		}
+	}
+
+	return 0;
+}
+
+
+// Get the [service] settings from a configuration snapshot. Returns 0 if
+// the settings are usable.
+//
+int Service::getConfiguration(const CSimpleIniSnapshot &snapshot, ServiceConfig &config)
+{
+	// The values below point into the snapshot and are copied straight
+	// into the config buffers, so no temporary strings are needed.
 	//
-	std::string command_line = ini.GetValue("service", "command_line", "cmd.exe");
-	if (command_line.length() < 1)
+	const char *value;
+	size_t value_length;
+
+	value = snapshot.GetValue("service", "name", "ServiceStation", &value_length);
+	copy_text(config.name, value, SERVICE_NAME_MAX_LEN, value_length);
+
+	value = snapshot.GetValue("service", "description", "ServiceStation Managed Service", &value_length);
+	copy_text(config.description, value, SERVICE_DESC_MAX_LENGTH, value_length);
+
+	value = snapshot.GetValue("service", "gui", "no");
+	config.gui = (strcmp(value, "yes") == 0);
+
+	value = snapshot.GetValue("service", "command_line", "cmd.exe", &value_length);
+	if (value_length < 1)
 	{
 		this->logEvent("Error command_line was an empty string!", S_ERROR);
 		return 1;
 	}
-	copy_text(this->process_name, command_line.c_str(), NAME_PATH_MAX_LENGTH, command_line.length());
+	copy_text(config.command_line, value, NAME_PATH_MAX_LENGTH, value_length);
 
+	value = snapshot.GetValue("service", "working_dir", "c:\\", &value_length);
+	copy_text(config.working_dir, value, NAME_PATH_MAX_LENGTH, value_length);
 
-	// Set up where the process is run from:
+	value = snapshot.GetValue("service", "log_file", "child_out_err.log", &value_length);
+	copy_text(config.log_file, value, MAX_PATH, value_length);
+
+	value = snapshot.GetValue("service", "ready_after", "0");
+	config.ready_after = (DWORD) strtoul(value, NULL, 10) * 1000;
+
+	return 0;
+}
+
+
+// Start the thread watching the config file. If the watcher can't be
+// started the service carries on with the configuration it has.
+//
+void Service::startWatcher(void)
+{
+	if (!this->watcher_stop || this->watcher_thread)
+	{
+		return;
+	}
+
+	ResetEvent(this->watcher_stop);
+	this->watcher_thread = (HANDLE) _beginthreadex(NULL, 0, Service::configWatcher, this, 0, NULL);
+	if (!this->watcher_thread)
+	{
+		this->logEvent("Service::startWatcher: unable to start watching the config file, changes need a restart.", S_WARN);
+	}
+}
+
+void Service::stopWatcher(void)
+{
+	if (this->watcher_thread)
+	{
+		SetEvent(this->watcher_stop);
+		WaitForSingleObject(this->watcher_thread, INFINITE);
+		CloseHandle(this->watcher_thread);
+		this->watcher_thread = NULL;
+	}
+}
+
+unsigned __stdcall Service::configWatcher(void *service)
+{
+	return ((Service *) service)->watchConfiguration();
+}
+
+// Runs on the watcher thread. Waits for the config file to change, reads
+// it and replaces config_snapshot. The settings are applied by run(), so
+// nothing else in the running service is changed from here.
+//
+unsigned Service::watchConfiguration(void)
+{
+	// Watch the directory holding the config file, as an editor may
+	// replace the file rather than writing to it:
 	//
-	std::string working_dir = ini.GetValue("service", "working_dir", "c:\\");
-	copy_text(this->working_path, working_dir.c_str(), NAME_PATH_MAX_LENGTH, working_dir.length());
+	char config_dir[NAME_PATH_MAX_LENGTH];
+	copy_text(config_dir, this->config_file, NAME_PATH_MAX_LENGTH, strlen(this->config_file));
 
-	// The file to write the child processes STDOUT/ERR to:
+	char *dir_end = strrchr(config_dir, '\\');
+	if (!dir_end)
+	{
+		dir_end = strrchr(config_dir, '/');
+	}
+	if (dir_end)
+	{
+		*dir_end = '\0';
+	}
+	else
+	{
+		strcpy(config_dir, ".");
+	}
+
+	HANDLE change = FindFirstChangeNotification(
+		config_dir,
+		FALSE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE
+	);
+	if (change == INVALID_HANDLE_VALUE)
+	{
+		char pTemp[NAME_PATH_MAX_LENGTH + 255] = "";
+		sprintf(pTemp, "Service::watchConfiguration: unable to watch '%s', changes need a restart.", config_dir);
+		this->logEvent(pTemp, S_WARN);
+		return 1;
+	}
+
+	HANDLE handles[2] = { this->watcher_stop, change };
+	for (;;)
+	{
+		if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+		{
+			break;
+		}
+
+		// Editors often save in several steps, so wait until the directory
+		// has been quiet for a moment before reading the file:
+		//
+		DWORD wait;
+		do
+		{
+			FindNextChangeNotification(change);
+			wait = WaitForMultipleObjects(2, handles, FALSE, 500);
+		}
+		while (wait == WAIT_OBJECT_0 + 1);
+
+		if (wait != WAIT_TIMEOUT)
+		{
+			break;
+		}
+
+		// Other files in the directory (including the config snapshot)
+		// change as well, these leave the config file hash as it was. A
+		// missing file counts as one more version, so it's reported once:
+		//
+		SI_SnapshotSource source;
+		if (CSimpleIniSnapshot::GetSource(this->config_file, source) < 0)
+		{
+			source.uSize = (ULONGLONG) -1;
+			source.uHash = (ULONGLONG) -1;
+		}
+		if (source.uSize == this->config_size && source.uHash == this->config_hash)
+		{
+			continue;
+		}
+
+		// Remembered even if the file is rejected, so each bad edit is only
+		// reported once rather than on every write in the directory:
+		//
+		this->config_size = source.uSize;
+		this->config_hash = source.uHash;
+
+		ServiceConfig config;
+		CSimpleIniSnapshot *snapshot = new CSimpleIniSnapshot;
+
+		if (this->readConfiguration(this->config_file, *snapshot, source) != 0
+			|| this->getConfiguration(*snapshot, config) != 0)
+		{
+			delete snapshot;
+			this->logEvent("Service::watchConfiguration: keeping the running configuration.", S_WARN);
+			continue;
+		}
+
+		// Readers of the old configuration finish with it before this
+		// returns, new readers get the new one:
+		//
+		this->config_snapshot.Replace(snapshot);
+		this->postControl(SERVICE_CONTROL_PARAMCHANGE);
+	}
+
+	FindCloseChangeNotification(change);
+	return 0;
+}
+
+// Called from run() when the watcher has read a changed config file. Only
+// the settings which differ are applied, and the child process is only
+// restarted if it would be run differently.
+//
+void Service::applyConfiguration(void)
+{
+	ServiceConfig config;
+	bool restart = false;
+	char pTemp[NAME_PATH_MAX_LENGTH + 255] = "";
+	int rc = 1;
+
+	// The settings are copied out so the snapshot isn't held while the
+	// process is restarted:
 	//
-	std::string the_log_file = ini.GetValue("service", "log_file", "child_out_err.log");
-	copy_text(this->log_file_name, the_log_file.c_str(), MAX_PATH, the_log_file.length());
+	{
+		CSimpleIniSharedSnapshot::Reader reader(this->config_snapshot);
+		if (reader.Get())
+		{
+			rc = this->getConfiguration(*reader.Get(), config);
+		}
+	}
+	if (rc != 0)
+	{
+		return;
+	}
 
-	//this->log_file = CreateFile(
-	//   (LPCTSTR) (log_file_name), 
-	//   GENERIC_READ | GENERIC_WRITE, 
-	//   0, 
-	//   NULL, 
-	//   CREATE_NEW, 
-	//   FILE_ATTRIBUTE_NORMAL, 
-	//   NULL
-	//); 
+	// The service is registered with the SCM under its name, so a new
+	// name needs the service to be reinstalled:
+	//
+	if (strcmp(config.name, this->getName()) != 0)
+	{
+		sprintf(pTemp, "Service::applyConfiguration: the name '%s' can't be used until the service is reinstalled.", config.name);
+		this->logEvent(pTemp, S_WARN);
+	}
 
-	//if (this->log_file == INVALID_HANDLE_VALUE) 
-	//{
-	//  this->log_file = NULL;
-	//  char pTemp[MAX_PATH + 255] = "";
-	//  sprintf(pTemp, "Unable to access/read: '%s'.", this->log_file_name);
- //     this->logEvent(pTemp, S_ERROR);
-	//  //
-	//  //return 1;
-	//}	
+	if (strcmp(config.description, this->description) != 0)
+	{
+		this->setDescription(config.description);
+	}
 
-	return NO_ERROR;
+	if (config.gui != this->has_gui)
+	{
+		this->has_gui = config.gui;
+		this->interactiveState(this->has_gui);
+		restart = true;
+	}
+
+	if (strcmp(config.command_line, this->process_name) != 0)
+	{
+		copy_text(this->process_name, config.command_line, NAME_PATH_MAX_LENGTH, strlen(config.command_line));
+		restart = true;
+	}
+
+	if (strcmp(config.working_dir, this->working_path) != 0)
+	{
+		copy_text(this->working_path, config.working_dir, NAME_PATH_MAX_LENGTH, strlen(config.working_dir));
+		restart = true;
+	}
+
+	// Not used by the running process (see setupFromConfiguration):
+	//
+	copy_text(this->log_file_name, config.log_file, MAX_PATH, strlen(config.log_file));
+
+	if (restart)
+	{
+		this->logEvent("Service::applyConfiguration: restarting the process with the new configuration.", S_INFO);
+		this->stopProcess();
+
+		// While paused run() starts it when we continue:
+		if (!this->is_suspended)
+		{
+			this->startProcess();
+		}
+	}
+	else
+	{
+		this->logEvent("Service::applyConfiguration: configuration reloaded, the process was left running.", S_INFO);
+	}
 }
 
 
@@ -291,25 +733,17 @@ DWORD Service::init(DWORD ac, LPTSTR *av)
     char szFilePath[_MAX_PATH];
     ::GetModuleFileName(NULL, szFilePath, sizeof(szFilePath));
 
-	char reg_start[] = "SOFTWARE\\StationService\\Services\\";
-	int reg_start_length = strlen(reg_start);
-	char reg_end[] = "\\setup";
-	int reg_end_length = strlen(reg_start);
-	int max_exe_length = REG_PATH_MAX_LENGTH - (reg_start_length+reg_end_length);
 	memset(&(this->registry_path[0]), 0, REG_PATH_MAX_LENGTH);
 
 	// Before setting up the registry key check we can fit in the space for it:
 	//
-	if (_MAX_PATH >= max_exe_length) 
+	if (!this->setRegistryPath(szFilePath, true)) 
 	{
 		char pTemp[255] = "";
 		sprintf(pTemp, "Service::init(): Cannot recover the registry as the exe path and name are too large!");
 		this->logEvent(pTemp, S_ERROR);
 		return 1;
 	}
-	strcpy(registry_path, reg_start);	
-	strcat(registry_path, szFilePath);							
-	strcat(registry_path, reg_end);								
 
 	HKEY service_key;
 	 
@@ -320,6 +754,19 @@ DWORD Service::init(DWORD ac, LPTSTR *av)
 		KEY_READ,
 		&service_key 
 	);
+	if (rc != ERROR_SUCCESS)
+	{
+		// Installed before the key had the service name in it:
+		//
+		this->setRegistryPath(szFilePath, false);
+		rc = RegOpenKeyEx(
+			HKEY_LOCAL_MACHINE, 
+			registry_path, 
+			0, 
+			KEY_READ,
+			&service_key 
+		);
+	}
 	if (rc == ERROR_SUCCESS) 
 	{
         // Set the config file this service must use when it starts up.
@@ -364,7 +811,9 @@ DWORD Service::init(DWORD ac, LPTSTR *av)
 int Service::run( void )
 {
 	this->is_running = true;
+	this->run_started = GetTickCount();
 	this->startProcess();
+	this->startWatcher();
 
     while(this->is_running)
 	{
@@ -377,8 +826,13 @@ int Service::run( void )
 		{
 			if(dwCode != STILL_ACTIVE)
 			{
-				if(this->startProcess())
+				this->publishProcess(SERVICE_STOPPED);
+
+				// While paused it's restarted when we continue:
+				if(!this->is_suspended && this->startProcess())
 				{
+					this->restarts++;
+					this->publishProcess(SERVICE_RUNNING);
 					this->logEvent("run: Restarted process ok.\n", S_WARN);
 				}
 			}
@@ -395,60 +849,160 @@ int Service::run( void )
 		//
 		//this->readWriteOutErrFromPipe();
 
-		// Wait a bit so we're not hogging CPU time too much.
-		Sleep(1000);
+		this->reportProgress();
+
+		// Wait a bit so we're not hogging CPU time too much, but check in
+		// with the service manager's watchdog often enough. Controls and
+		// config file changes wake us early and are dealt with here.
+		//
+		DWORD wait = 1000;
+		DWORD watchdog_interval = this->manager->getWatchdogInterval();
+		if (watchdog_interval && watchdog_interval / 2 < wait)
+		{
+			wait = watchdog_interval / 2;
+		}
+
+		this->waitForControl(wait);
 	}
     
 	// Ok, time to exit tell out child process to stop as well.
+	this->stopWatcher();
 	this->stopProcess();
 
 	return NO_ERROR; 
 }
 
-// Set description
-bool Service::setDescription(std::string description)
+// Called each time round the run() loop. Until the child process has
+// been running for ready_after we are still starting, then we are
+// ready. If that doesn't happen by the start timeout the start has
+// failed and run() ends, rather than asking for more time forever. The
+// watchdog is told we're alive and the status summary is updated when
+// it changes.
+//
+void Service::reportProgress(void)
 {
-    bool rc = false;
-	SERVICE_DESCRIPTION sd;
+	DWORD code = 0;
+	bool child_running = (this->process_info 
+		&& ::GetExitCodeProcess(this->process_info->hProcess, &code) 
+		&& code == STILL_ACTIVE);
 
+	if (!this->is_ready && !this->is_suspended)
+	{
+		DWORD start_timeout = this->ready_after * START_TIMEOUT_FACTOR;
+		if (start_timeout < START_TIMEOUT_MIN)
+		{
+			start_timeout = START_TIMEOUT_MIN;
+		}
 
-    // Open the Service Control Manager
-    SC_HANDLE service_manager = ::OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
-    if (service_manager) 
-    {
-        // Try to open the service
-        SC_HANDLE service = ::OpenService(
-			service_manager, 
-			this->service_name, 
-			SERVICE_CHANGE_CONFIG
-		);
-        if (service) 
-        {
-			// Changing service config, ref:
-			//    http://msdn.microsoft.com/en-us/library/ms682006(VS.85).aspx
+		if (child_running && GetTickCount() - this->process_started >= this->ready_after)
+		{
+			this->is_ready = this->reportReady();
+		}
+		else if (GetTickCount() - this->run_started >= start_timeout)
+		{
+			char pTemp[NAME_PATH_MAX_LENGTH + 255];
+			sprintf(pTemp, "Service::reportProgress: '%s' didn't keep running for %lu s within %lu s, the start has failed.",
+				this->process_name,
+				(unsigned long) (this->ready_after / 1000),
+				(unsigned long) (start_timeout / 1000)
+			);
+			this->logEvent(pTemp, S_ERROR);
+
+			// Unless a stop got in first, report the failure. service()
+			// reports SERVICE_STOPPED with the exit code once run() is done:
 			//
-			char szDesc[SERVICE_DESC_MAX_LENGTH];
-		
-			copy_text(szDesc, description.c_str(), SERVICE_DESC_MAX_LENGTH, description.length());
-			sd.lpDescription = szDesc;
+			ServiceStatusRecord &record = this->beginStatusUpdate();
+			if (record.status.dwCurrentState == SERVICE_START_PENDING)
+			{
+				record.status.dwWin32ExitCode = ERROR_SERVICE_START_HANG;
+				record.status.dwCurrentState = SERVICE_STOP_PENDING;
+				record.status.dwCheckPoint = 1;
+				record.status.dwWaitHint = CONTROL_WAIT_HINT;
+				this->manager->setStatus(record.status);
+			}
+			this->endStatusUpdate();
+			this->is_running = false;
+		}
+		else
+		{
+			this->reportStarting(2000);
+		}
+	}
 
-			char pTemp[SERVICE_DESC_MAX_LENGTH + 255] = "";
-			sprintf(pTemp, "Service::setDescription(): set to '%s'!", description.c_str());
-			this->logEvent(pTemp, S_WARN);
+	this->manager->watchdog();
 
-			// Now attempt to change the service type:
-			rc = ChangeServiceConfig2(
-				service,
-				SERVICE_CONFIG_DESCRIPTION,
-				&sd
-			);
+	// Count everything in our job, the child may have started others:
+	//
+	JOBOBJECT_BASIC_ACCOUNTING_INFORMATION accounting;
+	ZeroMemory(&accounting, sizeof(accounting));
+	if (this->job_processes)
+	{
+		QueryInformationJobObject(
+			this->job_processes, 
+			JobObjectBasicAccountingInformation, 
+			&accounting, 
+			sizeof(accounting), 
+			NULL
+		);
+	}
 
-            ::CloseServiceHandle(service);
-        }
-        ::CloseServiceHandle(service_manager);
-    }
-    
-    return rc;
+	char text[sizeof(this->status_text)];
+	sprintf(text, "%s '%s': %lu process(es) up, %lu restart(s).",
+		this->is_suspended ? "Paused" : this->is_ready ? "Running" : "Starting",
+		this->process_name,
+		(unsigned long) accounting.ActiveProcesses,
+		this->restarts
+	);
+	if (strcmp(text, this->status_text) != 0)
+	{
+		strcpy(this->status_text, text);
+		this->manager->setStatusText(this->status_text);
+
+		ServiceStatusRecord &record = this->beginStatusUpdate();
+		record.process_count = accounting.ActiveProcesses;
+		this->endStatusUpdate();
+	}
+}
+
+// Update the process part of the status record, see getStatusRecord().
+// started: the process has just been started. The exit code is kept once
+// the process has stopped.
+//
+void Service::publishProcess(DWORD state, bool started)
+{
+	ServiceStatusRecord &record = this->beginStatusUpdate();
+	record.process_state = state;
+	record.restarts = this->restarts;
+	if (started)
+	{
+		record.process_started = time(NULL);
+	}
+
+	if (this->process_info)
+	{
+		DWORD code = 0;
+		record.process_id = this->process_info->dwProcessId;
+		if (state == SERVICE_STOPPED
+			&& ::GetExitCodeProcess(this->process_info->hProcess, &code) 
+			&& code != STILL_ACTIVE)
+		{
+			record.last_exit_code = code;
+		}
+	}
+	this->endStatusUpdate();
+}
+
+// Set description
+bool Service::setDescription(const char *description)
+{
+	// Kept so a reloaded config only updates the SCM when it changed:
+	copy_text(this->description, description, SERVICE_DESC_MAX_LENGTH, strlen(description));
+
+	char pTemp[SERVICE_DESC_MAX_LENGTH + 255] = "";
+	sprintf(pTemp, "Service::setDescription(): set to '%s'!", this->description);
+	this->logEvent(pTemp, S_WARN);
+
+    return (this->manager->setDescription(this->service_name, this->description) == NO_ERROR);
 }
 
 
@@ -460,65 +1014,166 @@ bool Service::setDescription(std::string description)
 //
 bool Service::interactiveState(bool interactive_state)
 {
-    bool rc = false;
+	if (interactive_state)
+	{
+		this->logEvent("interactiveState: ON.", S_INFO);
+	}
+	else
+	{
+		this->logEvent("interactiveState: OFF.", S_INFO);
+	}
 
-	// Set up with default no interaction:
-	DWORD service_type = SERVICE_WIN32_OWN_PROCESS;
+    return (this->manager->setInteractive(this->service_name, interactive_state) == NO_ERROR);
+}
 
-    // Open the Service Control Manager
-    SC_HANDLE service_manager = ::OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
-    if (service_manager) 
-    {
-        // Try to open the service
-        SC_HANDLE service = ::OpenService(
-			service_manager, 
-			this->service_name, 
-			SERVICE_CHANGE_CONFIG
-		);
-        if (service) 
-        {
-			if (interactive_state)
+
+// Called by windows to stop the service running. run() stops the child
+// process on its way out.
+//
+void Service::onStop( void )
+{
+	this->logEvent("Service::onStop - Exit time", S_INFO);
+	this->is_running = false;
+}
+
+// The watcher has read a changed config file:
+//
+void Service::onParamChange( void )
+{
+	this->applyConfiguration();
+}
+
+
+// Freeze the whole process tree, so it uses no CPU but keeps its state
+// for when we continue. If any of it can't be frozen none of it is.
+//
+DWORD Service::onPause( void )
+{
+	// Suspends count up, so never suspend twice for one continue:
+	if (this->is_suspended)
+	{
+		return NO_ERROR;
+	}
+
+	DWORD rc = this->suspendJob(true);
+	if (rc != NO_ERROR)
+	{
+		this->suspendJob(false);
+
+		char pTemp[1024];
+		sprintf(pTemp, "Service::onPause: unable to suspend the processes, carrying on running. Error code = %lu", rc);
+		this->logEvent(pTemp, S_WARN);
+		return rc;
+	}
+
+	this->is_suspended = true;
+	this->publishProcess(SERVICE_PAUSED);
+	this->logEvent("Service::onPause: processes suspended.", S_INFO);
+	return NO_ERROR;
+}
+
+DWORD Service::onContinue( void )
+{
+	if (!this->is_suspended)
+	{
+		return NO_ERROR;
+	}
+
+	DWORD rc = this->suspendJob(false);
+	if (rc != NO_ERROR)
+	{
+		char pTemp[1024];
+		sprintf(pTemp, "Service::onContinue: unable to resume all the processes. Error code = %lu", rc);
+		this->logEvent(pTemp, S_WARN);
+		return rc;
+	}
+
+	this->is_suspended = false;
+	this->publishProcess(SERVICE_RUNNING);
+	this->logEvent("Service::onContinue: processes resumed.", S_INFO);
+	return NO_ERROR;
+}
+
+// Suspend or resume every process in our job. A process can start another
+// while we go through them, so when suspending keep going until there
+// are no new ones. Processes which have exited meanwhile are skipped.
+//
+DWORD Service::suspendJob(bool suspend)
+{
+	std::vector<ULONG_PTR> done;
+	DWORD rc = NO_ERROR;
+
+	for (;;)
+	{
+		std::vector<ULONG_PTR> pids;
+		if (!this->getJobProcesses(pids))
+		{
+			return GetLastError();
+		}
+
+		bool found = false;
+		for (size_t i = 0; i < pids.size(); i++)
+		{
+			if (std::find(done.begin(), done.end(), pids[i]) != done.end())
 			{
-				// set up interactive flags:
-				service_type = SERVICE_WIN32_OWN_PROCESS | SERVICE_INTERACTIVE_PROCESS;
-				this->logEvent("interactiveState: ON.", S_INFO);
+				continue;
 			}
-			else
+			done.push_back(pids[i]);
+			found = true;
+
+			DWORD err = suspend_process((DWORD) pids[i], suspend);
+			if (err != NO_ERROR && err != ERROR_INVALID_PARAMETER)
 			{
-				this->logEvent("interactiveState: OFF.", S_INFO);
+				rc = err;
 			}
+		}
 
-			// Now attempt to change the service type:
-			rc = ChangeServiceConfig(
-				service,
-				service_type,
-				SERVICE_NO_CHANGE,
-				SERVICE_NO_CHANGE,
-				NULL,
-				NULL,
-				NULL,
-				NULL,
-				NULL,
-				NULL,
-				NULL
-			);
+		if (!found || !suspend || rc != NO_ERROR)
+		{
+			break;
+		}
+	}
 
-            ::CloseServiceHandle(service);
-        }
-        ::CloseServiceHandle(service_manager);
-    }
-    
-    return rc;
+	return rc;
 }
 
-
-// Called by windows to stop the service running.
+// The ids of the processes in our job.
 //
-void Service::onStop( void )
+bool Service::getJobProcesses(std::vector<ULONG_PTR> &pids)
 {
-	this->logEvent("Service::onStop - Exit time", S_INFO);
-	this->is_running = false;
-	this->stopProcess();
+	pids.clear();
+	if (!this->job_processes)
+	{
+		return true;
+	}
+
+	DWORD room = 64;
+	for (;;)
+	{
+		std::vector<char> buffer(sizeof(JOBOBJECT_BASIC_PROCESS_ID_LIST) + room * sizeof(ULONG_PTR));
+		JOBOBJECT_BASIC_PROCESS_ID_LIST *list = (JOBOBJECT_BASIC_PROCESS_ID_LIST *) &buffer[0];
+
+		if (!QueryInformationJobObject(
+				this->job_processes, 
+				JobObjectBasicProcessIdList, 
+				list, 
+				(DWORD) buffer.size(), 
+				NULL
+			) && GetLastError() != ERROR_MORE_DATA)
+		{
+			return false;
+		}
+
+		if (list->NumberOfProcessIdsInList < list->NumberOfAssignedProcesses)
+		{
+			// More started since we asked, leave some spare:
+			room = list->NumberOfAssignedProcesses + 16;
+			continue;
+		}
+
+		pids.assign(list->ProcessIdList, list->ProcessIdList + list->NumberOfProcessIdsInList);
+		return true;
+	}
 }
 
 
@@ -598,7 +1253,7 @@ bool Service::startProcess()
     ZeroMemory(this->process_info, sizeof(PROCESS_INFORMATION));
 
 	// Enable desktop interaction dependant on what the sets in the config file:
-	if (this->has_gui == "yes") 
+	if (this->has_gui) 
 	{
 		// SW_SHOWNORAL ref: http://msdn.microsoft.com/en-us/library/ms633548(VS.85).aspx
 		si.wShowWindow = SW_SHOWNORMAL;
@@ -634,6 +1289,10 @@ bool Service::startProcess()
 		this->logEvent(pTemp, S_INFO);
         rc = TRUE;
 
+		// For the readiness check in reportProgress():
+		this->process_started = GetTickCount();
+		this->publishProcess(SERVICE_RUNNING, true);
+
 		job_assign = AssignProcessToJobObject(this->job_processes, this->process_info->hProcess);
 		if(!(job_assign))
 		{
@@ -683,6 +1342,12 @@ void Service::stopProcess()
 
 	if(this->process_info)
 	{
+		// A suspended process can't exit politely:
+		if (this->is_suspended)
+		{
+			this->suspendJob(false);
+		}
+
 		// Post a WM_QUIT message first, attempting to politely ask it to exit:
 		PostThreadMessage(this->process_info->dwThreadId, WM_QUIT, 0, 0);
 		Sleep(4000);
@@ -693,6 +1358,10 @@ void Service::stopProcess()
 		// Shutdown all running processes inside our job:
 		//
 		TerminateJobObject(this->job_processes, 0);
+
+		// Give it a moment to go so its exit code is recorded:
+		WaitForSingleObject(this->process_info->hProcess, 1000);
+		this->publishProcess(SERVICE_STOPPED);
 	}
 }
 
@@ -704,31 +1373,19 @@ void Service::stopProcess()
 void Service::installAid(char *exe_path)
 {
 	long err_code = 0;
-	char reg_start[] = "SOFTWARE\\StationService\\Services\\";
-	int reg_start_length = strlen(reg_start);
-	char reg_end[] = "\\setup";
-	int reg_end_length = strlen(reg_start);
-	int exe_length = strlen(exe_path);
-	int max_exe_length = REG_PATH_MAX_LENGTH - (reg_start_length+reg_end_length);
 
 	// Before setting up the registry key check we can fit in the 
 	// space for it:
 	//
-	if (exe_length >= max_exe_length) 
+	if (!this->setRegistryPath(exe_path, true)) 
 	{
 		char pTemp[NAME_PATH_MAX_LENGTH + 255] = "";
-		sprintf(pTemp,"Service::installAid: exe path '%s' is too big. It must be >= %d.\n", exe_path, max_exe_length); 
+		sprintf(pTemp,"Service::installAid: exe path '%s' is too big.\n", exe_path); 
 	    this->logEvent(pTemp, S_ERROR);
 
 		return;
 	}
 
-	// Ok, it'll fit:
-	//
-	strcpy(registry_path, reg_start);	
-	strcat(registry_path, exe_path);							
-	strcat(registry_path, reg_end);								
-
 	HKEY service_key;
 	DWORD rc = 0;
 	DWORD disposition = 0;
@@ -780,14 +1437,108 @@ void Service::installAid(char *exe_path)
 		); 
 		this->logEvent(pTemp, S_ERROR);
 	}
+
+	// The service didn't exist when the configuration was loaded so set
+	// up the description and desktop interaction now. setDescription()
+	// stores the description it is given so pass it a copy:
+	//
+	char desc[SERVICE_DESC_MAX_LENGTH];
+	strcpy(desc, this->description);
+	this->setDescription(desc);
+	this->interactiveState(this->has_gui);
 }
 
 
-// Uninstall the registry config for this service instance.
-//
+// Uninstall the registry config for this service instance. The exe
+// path key is left as other services may be using it.
 //
 void Service::uninstallAid(void)
 {
+    char szFilePath[_MAX_PATH];
+    ::GetModuleFileName(NULL, szFilePath, sizeof(szFilePath));
+
+	if (this->setRegistryPath(szFilePath, true))
+	{
+		RegDeleteKey(HKEY_LOCAL_MACHINE, this->registry_path);
+
+		// Then the service name key it was in:
+		*strrchr(this->registry_path, '\\') = '\0';
+		RegDeleteKey(HKEY_LOCAL_MACHINE, this->registry_path);
+	}
+
+	// An older version may have installed this service under the exe path
+	// key alone. Only one service could be installed that way per exe, so
+	// the key is removed only if it points at our config file:
+	//
+	if (this->setRegistryPath(szFilePath, false))
+	{
+		HKEY service_key;
+		DWORD rc = RegOpenKeyEx(
+			HKEY_LOCAL_MACHINE, 
+			registry_path, 
+			0, 
+			KEY_READ,
+			&service_key 
+		);
+
+		if (rc == ERROR_SUCCESS)
+		{
+			DWORD keytype;
+			char data[REG_PATH_MAX_LENGTH] = "";
+			DWORD len = REG_PATH_MAX_LENGTH - 1;
+
+			rc = RegQueryValueEx(
+				service_key,
+				"config_file",
+				NULL,
+				&keytype,
+				(BYTE*)&data,
+				&len
+			);
+			RegCloseKey(service_key);
+
+			if (rc == ERROR_SUCCESS && _stricmp(data, this->config_file) == 0)
+			{
+				RegDeleteKey(HKEY_LOCAL_MACHINE, this->registry_path);
+
+				char pTemp[REG_PATH_MAX_LENGTH + 255] = "";
+				sprintf(pTemp, "Service::uninstallAid: removed the old registry key '%s'.", registry_path);
+				this->logEvent(pTemp, S_INFO);
+			}
+		}
+	}
+}
+
+
+// The registry key holding this instances setup. It is based on the
+// exe path and the service name, so several services can run from
+// the same exe. Services installed by older versions only have the
+// exe path. Returns false if the key would be too long.
+//
+bool Service::setRegistryPath(const char *exe_path, bool per_service)
+{
+	char reg_start[] = "SOFTWARE\\StationService\\Services\\";
+	char reg_end[] = "\\setup";
+	size_t length = strlen(reg_start) + strlen(exe_path) + strlen(reg_end);
+
+	if (per_service)
+	{
+		length += 1 + strlen(this->service_name);
+	}
+	if (length >= REG_PATH_MAX_LENGTH)
+	{
+		return false;
+	}
+
+	strcpy(this->registry_path, reg_start);
+	strcat(this->registry_path, exe_path);
+	if (per_service)
+	{
+		strcat(this->registry_path, "\\");
+		strcat(this->registry_path, this->service_name);
+	}
+	strcat(this->registry_path, reg_end);
+	return true;
 }
 
 
@@ -9,7 +9,11 @@ Oisin Mulvihill
 #ifndef _the_service_h_
 #define _the_service_h_
 
+#include <vector>
+#include <algorithm>
+
 #include "servicebase.hpp"
+#include "SimpleIniSnapshot.h"
 
 #define NAME_PATH_MAX_LENGTH 2048
 #define REG_PATH_MAX_LENGTH 2048
@@ -17,6 +21,11 @@ Oisin Mulvihill
 
 
 #define BUFSIZE 4096 
+
+// Give up starting if the child hasn't kept running for ready_after by
+// START_TIMEOUT_FACTOR * ready_after, but no sooner than START_TIMEOUT_MIN ms:
+#define START_TIMEOUT_FACTOR 3
+#define START_TIMEOUT_MIN 60000
  
 // logEvent: levels
 //
@@ -24,6 +33,19 @@ Oisin Mulvihill
 #define S_WARN 2
 #define S_ERROR 3
 
+// The settings read from the [service] section of the config file:
+//
+struct ServiceConfig
+{
+	char name[SERVICE_NAME_MAX_LEN];
+	char description[SERVICE_DESC_MAX_LENGTH];
+	char command_line[NAME_PATH_MAX_LENGTH];
+	char working_dir[NAME_PATH_MAX_LENGTH];
+	char log_file[MAX_PATH];
+	bool gui;
+	DWORD ready_after;
+};
+
 class Service : public ServiceBase
 {
     HANDLE childStd_ERR_Read;
@@ -41,8 +63,43 @@ class Service : public ServiceBase
 	//
 	boolean is_running;
 
-	// Contains yes or no to indicate whether the service interacts with the desktop:
-	std::string has_gui;
+	// Whether the service interacts with the desktop (gui = yes):
+	bool has_gui;
+
+	// Readiness: how long (ms) the child must keep running before the
+	// service is reported as started, when it was last started and when
+	// run() started (for the start timeout, see reportProgress()):
+	//
+	DWORD ready_after;
+	DWORD process_started;
+	DWORD run_started;
+	bool is_ready;
+
+	// Paused: every process in job_processes is suspended and no new child
+	// is started until we continue.
+	bool is_suspended;
+
+	// For the status summary:
+	unsigned long restarts;
+	char status_text[NAME_PATH_MAX_LENGTH + 255];
+
+	// The description currently set on the service:
+	char description[SERVICE_DESC_MAX_LENGTH];
+
+	// The current configuration. Any thread can read it without locking,
+	// the watcher thread replaces it when the config file changes:
+	//
+	CSimpleIniSharedSnapshot config_snapshot;
+
+	// Config file watching. The watcher posts SERVICE_CONTROL_PARAMCHANGE
+	// after replacing config_snapshot so that run() applies the new settings:
+	//
+	HANDLE watcher_thread;
+	HANDLE watcher_stop;
+
+	// Identity of the config file the running settings came from:
+	ULONGLONG config_size;
+	ULONGLONG config_hash;
 
 	// Where this instances configuration is stored in the registry
 	char registry_path[REG_PATH_MAX_LENGTH];
@@ -77,7 +134,7 @@ protected:
     int run();
 
 	// Set a note about what this service does:
-	bool setDescription(std::string description);
+	bool setDescription(const char *description);
 
 	// true: enable desktop interaction, false: disable interaction.
 	bool interactiveState(bool interactive_state);
@@ -85,6 +142,17 @@ protected:
 	// Called when its time to stop the service runing.
     void onStop(void);
 
+	// Called when the config file has changed.
+	void onParamChange(void);
+
+	// Freeze / thaw the child processes.
+	DWORD onPause(void);
+	DWORD onContinue(void);
+
+	// Suspend or resume every process in job_processes.
+	DWORD suspendJob(bool suspend);
+	bool getJobProcesses(std::vector<ULONG_PTR> &pids);
+
 	// Start the child process running.
 	bool startProcess(void);
 
@@ -95,6 +163,30 @@ protected:
 	int setupFromConfiguration(void);
 	int setupFromConfiguration(const char *config_filename);
 
+	// Take on the settings from the config file.
+	void useConfiguration(const ServiceConfig &config);
+
+	// Load the configuration snapshot for the config file.
+	int readConfiguration(const char *config_filename, CSimpleIniSnapshot &snapshot, SI_SnapshotSource &source, bool save_snapshot = true);
+
+	// Get the [service] settings from a configuration snapshot.
+	int getConfiguration(const CSimpleIniSnapshot &snapshot, ServiceConfig &config);
+
+	// Start / stop the thread which watches the config file for changes.
+	void startWatcher(void);
+	void stopWatcher(void);
+	static unsigned __stdcall configWatcher(void *service);
+	unsigned watchConfiguration(void);
+
+	// Apply the settings the watcher found which differ from those in use.
+	void applyConfiguration(void);
+
+	// Report readiness / liveness / a status summary to the service manager.
+	void reportProgress(void);
+
+	// Record the child process's state in the status record.
+	void publishProcess(DWORD state, bool started = false);
+
 	// Log a message to the window event log.
 	void logEvent(const char *message, int level);
 
@@ -105,6 +197,9 @@ protected:
 	void installAid(char *exe_path);
 	void uninstallAid(void);
 
+	// Set registry_path to this instances key, see installAid().
+	bool setRegistryPath(const char *exe_path, bool per_service);
+
 public:
 	Service(
 		std::string config_file, 
@@ -113,6 +208,10 @@ public:
 	);
 
 	~Service(void);
+
+	// Load the configuration for install / uninstall. Unlike
+	// setupFromConfiguration() nothing is written or sent to the SCM.
+	int loadConfiguration(void);
 };
 
 #endif
@@ -6,7 +6,7 @@ Oisin Mulvihill
 2009-04-20
 
 */
-#include "ServiceBase.hpp"
+#include "servicebase.hpp"
 
 // Copy text safely into a limited amount of space:
 void copy_text(char *dest, const char *src, int dest_max, int src_length)
@@ -49,19 +49,27 @@ ServiceBase::ServiceBase(
     memset(this->service_name, 0, sizeof(this->service_name));
     this->is_started = false;
     this->is_paused = false;
-    memset(&this->dispatch_table[0], 0, sizeof(this->dispatch_table));
-    memset(&this->service_status, 0, sizeof(SERVICE_STATUS));
-    this->service_stat = 0;
-
-    this->service_status.dwServiceType = SERVICE_WIN32; 
-    this->service_status.dwCurrentState = SERVICE_START_PENDING; 
-    this->service_status.dwControlsAccepted = SERVICE_ACCEPT_STOP 
-                                            | SERVICE_ACCEPT_PAUSE_CONTINUE
-                                            | SERVICE_ACCEPT_SHUTDOWN; 
+    memset(&this->status_record, 0, sizeof(ServiceStatusRecord));
+
+    this->manager = ServiceManager::create();
+    this->owns_manager = true;
+    this->ready_on_start = true;
+
+    this->status_record.status.dwServiceType = SERVICE_WIN32; 
+    this->status_record.status.dwCurrentState = SERVICE_START_PENDING; 
+    this->status_record.status.dwControlsAccepted = SERVICE_ACCEPT_STOP 
+                                                  | SERVICE_ACCEPT_PAUSE_CONTINUE
+                                                  | SERVICE_ACCEPT_SHUTDOWN; 
+    this->status_record.process_state = SERVICE_STOPPED;
+    this->status_published.write(this->status_record);
 }
 
 ServiceBase::~ServiceBase( void )
 {
+	if (this->owns_manager)
+	{
+		delete this->manager;
+	}
 }
 
 int ServiceBase::setupFromConfiguration()
@@ -74,12 +82,30 @@ int ServiceBase::setupFromConfiguration(const char *config_filename)
 	return 1;
 }
 
+// Use the callers service manager rather than the platform's own:
+//
+void ServiceBase::setServiceManager(ServiceManager *manager)
+{
+	if (this->owns_manager)
+	{
+		delete this->manager;
+	}
+
+	this->owns_manager = (manager == NULL);
+	this->manager = manager ? manager : ServiceManager::create();
+}
+
 // Change the current service name:
 void ServiceBase::setName(std::string new_name) 
 {
 	copy_text(this->service_name, new_name.c_str(), SERVICE_NAME_MAX_LEN, new_name.length());
 }
 
+void ServiceBase::setName(const char *new_name) 
+{
+	copy_text(this->service_name, new_name, SERVICE_NAME_MAX_LEN, strlen(new_name));
+}
+
 
 // Recover the current service name:
 const char * ServiceBase::getName(void) 
@@ -92,12 +118,10 @@ const char * ServiceBase::getName(void)
 //
 DWORD ServiceBase::startUp(void)
 {
-	this->dispatch_table[0].lpServiceName = this->service_name;
-    this->dispatch_table[0].lpServiceProc = this->service_main;
-
-    if(!StartServiceCtrlDispatcher(this->dispatch_table))
+    DWORD rc = this->manager->startDispatcher(this->service_name, this->service_main);
+    if(rc != NO_ERROR)
 	{
-		this->error_code = GetLastError();
+		this->error_code = rc;
         return this->error_code;
     }
 
@@ -122,164 +146,195 @@ int ServiceBase::service(DWORD argc, LPTSTR* argv)
         return this->error_code;
     }
     
-	this->service_stat = RegisterServiceCtrlHandler(_T(this->getName()), this->service_control);
-    if((SERVICE_STATUS_HANDLE)0 == this->service_stat)
+    DWORD rc = this->manager->registerHandler(this->getName(), this->service_control);
+    if(rc != NO_ERROR)
 	{
-        this->error_code = GetLastError();
+        this->error_code = rc;
         return this->error_code;
     }
     
-    changeStatus(SERVICE_RUNNING);
-    return run();
+    // Otherwise run() says when we're ready:
+    if(this->ready_on_start)
+    {
+        reportReady();
+    }
+
+    int exit_code = run();
+
+    // Only now has everything really stopped:
+    changeStatus(SERVICE_STOPPED);
+    return exit_code;
 }
 
-// Handle various windows control signals. These will call the various
-// methods match the signal i.e. SERVICE_CONTROL_STOP calls onStop().
+// Handle various windows control signals. This is called on the service
+// manager's thread, which mustn't be kept waiting (the SCM times out and
+// blocks other services meanwhile), so only the pending state is reported
+// here. The control is queued for run() which then calls the method that
+// matches it i.e. SERVICE_CONTROL_STOP calls onStop(), see processControl().
 //
 void ServiceBase::control(DWORD opcode)
 {
     switch(opcode)
     {
     case SERVICE_CONTROL_PAUSE:
-        changeStatus(SERVICE_PAUSE_PENDING);
+        changeStatus(SERVICE_PAUSE_PENDING, 1, CONTROL_WAIT_HINT);
+        break;
+
+    case SERVICE_CONTROL_CONTINUE:
+        changeStatus(SERVICE_CONTINUE_PENDING, 1, CONTROL_WAIT_HINT);
+        break;
+
+    case SERVICE_CONTROL_STOP:
+    case SERVICE_CONTROL_SHUTDOWN:
+        changeStatus(SERVICE_STOP_PENDING, 1, CONTROL_WAIT_HINT);
+        break;
+
+    case SERVICE_CONTROL_INTERROGATE:
+        onInquire();
+        reportStatus();
+        return;
+
+    default:
+        reportStatus();
+        break;
+    };
+
+    postControl(opcode);
+}
+
+void ServiceBase::postControl(DWORD opcode)
+{
+    this->controls_lock.lock();
+    this->controls.push_back(opcode);
+    this->controls_lock.unlock();
+
+    this->control_posted.set();
+}
+
+// Called from run(): carry out the controls queued since last time, in
+// the order they came in.
+//
+bool ServiceBase::waitForControl(DWORD timeout)
+{
+    this->control_posted.wait(timeout);
+
+    bool processed = false;
+    for(;;)
+    {
+        this->controls_lock.lock();
+        if(this->controls.empty())
+        {
+            this->controls_lock.unlock();
+            break;
+        }
+        DWORD opcode = this->controls.front();
+        this->controls.pop_front();
+        this->controls_lock.unlock();
+
+        processControl(opcode);
+        processed = true;
+    }
+
+    return processed;
+}
+
+// Carry out a control control() accepted. The final state for a stop is
+// reported by service() once run() returns.
+//
+void ServiceBase::processControl(DWORD opcode)
+{
+    switch(opcode)
+    {
+    // A stop accepted by control() meanwhile has already replaced the
+    // pending state, which then stays:
+    //
+    case SERVICE_CONTROL_PAUSE:
         if(onPause() == NO_ERROR)
         {
             this->is_paused = true;
-            changeStatus(SERVICE_PAUSED);
+            changeStatusFrom(SERVICE_PAUSE_PENDING, SERVICE_PAUSED);
+        }
+        else
+        {
+            changeStatusFrom(SERVICE_PAUSE_PENDING, SERVICE_RUNNING);
         }
         break;
 
     case SERVICE_CONTROL_CONTINUE:
-        changeStatus(SERVICE_CONTINUE_PENDING);
         if(onContinue() == NO_ERROR)
         {
             this->is_paused = false;
-            changeStatus(SERVICE_RUNNING);
+            changeStatusFrom(SERVICE_CONTINUE_PENDING, SERVICE_RUNNING);
+        }
+        else
+        {
+            changeStatusFrom(SERVICE_CONTINUE_PENDING, SERVICE_PAUSED);
         }
         break;
 
     case SERVICE_CONTROL_STOP:
-        changeStatus(SERVICE_STOP_PENDING);
         onStop();
-        changeStatus(SERVICE_STOPPED);
         break;
 
     case SERVICE_CONTROL_SHUTDOWN:
-        changeStatus(SERVICE_STOP_PENDING);
         onShutdown();
-        changeStatus(SERVICE_STOPPED);
         break;
 
-    case SERVICE_CONTROL_INTERROGATE:
-        onInquire();
-        SetServiceStatus(this->service_stat, &this->service_status);
+    case SERVICE_CONTROL_PARAMCHANGE:
+        onParamChange();
         break;
 
     default:
         onUserControl(opcode);
-        SetServiceStatus(this->service_stat, &this->service_status);
         break;
     };
-    return;
 }
 
 
 bool ServiceBase::install(void)
 {
-	// Don't reinstall if we've been already been:
-    if(isInstalled())
-	{
-        return true;
-	}
-	
-    SC_HANDLE service_manager = OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
-    if(service_manager == NULL)
-    {
-        this->error_code = GetLastError();
-        return false;
-    }
-
 	// This is the service exe path and the directory
 	// which will be used to run the exe from.
 	//
     char file_path[_MAX_PATH];
-    GetModuleFileName(NULL, file_path, sizeof(file_path));
+    exe_path(file_path, sizeof(file_path));
 
-
-	// msdn create service ref: 
-	//  http://msdn.microsoft.com/en-us/library/ms682450(VS.85).aspx
-	//
-    SC_HANDLE service = CreateService(
-        service_manager,
-        this->service_name,
-        this->service_name,
-        SERVICE_ALL_ACCESS,
-        SERVICE_WIN32_OWN_PROCESS,
-        SERVICE_AUTO_START,
-        SERVICE_ERROR_NORMAL,
-        file_path,
-        NULL,
-        NULL,
-        NULL,
-        NULL,
-        NULL
-    );
-
-    bool rc = true;
-    if(service == NULL)
+    DWORD rc = this->manager->install(this->service_name, file_path);
+    if(rc != NO_ERROR)
     {
-        this->error_code = GetLastError();
-        rc = false;
+        this->error_code = rc;
+
+		// Don't reinstall if we've been already been:
+        return (this->error_code == ERROR_SERVICE_EXISTS);
     }
-    else
-	{
-		// Pass this on so that it can be used in registry set up 
-		// if the end user wants to do this.
-        installAid(file_path);
-	}
-    
-    CloseServiceHandle(service);
-    CloseServiceHandle(service_manager);
-    return rc;
+
+	// Pass this on so that it can be used in registry set up 
+	// if the end user wants to do this.
+    installAid(file_path);
+    return true;
 }
 
 // Remove the service if it is actually present.
 bool ServiceBase::unInstall(void)
 {
-	// Only do this if it is actually installed!
-    if(!isInstalled())
-	{
-        return true;
-	}
-
-    SC_HANDLE service_manager = OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
-    if(service_manager == NULL)
+    DWORD rc = this->manager->uninstall(this->service_name);
+    if(rc == ERROR_SERVICE_DOES_NOT_EXIST)
     {
-        this->error_code = GetLastError();
-        return false;
+		// Only do this if it is actually installed!
+        return true;
     }
-
-    SC_HANDLE service = OpenService(service_manager, this->service_name, DELETE);
-    if(service == NULL)
+    if(rc != NO_ERROR)
     {
-        this->error_code = GetLastError();
-        CloseServiceHandle(service_manager);
-        return false;
+        this->error_code = rc;
     }
 
-    bool rc = true;
-    if(!DeleteService(service))
+    // Uninstall any registry setup, unless the service is still there:
+    if(rc == NO_ERROR || rc == ERROR_SERVICE_MARKED_FOR_DELETE)
     {
-        rc = false;
-        this->error_code = GetLastError();
+        uninstallAid();
     }
 
-    // Uninstall any registry setup:
-    uninstallAid();
-
-    CloseServiceHandle(service);
-    CloseServiceHandle(service_manager);
-    return rc;
+    return (rc == NO_ERROR);
 }
 
 DWORD ServiceBase::getLastError( void )
@@ -293,42 +348,94 @@ DWORD ServiceBase::getLastError( void )
 //
 bool ServiceBase::isInstalled( void )
 {
-    bool rc = false;
+    return this->manager->isInstalled(this->service_name);
+}
+
+void ServiceBase::setAcceptedControls(DWORD controls)
+{
+    ServiceStatusRecord &record = beginStatusUpdate();
+    record.status.dwControlsAccepted = controls;
+    endStatusUpdate();
+}
+
+// The lock keeps reports to the service manager in the order the status
+// changed, readers of the record never take it.
+//
+ServiceStatusRecord &ServiceBase::beginStatusUpdate(void)
+{
+    this->status_lock.lock();
+    return this->status_record;
+}
+
+void ServiceBase::endStatusUpdate(void)
+{
+    this->status_published.write(this->status_record);
+    this->status_lock.unlock();
+}
 
-    // Open the Service Control Manager
-    SC_HANDLE service_manager = ::OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
-    if (service_manager) 
+// control() can report a pending state on the handler thread at any time,
+// so the state is checked and changed under the one lock:
+//
+bool ServiceBase::reportStarting(DWORD waithint)
+{
+    ServiceStatusRecord &record = beginStatusUpdate();
+    bool starting = (record.status.dwCurrentState == SERVICE_START_PENDING);
+    if(starting)
     {
-        // Try to open the service
-        SC_HANDLE service = ::OpenService(
-			service_manager, 
-			this->service_name, 
-			SERVICE_QUERY_CONFIG
-		);
-
-        if (service) 
-        {
-            rc = true;
-            ::CloseServiceHandle(service);
-        }
-        ::CloseServiceHandle(service_manager);
+        record.status.dwCheckPoint++;
+        record.status.dwWaitHint = waithint;
+        this->manager->setStatus(record.status);
     }
-    
-    return rc;
+    endStatusUpdate();
+    return starting;
 }
 
-void ServiceBase::setAcceptedControls(DWORD controls)
+bool ServiceBase::reportReady(void)
+{
+    if(!changeStatusFrom(SERVICE_START_PENDING, SERVICE_RUNNING))
+    {
+        return false;
+    }
+    this->is_started = true;
+    return true;
+}
+
+// Change to state only if the state is still pending, checked and changed
+// under the one lock. Returns false if it had moved on.
+//
+bool ServiceBase::changeStatusFrom(DWORD pending, DWORD state)
 {
-    this->service_status.dwControlsAccepted = controls;
+    ServiceStatusRecord &record = beginStatusUpdate();
+    bool changed = (record.status.dwCurrentState == pending);
+    if(changed)
+    {
+        record.status.dwCurrentState = state;
+        record.status.dwCheckPoint = 0;
+        record.status.dwWaitHint = 0;
+        this->manager->setStatus(record.status);
+    }
+    endStatusUpdate();
+    return changed;
 }
 
 void ServiceBase::changeStatus(DWORD state, DWORD checkpoint, DWORD waithint)
 {
-    this->service_status.dwCurrentState = state;
-    this->service_status.dwCheckPoint = checkpoint;
-    this->service_status.dwWaitHint = waithint;
+    ServiceStatusRecord &record = beginStatusUpdate();
+    record.status.dwCurrentState = state;
+    record.status.dwCheckPoint = checkpoint;
+    record.status.dwWaitHint = waithint;
     
-    SetServiceStatus(this->service_stat, &this->service_status);
+    this->manager->setStatus(record.status);
+    endStatusUpdate();
+}
+
+// Report the status again unchanged, e.g. when interrogated:
+//
+void ServiceBase::reportStatus(void)
+{
+    ServiceStatusRecord &record = beginStatusUpdate();
+    this->manager->setStatus(record.status);
+    endStatusUpdate();
 }
 
 DWORD ServiceBase::init(DWORD argc, LPTSTR* argv) 
@@ -371,4 +478,8 @@ void  ServiceBase::onUserControl(DWORD)
 {
 }
 
+void  ServiceBase::onParamChange(void) 
+{
+}
+
 
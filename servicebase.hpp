@@ -12,14 +12,40 @@ Oisin Mulvihill
 #ifndef _ServiceBase_h_
 #define _ServiceBase_h_
 
-#include "stdafx.h"
+#include <deque>
+#include <time.h>
 
-#define SERVICE_NAME_MAX_LEN 256
+#include "servicemanager.hpp"
+
+// The wait hint given when a control is accepted, for run() to carry it
+// out by:
+#define CONTROL_WAIT_HINT 10000
 
 // Safe copy up to the max amount we have available or just the length of the
 // string id it is less.
 void copy_text(char *dest, const char *src, int dest_max, int src_length);
 
+// What the service is up to, see ServiceBase::getStatusRecord().
+//
+struct ServiceStatusRecord
+{
+    // As last reported to the service manager:
+    SERVICE_STATUS status;
+
+    // The process the service runs: its id, its state (SERVICE_RUNNING,
+    // SERVICE_PAUSED or SERVICE_STOPPED), when it was last started (0 if
+    // never) and how many processes there are counting those it started.
+    DWORD process_id;
+    DWORD process_state;
+    time_t process_started;
+    DWORD process_count;
+
+    // How often the process has been restarted, and its exit code when it
+    // last stopped:
+    DWORD restarts;
+    DWORD last_exit_code;
+};
+
 class ServiceBase
 {
 private:
@@ -33,9 +59,27 @@ protected:
     LPSERVICE_MAIN_FUNCTION service_main;
     LPHANDLER_FUNCTION service_control;
 
-    SERVICE_TABLE_ENTRY dispatch_table[2];
-    SERVICE_STATUS service_status;
-    SERVICE_STATUS_HANDLE service_stat;
+    // The status. status_record is only changed between beginStatusUpdate()
+    // and endStatusUpdate(), which publishes it to status_published for
+    // getStatusRecord():
+    //
+    ServiceStatusRecord status_record;
+    ServiceLock status_lock;
+    SeqLocked<ServiceStatusRecord> status_published;
+
+    // The operating system's service manager, see setServiceManager():
+    ServiceManager *manager;
+    bool owns_manager;
+
+    // Whether service() reports SERVICE_RUNNING as soon as init() is done.
+    // Services which check they really started clear this and call
+    // reportReady() themselves.
+    bool ready_on_start;
+
+    // Controls accepted by control() waiting for run() to carry them out:
+    std::deque<DWORD> controls;
+    ServiceLock controls_lock;
+    ServiceEvent control_posted;
 
 private:
     ServiceBase();               
@@ -49,9 +93,34 @@ protected:
         DWORD checkpoint = (DWORD)0, 
         DWORD waithint = (DWORD)0
 	);
+    virtual void reportStatus(void);
+    virtual bool changeStatusFrom(DWORD pending, DWORD state);
     
     virtual DWORD init(DWORD argc, LPTSTR* argv);
+
+    // Lock status_record for changing / publish the changes and unlock it.
+    ServiceStatusRecord &beginStatusUpdate(void);
+    void endStatusUpdate(void);
+
+    // Still starting, the next report will be within waithint ms:
+    virtual bool reportStarting(DWORD waithint);
+
+    // Started up ok, report SERVICE_RUNNING:
+    virtual bool reportReady(void);
+
+    // Both only report while the state is still SERVICE_START_PENDING, a
+    // stop etc. accepted meanwhile isn't undone. They return false if the
+    // state had already moved on.
+
+    // The service itself, it returns once the service has stopped. Controls
+    // are only carried out in waitForControl(), which it must call
+    // regularly, see control().
     virtual int run(void) = 0;
+
+    // Wait up to timeout ms for a control and then carry out any that are
+    // waiting, calling onStop() etc. Returns true if there were any.
+    virtual bool waitForControl(DWORD timeout);
+    virtual void processControl(DWORD opcode);
     
     virtual void installAid(char *exe_path);
     virtual void uninstallAid(void);
@@ -64,6 +133,7 @@ protected:
 
     virtual void onInquire(void);
     virtual void onUserControl(DWORD usercmd);
+    virtual void onParamChange(void);
 
 public:
     ServiceBase(
@@ -76,23 +146,42 @@ public:
 	virtual int setupFromConfiguration(const char *config_filename);
     
 	void setName(std::string new_name);
+	void setName(const char *new_name);
 	const char * getName(void);
 
     virtual DWORD startUp(void);
     virtual int service(DWORD argc, LPTSTR* argv);    
     virtual void control(DWORD opcode);
 
+    // Queue a control for run() as if the service manager had sent it.
+    void postControl(DWORD opcode);
+
     virtual bool isInstalled(void);
     virtual bool install(void);
     virtual bool unInstall(void);
 
+    // Use a different service manager to the platform's own, for example
+    // one sharing an SCM connection or a FakeServiceManager. The caller
+    // keeps ownership. NULL goes back to the platform's own.
+    //
+    void setServiceManager(ServiceManager *manager);
+
+    // A consistent copy of the latest status. Any thread can call this, it
+    // doesn't lock or hold up the service changing its status.
+    ServiceStatusRecord getStatusRecord(void);
+
     virtual DWORD getLastError(void);    
     virtual DWORD getExitCode(void);    
 };
 
+inline ServiceStatusRecord ServiceBase::getStatusRecord(void)
+{
+    return this->status_published.read();
+}
+
 inline DWORD ServiceBase::getExitCode(void)
 {
-    return this->service_status.dwWin32ExitCode;
+    return this->getStatusRecord().status.dwWin32ExitCode;
 }
 
 #endif
@@ -0,0 +1,366 @@
+/*
+
+See License.txt to see what this project is licensed under.
+
+The Win32 service types and values ServiceBase uses, so that it and the
+ServiceManager implementations which don't need Windows also build on
+Linux. On Windows this is just the usual headers.
+
+*/
+#ifndef _ServiceCompat_h_
+#define _ServiceCompat_h_
+
+#ifdef _WIN32
+
+#include "stdafx.h"
+
+#else
+
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+
+#define WINAPI
+#define _T(x) x
+#define _MAX_PATH PATH_MAX
+#define ZeroMemory(dest, length) memset((dest), 0, (length))
+
+typedef unsigned long DWORD;
+typedef char *LPTSTR;
+
+typedef void (WINAPI *LPSERVICE_MAIN_FUNCTION)(DWORD argc, LPTSTR *argv);
+typedef void (WINAPI *LPHANDLER_FUNCTION)(DWORD opcode);
+
+// Same layout and meaning as the winsvc.h version:
+//
+typedef struct _SERVICE_STATUS
+{
+    DWORD dwServiceType;
+    DWORD dwCurrentState;
+    DWORD dwControlsAccepted;
+    DWORD dwWin32ExitCode;
+    DWORD dwServiceSpecificExitCode;
+    DWORD dwCheckPoint;
+    DWORD dwWaitHint;
+} SERVICE_STATUS;
+
+// Service types:
+#define SERVICE_WIN32_OWN_PROCESS       0x00000010
+#define SERVICE_WIN32_SHARE_PROCESS     0x00000020
+#define SERVICE_WIN32                   (SERVICE_WIN32_OWN_PROCESS | SERVICE_WIN32_SHARE_PROCESS)
+#define SERVICE_INTERACTIVE_PROCESS     0x00000100
+
+// Service states:
+#define SERVICE_STOPPED                 0x00000001
+#define SERVICE_START_PENDING           0x00000002
+#define SERVICE_STOP_PENDING            0x00000003
+#define SERVICE_RUNNING                 0x00000004
+#define SERVICE_CONTINUE_PENDING        0x00000005
+#define SERVICE_PAUSE_PENDING           0x00000006
+#define SERVICE_PAUSED                  0x00000007
+
+// Controls accepted:
+#define SERVICE_ACCEPT_STOP             0x00000001
+#define SERVICE_ACCEPT_PAUSE_CONTINUE   0x00000002
+#define SERVICE_ACCEPT_SHUTDOWN         0x00000004
+
+// Control opcodes:
+#define SERVICE_CONTROL_STOP            0x00000001
+#define SERVICE_CONTROL_PAUSE           0x00000002
+#define SERVICE_CONTROL_CONTINUE        0x00000003
+#define SERVICE_CONTROL_INTERROGATE     0x00000004
+#define SERVICE_CONTROL_SHUTDOWN        0x00000005
+#define SERVICE_CONTROL_PARAMCHANGE     0x00000006
+
+// Error codes:
+#define NO_ERROR                        0
+#define ERROR_ACCESS_DENIED             5
+#define ERROR_NOT_ENOUGH_MEMORY         8
+#define ERROR_INVALID_PARAMETER         87
+#define ERROR_CALL_NOT_IMPLEMENTED      120
+#define ERROR_SERVICE_DOES_NOT_EXIST    1060
+#define ERROR_SERVICE_NOT_ACTIVE        1062
+#define ERROR_SERVICE_MARKED_FOR_DELETE 1072
+#define ERROR_SERVICE_EXISTS            1073
+
+#endif
+
+// A plain mutex, for state shared with the control handler thread:
+//
+class ServiceLock
+{
+private:
+#ifdef _WIN32
+    CRITICAL_SECTION section;
+#else
+    pthread_mutex_t mutex;
+#endif
+
+private:
+    ServiceLock(ServiceLock&);
+
+public:
+#ifdef _WIN32
+    ServiceLock() { InitializeCriticalSection(&this->section); }
+    ~ServiceLock() { DeleteCriticalSection(&this->section); }
+    void lock(void) { EnterCriticalSection(&this->section); }
+    void unlock(void) { LeaveCriticalSection(&this->section); }
+#else
+    ServiceLock() { pthread_mutex_init(&this->mutex, NULL); }
+    ~ServiceLock() { pthread_mutex_destroy(&this->mutex); }
+    void lock(void) { pthread_mutex_lock(&this->mutex); }
+    void unlock(void) { pthread_mutex_unlock(&this->mutex); }
+#endif
+};
+
+// An auto reset event: wait() returns true, and resets it, once set() has
+// been called, or false if that didn't happen within timeout ms.
+//
+class ServiceEvent
+{
+private:
+#ifdef _WIN32
+    HANDLE event;
+#else
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool signalled;
+#endif
+
+private:
+    ServiceEvent(ServiceEvent&);
+
+public:
+#ifdef _WIN32
+    ServiceEvent() { this->event = CreateEvent(NULL, FALSE, FALSE, NULL); }
+    ~ServiceEvent() { CloseHandle(this->event); }
+    void set(void) { SetEvent(this->event); }
+    bool wait(DWORD timeout) { return (WaitForSingleObject(this->event, timeout) == WAIT_OBJECT_0); }
+#else
+    ServiceEvent()
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&this->cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_init(&this->mutex, NULL);
+        this->signalled = false;
+    }
+    ~ServiceEvent()
+    {
+        pthread_cond_destroy(&this->cond);
+        pthread_mutex_destroy(&this->mutex);
+    }
+    void set(void)
+    {
+        pthread_mutex_lock(&this->mutex);
+        this->signalled = true;
+        pthread_cond_signal(&this->cond);
+        pthread_mutex_unlock(&this->mutex);
+    }
+    bool wait(DWORD timeout)
+    {
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_sec += timeout / 1000;
+        until.tv_nsec += (long) (timeout % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L)
+        {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&this->mutex);
+        while (!this->signalled)
+        {
+            if (pthread_cond_timedwait(&this->cond, &this->mutex, &until) != 0)
+            {
+                break;
+            }
+        }
+        bool rc = this->signalled;
+        this->signalled = false;
+        pthread_mutex_unlock(&this->mutex);
+        return rc;
+    }
+#endif
+};
+
+// A value any thread can read a consistent copy of without locking, and
+// without holding up the writer (a seqlock). The writer makes sequence odd,
+// changes the value and makes it even again. Readers copy the value and
+// start over if sequence was odd or has changed meanwhile. T must be plain
+// data. Only one thread may write at a time, the caller sees to that.
+//
+template <class T>
+class SeqLocked
+{
+private:
+#ifdef _WIN32
+    typedef LONG Word;
+#else
+    typedef long Word;
+#endif
+    enum { WORDS = (sizeof(T) + sizeof(Word) - 1) / sizeof(Word) };
+
+    union Data
+    {
+        T value;
+        Word words[WORDS];
+    };
+
+    volatile Word sequence;
+    Data data;
+
+private:
+    SeqLocked(SeqLocked&);
+
+public:
+    SeqLocked()
+    {
+        this->sequence = 0;
+        memset(&this->data, 0, sizeof(this->data));
+    }
+
+    void write(const T &value)
+    {
+        Data next;
+        memset(&next, 0, sizeof(next));
+        next.value = value;
+
+        Word seq = this->sequence;
+#ifdef _WIN32
+        // Interlocked calls are full barriers and volatile stores releases:
+        InterlockedExchange(&this->sequence, seq + 1);
+        for (int i = 0; i < WORDS; i++)
+        {
+            ((volatile Word *) this->data.words)[i] = next.words[i];
+        }
+        InterlockedExchange(&this->sequence, seq + 2);
+#else
+        __atomic_store_n(&this->sequence, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        for (int i = 0; i < WORDS; i++)
+        {
+            __atomic_store_n(&this->data.words[i], next.words[i], __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&this->sequence, seq + 2, __ATOMIC_RELEASE);
+#endif
+    }
+
+    T read(void)
+    {
+        Data copy;
+        for (;;)
+        {
+#ifdef _WIN32
+            Word before = this->sequence;
+#else
+            Word before = __atomic_load_n(&this->sequence, __ATOMIC_ACQUIRE);
+#endif
+            if (before & 1)
+            {
+                // Mid write, let the writer get on with it:
+#ifdef _WIN32
+                SwitchToThread();
+#else
+                sched_yield();
+#endif
+                continue;
+            }
+
+#ifdef _WIN32
+            for (int i = 0; i < WORDS; i++)
+            {
+                copy.words[i] = ((volatile Word *) this->data.words)[i];
+            }
+            MemoryBarrier();
+            Word after = this->sequence;
+#else
+            for (int i = 0; i < WORDS; i++)
+            {
+                copy.words[i] = __atomic_load_n(&this->data.words[i], __ATOMIC_RELAXED);
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            Word after = __atomic_load_n(&this->sequence, __ATOMIC_RELAXED);
+#endif
+            if (before == after)
+            {
+                return copy.value;
+            }
+        }
+    }
+};
+
+// The full path of the running exe, as installed as the service command.
+// Returns false if it could not be found or did not fit.
+//
+inline bool exe_path(char *path, DWORD path_max)
+{
+#ifdef _WIN32
+    DWORD length = GetModuleFileName(NULL, path, path_max);
+    return (length > 0 && length < path_max);
+#else
+    ssize_t length = readlink("/proc/self/exe", path, path_max - 1);
+    if (length <= 0)
+    {
+        path[0] = '\0';
+        return false;
+    }
+    path[length] = '\0';
+    return true;
+#endif
+}
+
+// Freeze (suspend = true) or thaw a process: all its threads stop running
+// but it keeps its memory, handles etc. Returns NO_ERROR,
+// ERROR_INVALID_PARAMETER if there is no such process any more, or another
+// error code.
+//
+// Windows has no documented call for this, so ntdll's NtSuspendProcess /
+// NtResumeProcess are used; both have been there since XP. Suspends count
+// up so each suspend needs its resume. Elsewhere it's SIGSTOP / SIGCONT,
+// which don't count.
+//
+inline DWORD suspend_process(DWORD pid, bool suspend)
+{
+#ifdef _WIN32
+    typedef LONG (NTAPI *SuspendResume)(HANDLE process);
+
+    HMODULE ntdll = GetModuleHandle("ntdll.dll");
+    SuspendResume call = ntdll ? (SuspendResume) GetProcAddress(ntdll, suspend ? "NtSuspendProcess" : "NtResumeProcess") : NULL;
+    if (!call)
+    {
+        return ERROR_CALL_NOT_IMPLEMENTED;
+    }
+
+    HANDLE process = OpenProcess(PROCESS_SUSPEND_RESUME, FALSE, pid);
+    if (!process)
+    {
+        return GetLastError();
+    }
+    LONG status = call(process);
+    CloseHandle(process);
+
+    // Not being allowed is the usual reason for a failed NTSTATUS:
+    return (status < 0) ? ERROR_ACCESS_DENIED : NO_ERROR;
+#else
+    if (kill((pid_t) pid, suspend ? SIGSTOP : SIGCONT) == 0)
+    {
+        return NO_ERROR;
+    }
+    return (errno == ESRCH) ? ERROR_INVALID_PARAMETER : ERROR_ACCESS_DENIED;
+#endif
+}
+
+#endif
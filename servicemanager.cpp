@@ -0,0 +1,744 @@
+/*
+
+See License.txt to see what this project is licensed under.
+
+*/
+#include "servicebase.hpp"
+
+#ifndef _WIN32
+# include <errno.h>
+# include <stddef.h>
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif
+
+
+ServiceManager *ServiceManager::create(void)
+{
+#ifdef _WIN32
+	return new Win32ServiceManager();
+#else
+	return new SystemdServiceManager();
+#endif
+}
+
+
+#ifdef _WIN32
+
+SCMSession::SCMSession()
+{
+	this->manager = NULL;
+	this->manager_access = 0;
+	this->owns_manager = false;
+	this->service = NULL;
+	this->service_access = 0;
+	memset(this->service_name, 0, sizeof(this->service_name));
+}
+
+SCMSession::~SCMSession()
+{
+	this->close();
+}
+
+void SCMSession::useManager(SC_HANDLE manager)
+{
+	this->close();
+	this->manager = manager;
+	this->owns_manager = false;
+}
+
+SC_HANDLE SCMSession::getManager(DWORD access)
+{
+	if (this->manager && !this->owns_manager)
+	{
+		return this->manager;
+	}
+	if (this->manager && (this->manager_access & access) == access)
+	{
+		return this->manager;
+	}
+
+	// Reopen asking for what we had as well, so the service handle
+	// which came from it stays usable:
+	//
+	access |= this->manager_access;
+	SC_HANDLE manager = ::OpenSCManager(NULL, NULL, access);
+	if (manager == NULL)
+	{
+		return NULL;
+	}
+	if (this->manager)
+	{
+		::CloseServiceHandle(this->manager);
+	}
+	this->manager = manager;
+	this->manager_access = access;
+	this->owns_manager = true;
+	return manager;
+}
+
+SC_HANDLE SCMSession::getService(const char *name, DWORD access)
+{
+	if (this->service && strcmp(this->service_name, name) != 0)
+	{
+		this->closeService();
+	}
+	if (this->service && (this->service_access & access) == access)
+	{
+		return this->service;
+	}
+
+	SC_HANDLE manager = this->getManager(SC_MANAGER_CONNECT);
+	if (manager == NULL)
+	{
+		return NULL;
+	}
+
+	access |= this->service_access;
+	SC_HANDLE service = ::OpenService(manager, name, access);
+	if (service == NULL)
+	{
+		return NULL;
+	}
+	this->setService(name, service, access);
+	return service;
+}
+
+void SCMSession::setService(const char *name, SC_HANDLE service, DWORD access)
+{
+	this->closeService();
+	this->service = service;
+	this->service_access = access;
+	copy_text(this->service_name, name, SERVICE_NAME_MAX_LEN, strlen(name));
+}
+
+void SCMSession::closeService(void)
+{
+	if (this->service)
+	{
+		::CloseServiceHandle(this->service);
+	}
+	this->service = NULL;
+	this->service_access = 0;
+}
+
+void SCMSession::close(void)
+{
+	this->closeService();
+	if (this->manager && this->owns_manager)
+	{
+		::CloseServiceHandle(this->manager);
+	}
+	this->manager = NULL;
+	this->manager_access = 0;
+	this->owns_manager = false;
+}
+
+
+Win32ServiceManager::Win32ServiceManager(SC_HANDLE shared_manager)
+{
+	memset(this->service_name, 0, sizeof(this->service_name));
+	memset(&this->dispatch_table[0], 0, sizeof(this->dispatch_table));
+	this->status_handle = 0;
+
+	if (shared_manager)
+	{
+		this->scm.useManager(shared_manager);
+	}
+}
+
+DWORD Win32ServiceManager::startDispatcher(const char *name, LPSERVICE_MAIN_FUNCTION service_main)
+{
+	copy_text(this->service_name, name, SERVICE_NAME_MAX_LEN, strlen(name));
+	this->dispatch_table[0].lpServiceName = this->service_name;
+	this->dispatch_table[0].lpServiceProc = service_main;
+
+	if (!StartServiceCtrlDispatcher(this->dispatch_table))
+	{
+		return GetLastError();
+	}
+	return NO_ERROR;
+}
+
+DWORD Win32ServiceManager::registerHandler(const char *name, LPHANDLER_FUNCTION handler)
+{
+	this->status_handle = RegisterServiceCtrlHandler(_T(name), handler);
+	if ((SERVICE_STATUS_HANDLE)0 == this->status_handle)
+	{
+		return GetLastError();
+	}
+	return NO_ERROR;
+}
+
+DWORD Win32ServiceManager::setStatus(const SERVICE_STATUS &status)
+{
+	SERVICE_STATUS current = status;
+
+	if (!SetServiceStatus(this->status_handle, &current))
+	{
+		return GetLastError();
+	}
+	return NO_ERROR;
+}
+
+DWORD Win32ServiceManager::install(const char *name, const char *command)
+{
+	SC_HANDLE service_manager = this->scm.getManager(SC_MANAGER_CONNECT | SC_MANAGER_CREATE_SERVICE);
+	if (service_manager == NULL)
+	{
+		return GetLastError();
+	}
+
+	// msdn create service ref:
+	//  http://msdn.microsoft.com/en-us/library/ms682450(VS.85).aspx
+	//
+	// Only ask for the access needed to finish the set up, see
+	// setDescription() and setInteractive().
+	//
+	SC_HANDLE service = CreateService(
+		service_manager,
+		name,
+		name,
+		SERVICE_CHANGE_CONFIG | SERVICE_QUERY_CONFIG,
+		SERVICE_WIN32_OWN_PROCESS,
+		SERVICE_AUTO_START,
+		SERVICE_ERROR_NORMAL,
+		command,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL
+	);
+	if (service == NULL)
+	{
+		return GetLastError();
+	}
+
+	this->scm.setService(name, service, SERVICE_CHANGE_CONFIG | SERVICE_QUERY_CONFIG);
+	return NO_ERROR;
+}
+
+DWORD Win32ServiceManager::uninstall(const char *name)
+{
+	SC_HANDLE service = this->scm.getService(name, DELETE);
+	if (service == NULL)
+	{
+		return GetLastError();
+	}
+
+	DWORD rc = NO_ERROR;
+	if (!DeleteService(service))
+	{
+		rc = GetLastError();
+	}
+
+	// The service is only removed once all handles to it are closed:
+	this->scm.closeService();
+	return rc;
+}
+
+bool Win32ServiceManager::isInstalled(const char *name)
+{
+	return (this->scm.getService(name, SERVICE_QUERY_CONFIG) != NULL);
+}
+
+DWORD Win32ServiceManager::setDescription(const char *name, const char *description)
+{
+	SC_HANDLE service = this->scm.getService(name, SERVICE_CHANGE_CONFIG);
+	if (service == NULL)
+	{
+		return GetLastError();
+	}
+
+	// Changing service config, ref:
+	//    http://msdn.microsoft.com/en-us/library/ms682006(VS.85).aspx
+	//
+	std::string text = description;
+	SERVICE_DESCRIPTION sd;
+
+	sd.lpDescription = (LPTSTR) text.c_str();
+
+	if (!ChangeServiceConfig2(service, SERVICE_CONFIG_DESCRIPTION, &sd))
+	{
+		return GetLastError();
+	}
+	return NO_ERROR;
+}
+
+DWORD Win32ServiceManager::setInteractive(const char *name, bool interactive)
+{
+	SC_HANDLE service = this->scm.getService(name, SERVICE_CHANGE_CONFIG);
+	if (service == NULL)
+	{
+		return GetLastError();
+	}
+
+	DWORD service_type = SERVICE_WIN32_OWN_PROCESS;
+	if (interactive)
+	{
+		service_type |= SERVICE_INTERACTIVE_PROCESS;
+	}
+
+	if (!ChangeServiceConfig(
+		service,
+		service_type,
+		SERVICE_NO_CHANGE,
+		SERVICE_NO_CHANGE,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL
+	))
+	{
+		return GetLastError();
+	}
+	return NO_ERROR;
+}
+
+#else
+
+SystemdServiceManager::SystemdServiceManager(const char *socket_path)
+{
+	if (!socket_path)
+	{
+		socket_path = getenv("NOTIFY_SOCKET");
+	}
+	if (socket_path)
+	{
+		this->socket_path = socket_path;
+	}
+
+	// Opened up front as the status is sent from more than one thread:
+	//
+	this->socket_fd = -1;
+	if (!this->socket_path.empty())
+	{
+		this->socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	}
+
+	this->handler = NULL;
+	this->has_signal_thread = false;
+	this->stopping = false;
+
+	// The watchdog is only for us if WATCHDOG_PID is unset or our pid:
+	//
+	this->watchdog_usec = 0;
+	const char *watchdog_usec = getenv("WATCHDOG_USEC");
+	const char *watchdog_pid = getenv("WATCHDOG_PID");
+	if (watchdog_usec && (!watchdog_pid || strtoul(watchdog_pid, NULL, 10) == (unsigned long) getpid()))
+	{
+		this->watchdog_usec = strtoull(watchdog_usec, NULL, 10);
+	}
+
+	sigemptyset(&this->signals);
+	sigaddset(&this->signals, SIGTERM);
+	sigaddset(&this->signals, SIGINT);
+}
+
+SystemdServiceManager::~SystemdServiceManager()
+{
+	this->stopSignalWatcher();
+	if (this->socket_fd >= 0)
+	{
+		close(this->socket_fd);
+	}
+}
+
+// Wake the signal thread up with one of its own signals, it is blocked
+// so it will go to the thread's sigwait():
+//
+void SystemdServiceManager::stopSignalWatcher(void)
+{
+	if (!this->has_signal_thread)
+	{
+		return;
+	}
+
+	this->lock.lock();
+	this->stopping = true;
+	this->lock.unlock();
+
+	pthread_kill(this->signal_thread, SIGTERM);
+	pthread_join(this->signal_thread, NULL);
+	this->has_signal_thread = false;
+	this->stopping = false;
+}
+
+// Turn the stop signals into control requests, on a thread of its own
+// as the handler can't be called from a signal handler:
+//
+void *SystemdServiceManager::signalWatcher(void *param)
+{
+	SystemdServiceManager *manager = (SystemdServiceManager *) param;
+
+	for (;;)
+	{
+		int signal = 0;
+		if (sigwait(&manager->signals, &signal) != 0)
+		{
+			continue;
+		}
+
+		manager->lock.lock();
+		bool stopping = manager->stopping;
+		manager->lock.unlock();
+		if (stopping)
+		{
+			break;
+		}
+
+		manager->handler(SERVICE_CONTROL_STOP);
+	}
+
+	return NULL;
+}
+
+// The systemd notify protocol, ref:
+//    https://www.freedesktop.org/software/systemd/man/sd_notify.html
+//
+// Errors are errno values.
+//
+DWORD SystemdServiceManager::notify(const char *state)
+{
+	if (this->socket_path.empty())
+	{
+		return NO_ERROR;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	size_t path_length = this->socket_path.length();
+	if (path_length >= sizeof(address.sun_path))
+	{
+		return ERROR_INVALID_PARAMETER;
+	}
+	memcpy(address.sun_path, this->socket_path.c_str(), path_length);
+	if (address.sun_path[0] == '@')
+	{
+		address.sun_path[0] = '\0';
+	}
+
+	if (this->socket_fd < 0)
+	{
+		return ERROR_SERVICE_NOT_ACTIVE;
+	}
+
+	if (sendto(
+		this->socket_fd,
+		state,
+		strlen(state),
+		MSG_NOSIGNAL,
+		(struct sockaddr *) &address,
+		(socklen_t) (offsetof(struct sockaddr_un, sun_path) + path_length)
+	) < 0)
+	{
+		return (DWORD) errno;
+	}
+	return NO_ERROR;
+}
+
+DWORD SystemdServiceManager::startDispatcher(const char *name, LPSERVICE_MAIN_FUNCTION service_main)
+{
+	// Block the stop signals before the service starts any threads, so
+	// they all leave them to signalWatcher():
+	//
+	pthread_sigmask(SIG_BLOCK, &this->signals, NULL);
+
+	// systemd started us as the service, so just run it:
+	//
+	char service_name[SERVICE_NAME_MAX_LEN];
+	copy_text(service_name, name, SERVICE_NAME_MAX_LEN, strlen(name));
+
+	LPTSTR argv[] = { service_name, NULL };
+	service_main(1, argv);
+
+	// Stopped, so no more control requests:
+	//
+	this->stopSignalWatcher();
+	return NO_ERROR;
+}
+
+DWORD SystemdServiceManager::registerHandler(const char *name, LPHANDLER_FUNCTION handler)
+{
+	this->handler = handler;
+	if (this->has_signal_thread)
+	{
+		return NO_ERROR;
+	}
+
+	pthread_sigmask(SIG_BLOCK, &this->signals, NULL);
+
+	int rc = pthread_create(&this->signal_thread, NULL, SystemdServiceManager::signalWatcher, this);
+	if (rc != 0)
+	{
+		return (DWORD) rc;
+	}
+	this->has_signal_thread = true;
+	return NO_ERROR;
+}
+
+DWORD SystemdServiceManager::setStatus(const SERVICE_STATUS &status)
+{
+	char message[128] = "";
+
+	switch (status.dwCurrentState)
+	{
+	case SERVICE_START_PENDING:
+	case SERVICE_STOP_PENDING:
+		// Ask for more time when we know how long it will take:
+		//
+		sprintf(message, "%s",
+			status.dwCurrentState == SERVICE_START_PENDING ? "STATUS=Starting" : "STOPPING=1\nSTATUS=Stopping");
+		if (status.dwWaitHint)
+		{
+			sprintf(message + strlen(message), "\nEXTEND_TIMEOUT_USEC=%llu",
+				(unsigned long long) status.dwWaitHint * 1000ULL);
+		}
+		break;
+
+	case SERVICE_RUNNING:
+		sprintf(message, "READY=1\nSTATUS=Running");
+		break;
+
+	case SERVICE_PAUSE_PENDING:
+		sprintf(message, "STATUS=Pausing");
+		break;
+
+	case SERVICE_PAUSED:
+		sprintf(message, "STATUS=Paused");
+		break;
+
+	case SERVICE_CONTINUE_PENDING:
+		sprintf(message, "STATUS=Continuing");
+		break;
+
+	case SERVICE_STOPPED:
+		sprintf(message, "STATUS=Stopped");
+		break;
+
+	default:
+		return NO_ERROR;
+	}
+
+	return this->notify(message);
+}
+
+DWORD SystemdServiceManager::watchdog(void)
+{
+	if (this->watchdog_usec == 0)
+	{
+		return NO_ERROR;
+	}
+	return this->notify("WATCHDOG=1");
+}
+
+DWORD SystemdServiceManager::getWatchdogInterval(void)
+{
+	return (DWORD) (this->watchdog_usec / 1000);
+}
+
+DWORD SystemdServiceManager::setStatusText(const char *text)
+{
+	std::string message = "STATUS=";
+
+	// One line only, the protocol is newline separated:
+	//
+	message.append(text, strcspn(text, "\n"));
+	return this->notify(message.c_str());
+}
+
+DWORD SystemdServiceManager::install(const char *name, const char *command)
+{
+	return ERROR_CALL_NOT_IMPLEMENTED;
+}
+
+DWORD SystemdServiceManager::uninstall(const char *name)
+{
+	return ERROR_CALL_NOT_IMPLEMENTED;
+}
+
+bool SystemdServiceManager::isInstalled(const char *name)
+{
+	return false;
+}
+
+DWORD SystemdServiceManager::setDescription(const char *name, const char *description)
+{
+	return ERROR_CALL_NOT_IMPLEMENTED;
+}
+
+DWORD SystemdServiceManager::setInteractive(const char *name, bool interactive)
+{
+	return ERROR_CALL_NOT_IMPLEMENTED;
+}
+
+#endif
+
+
+FakeServiceManager::FakeServiceManager()
+{
+	this->handler = NULL;
+	memset(&this->status, 0, sizeof(this->status));
+	this->status_count = 0;
+	this->watchdog_count = 0;
+}
+
+DWORD FakeServiceManager::startDispatcher(const char *name, LPSERVICE_MAIN_FUNCTION service_main)
+{
+	char service_name[SERVICE_NAME_MAX_LEN];
+	copy_text(service_name, name, SERVICE_NAME_MAX_LEN, strlen(name));
+
+	LPTSTR argv[] = { service_name, NULL };
+	service_main(1, argv);
+	return NO_ERROR;
+}
+
+DWORD FakeServiceManager::registerHandler(const char *name, LPHANDLER_FUNCTION handler)
+{
+	this->lock.lock();
+	this->handler = handler;
+	this->lock.unlock();
+	return NO_ERROR;
+}
+
+DWORD FakeServiceManager::setStatus(const SERVICE_STATUS &status)
+{
+	this->lock.lock();
+	this->status = status;
+	this->status_count++;
+	this->lock.unlock();
+	return NO_ERROR;
+}
+
+DWORD FakeServiceManager::watchdog(void)
+{
+	this->lock.lock();
+	this->watchdog_count++;
+	this->lock.unlock();
+	return NO_ERROR;
+}
+
+DWORD FakeServiceManager::setStatusText(const char *text)
+{
+	this->lock.lock();
+	this->status_text = text;
+	this->lock.unlock();
+	return NO_ERROR;
+}
+
+DWORD FakeServiceManager::install(const char *name, const char *command)
+{
+	DWORD rc = ERROR_SERVICE_EXISTS;
+
+	this->lock.lock();
+	if (this->services.find(name) == this->services.end())
+	{
+		FakeService &service = this->services[name];
+		service.command = command;
+		service.interactive = false;
+		rc = NO_ERROR;
+	}
+	this->lock.unlock();
+	return rc;
+}
+
+DWORD FakeServiceManager::uninstall(const char *name)
+{
+	this->lock.lock();
+	size_t removed = this->services.erase(name);
+	this->lock.unlock();
+	return removed ? NO_ERROR : ERROR_SERVICE_DOES_NOT_EXIST;
+}
+
+bool FakeServiceManager::isInstalled(const char *name)
+{
+	this->lock.lock();
+	bool rc = (this->services.find(name) != this->services.end());
+	this->lock.unlock();
+	return rc;
+}
+
+DWORD FakeServiceManager::setDescription(const char *name, const char *description)
+{
+	DWORD rc = ERROR_SERVICE_DOES_NOT_EXIST;
+
+	this->lock.lock();
+	std::map<std::string, FakeService>::iterator i = this->services.find(name);
+	if (i != this->services.end())
+	{
+		i->second.description = description;
+		rc = NO_ERROR;
+	}
+	this->lock.unlock();
+	return rc;
+}
+
+DWORD FakeServiceManager::setInteractive(const char *name, bool interactive)
+{
+	DWORD rc = ERROR_SERVICE_DOES_NOT_EXIST;
+
+	this->lock.lock();
+	std::map<std::string, FakeService>::iterator i = this->services.find(name);
+	if (i != this->services.end())
+	{
+		i->second.interactive = interactive;
+		rc = NO_ERROR;
+	}
+	this->lock.unlock();
+	return rc;
+}
+
+DWORD FakeServiceManager::sendControl(DWORD opcode)
+{
+	this->lock.lock();
+	LPHANDLER_FUNCTION handler = this->handler;
+	this->lock.unlock();
+
+	if (!handler)
+	{
+		return ERROR_SERVICE_NOT_ACTIVE;
+	}
+
+	this->dispatch_lock.lock();
+	handler(opcode);
+	this->dispatch_lock.unlock();
+	return NO_ERROR;
+}
+
+SERVICE_STATUS FakeServiceManager::getStatus(void)
+{
+	this->lock.lock();
+	SERVICE_STATUS status = this->status;
+	this->lock.unlock();
+	return status;
+}
+
+unsigned long FakeServiceManager::getStatusCount(void)
+{
+	this->lock.lock();
+	unsigned long count = this->status_count;
+	this->lock.unlock();
+	return count;
+}
+
+unsigned long FakeServiceManager::getWatchdogCount(void)
+{
+	this->lock.lock();
+	unsigned long count = this->watchdog_count;
+	this->lock.unlock();
+	return count;
+}
+
+std::string FakeServiceManager::getStatusText(void)
+{
+	this->lock.lock();
+	std::string text = this->status_text;
+	this->lock.unlock();
+	return text;
+}
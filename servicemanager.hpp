@@ -0,0 +1,251 @@
+/*
+
+See License.txt to see what this project is licensed under.
+
+*/
+#ifndef _ServiceManager_h_
+#define _ServiceManager_h_
+
+#include <map>
+#include <string>
+
+#include "servicecompat.hpp"
+
+#define SERVICE_NAME_MAX_LEN 256
+
+// What ServiceBase needs from the operating system's service manager: run
+// the service, pass it control requests and be told its status. Returns
+// NO_ERROR or an error code, as GetLastError() would give on Windows.
+//
+class ServiceManager
+{
+public:
+    virtual ~ServiceManager() {}
+
+    // Run the service. service_main is called with the service name as
+    // argv[0], this returns when the service has stopped.
+    virtual DWORD startDispatcher(const char *name, LPSERVICE_MAIN_FUNCTION service_main) = 0;
+
+    // Called from service_main, handler gets the control requests from
+    // here on.
+    virtual DWORD registerHandler(const char *name, LPHANDLER_FUNCTION handler) = 0;
+
+    // Report the service status.
+    virtual DWORD setStatus(const SERVICE_STATUS &status) = 0;
+
+    // Say we're still alive, for service managers with a watchdog. It
+    // must be called at least every getWatchdogInterval() ms, 0 if there
+    // is no watchdog.
+    virtual DWORD watchdog(void) { return NO_ERROR; }
+    virtual DWORD getWatchdogInterval(void) { return 0; }
+
+    // A one line summary of what the service is doing, for service
+    // managers which show one.
+    virtual DWORD setStatusText(const char *text) { return NO_ERROR; }
+
+    // Add / remove the service to run command. install gives
+    // ERROR_SERVICE_EXISTS and uninstall ERROR_SERVICE_DOES_NOT_EXIST when
+    // there is nothing to do.
+    virtual DWORD install(const char *name, const char *command) = 0;
+    virtual DWORD uninstall(const char *name) = 0;
+    virtual bool isInstalled(const char *name) = 0;
+
+    // Change the settings of an installed service.
+    virtual DWORD setDescription(const char *name, const char *description) = 0;
+    virtual DWORD setInteractive(const char *name, bool interactive) = 0;
+
+    // The service manager of the platform we are running on.
+    static ServiceManager *create(void);
+};
+
+
+#ifdef _WIN32
+
+// A connection to the Service Control Manager and to the service being
+// worked on. The handles are opened when first needed, with only the
+// access asked for so far, and then kept until close(). Several calls
+// for the same service then cost a single connection.
+//
+class SCMSession
+{
+private:
+    SC_HANDLE manager;
+    DWORD manager_access;
+    bool owns_manager;
+
+    SC_HANDLE service;
+    DWORD service_access;
+    char service_name[SERVICE_NAME_MAX_LEN];
+
+private:
+    SCMSession(SCMSession&);
+
+public:
+    SCMSession();
+    ~SCMSession();
+
+    // Use an already open manager connection instead of opening one. It
+    // is not closed by the session, and must have the access needed.
+    void useManager(SC_HANDLE manager);
+
+    // The manager / named service with at least the access given, or
+    // NULL with GetLastError() set if they could not be opened.
+    SC_HANDLE getManager(DWORD access);
+    SC_HANDLE getService(const char *name, DWORD access);
+
+    // Keep a service handle we got from CreateService().
+    void setService(const char *name, SC_HANDLE service, DWORD access);
+
+    // Close the service handle, e.g. so a deleted service goes away.
+    void closeService(void);
+
+    // Close everything the session opened.
+    void close(void);
+};
+
+// The Windows Service Control Manager.
+//
+class Win32ServiceManager : public ServiceManager
+{
+private:
+    SCMSession scm;
+    char service_name[SERVICE_NAME_MAX_LEN];
+    SERVICE_TABLE_ENTRY dispatch_table[2];
+    SERVICE_STATUS_HANDLE status_handle;
+
+private:
+    Win32ServiceManager(Win32ServiceManager&);
+
+public:
+    // shared_manager: an already open SCM connection to use, for example
+    // when installing many services at once. The caller keeps ownership.
+    Win32ServiceManager(SC_HANDLE shared_manager = NULL);
+
+    DWORD startDispatcher(const char *name, LPSERVICE_MAIN_FUNCTION service_main);
+    DWORD registerHandler(const char *name, LPHANDLER_FUNCTION handler);
+    DWORD setStatus(const SERVICE_STATUS &status);
+
+    DWORD install(const char *name, const char *command);
+    DWORD uninstall(const char *name);
+    bool isInstalled(const char *name);
+
+    DWORD setDescription(const char *name, const char *description);
+    DWORD setInteractive(const char *name, bool interactive);
+};
+
+#else
+
+// systemd, or anything else speaking its notify protocol. The status is
+// sent as sd_notify() messages to the datagram socket in NOTIFY_SOCKET,
+// SIGTERM and SIGINT become SERVICE_CONTROL_STOP. Units are set up with
+// systemctl so there is no install / uninstall.
+//
+class SystemdServiceManager : public ServiceManager
+{
+private:
+    std::string socket_path;
+    int socket_fd;
+
+    LPHANDLER_FUNCTION handler;
+    sigset_t signals;
+    pthread_t signal_thread;
+    bool has_signal_thread;
+    bool stopping;
+    ServiceLock lock;
+
+    // From WATCHDOG_USEC, 0 if systemd isn't watching us:
+    unsigned long long watchdog_usec;
+
+private:
+    SystemdServiceManager(SystemdServiceManager&);
+
+    static void *signalWatcher(void *manager);
+    void stopSignalWatcher(void);
+
+public:
+    // socket_path: where to send notifications, NULL for NOTIFY_SOCKET.
+    // A leading '@' is an abstract socket name.
+    SystemdServiceManager(const char *socket_path = NULL);
+    ~SystemdServiceManager();
+
+    // Send a notify message e.g. "READY=1". Does nothing when there is
+    // no socket to send it to.
+    DWORD notify(const char *state);
+
+    DWORD startDispatcher(const char *name, LPSERVICE_MAIN_FUNCTION service_main);
+    DWORD registerHandler(const char *name, LPHANDLER_FUNCTION handler);
+    DWORD setStatus(const SERVICE_STATUS &status);
+
+    DWORD watchdog(void);
+    DWORD getWatchdogInterval(void);
+    DWORD setStatusText(const char *text);
+
+    DWORD install(const char *name, const char *command);
+    DWORD uninstall(const char *name);
+    bool isInstalled(const char *name);
+
+    DWORD setDescription(const char *name, const char *description);
+    DWORD setInteractive(const char *name, bool interactive);
+};
+
+#endif
+
+
+// An in-process stand in for the service manager, to exercise and load
+// test ServiceBase without one. startDispatcher() runs service_main on
+// the calling thread, so run it on its own thread and send controls from
+// another. Controls are delivered one at a time as the SCM does.
+//
+class FakeServiceManager : public ServiceManager
+{
+private:
+    struct FakeService
+    {
+        std::string command;
+        std::string description;
+        bool interactive;
+    };
+
+    ServiceLock lock;
+    ServiceLock dispatch_lock;
+    std::map<std::string, FakeService> services;
+    LPHANDLER_FUNCTION handler;
+    SERVICE_STATUS status;
+    unsigned long status_count;
+    unsigned long watchdog_count;
+    std::string status_text;
+
+private:
+    FakeServiceManager(FakeServiceManager&);
+
+public:
+    FakeServiceManager();
+
+    DWORD startDispatcher(const char *name, LPSERVICE_MAIN_FUNCTION service_main);
+    DWORD registerHandler(const char *name, LPHANDLER_FUNCTION handler);
+    DWORD setStatus(const SERVICE_STATUS &status);
+
+    DWORD watchdog(void);
+    DWORD setStatusText(const char *text);
+
+    DWORD install(const char *name, const char *command);
+    DWORD uninstall(const char *name);
+    bool isInstalled(const char *name);
+
+    DWORD setDescription(const char *name, const char *description);
+    DWORD setInteractive(const char *name, bool interactive);
+
+    // Deliver a control request to the registered handler. Gives
+    // ERROR_SERVICE_NOT_ACTIVE if there is no handler yet.
+    DWORD sendControl(DWORD opcode);
+
+    // The last status reported and how many have been reported.
+    SERVICE_STATUS getStatus(void);
+    unsigned long getStatusCount(void);
+
+    // How many watchdog calls there have been and the last status text.
+    unsigned long getWatchdogCount(void);
+    std::string getStatusText(void);
+};
+
+#endif